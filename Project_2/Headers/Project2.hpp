@@ -14,17 +14,31 @@
 #include <glm/gtc/quaternion.hpp>
 #include <GLFW/glfw3.h>
 
+// stb_dxt.h keeps its implementation inside its include guard, so it has to be asked for before the first include
+// (texture_container.hpp, through heightmap.hpp)
+#define STB_DXT_IMPLEMENTATION
+
 // Our own headers
 #include <shader.hpp>
 #include <camera.hpp>
 #include <heightmap.hpp>
+#include <terrain.hpp>
+#include <gpu_timer.hpp>
 #include <track.hpp>
 #include <model.hpp>
+#include <model_loader.hpp>
+#include <instance_buffer.hpp>
+#include <uniform_blocks.hpp>
+#include <image_decoder.hpp>
+#include <texture_streamer.hpp>
+#include <memory_usage.hpp>
 
 // Basic C++ and C headers
 #include <iostream>
 #include <string>
 #include <limits>
+#include <cstring>
+#include <cstdlib>
 
 #include <math.h>      
 
@@ -32,9 +46,18 @@
 # define M_PI           3.14159265358979323846  /* pi */
 
 // Reference: https://github.com/nothings/stb/blob/master/stb_image.h#L4
-// To use stb_image, add this in *one* C++ source file.
+// To use stb_image, add this in *one* C++ source file.  Decoding runs on several threads (image_decoder.hpp): without
+// failure strings stb_image doesn't write its failure reason global.
 #define STB_IMAGE_IMPLEMENTATION
+#define STBI_NO_FAILURE_STRINGS
 #include <stb_image.h>
+// mip filter of the texture container converter
+#define STB_IMAGE_RESIZE_IMPLEMENTATION
+#include <stb_image_resize.h>
+
+// global operator new that counts allocations, see alloc_counter.hpp
+#define ALLOC_COUNTER_IMPLEMENTATION
+#include <alloc_counter.hpp>
 
 
 
@@ -45,8 +68,25 @@ void scroll_callback(GLFWwindow* window, double xoffset, double yoffset);
 void processInput(GLFWwindow *window);
 unsigned int loadTexture(const char *path);
 unsigned int loadCubemap(std::vector<std::string> faces);
-void set_lighting(Shader shader, glm::vec3 * pointLightPositions);
-
+std::vector<std::string> scene_images();
+std::vector<glm::mat4> statue_matrices(const Track &track, int count);
+LightsBlock scene_lights(const glm::vec3 *pointLightPositions);
+
+
+// image files main loads itself (the models bring their own)
+const std::vector<std::string> skyboxFaces =
+{
+	"../Project_2/Media/skybox_new/left.png",
+	"../Project_2/Media/skybox_new/right.png",
+	"../Project_2/Media/skybox_new/top.png",
+	"../Project_2/Media/skybox_new/bottom.png",
+	"../Project_2/Media/skybox_new/back.png",
+	"../Project_2/Media/skybox_new/front.png"
+};
+const char *const heightmapImage = "../Project_2/Media/heightmaps/hflab4.jpg";
+const char *const containerImage = "../Project_2/Media/textures/container2_specular.png";
+const char *const railImage = "../Project_2/Media/textures/black.jpg";
+const char *const plankImage = "../Project_2/Media/textures/marble.jpg";
 
 // settings
 unsigned int SCR_WIDTH = 1280;
@@ -66,9 +106,11 @@ float framerate = 0.0f;
 
 // booleans for doing different things
 bool drawHeightmap = true;
+bool drawTerrainLOD = true;
 bool drawBoxes = true;
 bool quaterians = true;
 bool drawNormals = true;
+bool printStats = false;
 
 // Transformation Matrices
 glm::vec3 translation   = glm::vec3(0.0f, 0.0f, 0.0f);
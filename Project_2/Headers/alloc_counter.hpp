@@ -0,0 +1,56 @@
+#ifndef ALLOC_COUNTER_H
+#define ALLOC_COUNTER_H
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+// Counts heap allocations made through global operator new, to check that hot paths (like drawing) don't allocate.
+//   Read allocation_count() before and after the code in question.  The counting operators replace the global ones,
+//   so, like stb_image, define ALLOC_COUNTER_IMPLEMENTATION in *one* C++ source file before including this.
+
+extern std::atomic<unsigned long long> allocationCounter;
+
+inline unsigned long long allocation_count()
+{
+	return allocationCounter.load(std::memory_order_relaxed);
+}
+
+#ifdef ALLOC_COUNTER_IMPLEMENTATION
+std::atomic<unsigned long long> allocationCounter(0);
+
+void *operator new(std::size_t size)
+{
+	allocationCounter.fetch_add(1, std::memory_order_relaxed);
+	void *p = std::malloc(size ? size : 1);
+	if (!p)
+		throw std::bad_alloc();
+	return p;
+}
+
+void *operator new[](std::size_t size)
+{
+	return operator new(size);
+}
+
+void operator delete(void *p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept
+{
+	std::free(p);
+}
+
+void operator delete[](void *p, std::size_t) noexcept
+{
+	std::free(p);
+}
+#endif
+#endif
@@ -0,0 +1,230 @@
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define FRUSTUM_SSE 1
+#endif
+
+// View frustum as six planes (a,b,c,d with a*x + b*y + c*z + d >= 0 inside), pulled straight out of projection * view
+//   Reference: Gribb & Hartmann, "Fast Extraction of Viewing Frustum Planes from the World-View-Projection Matrix"
+class Frustum
+{
+public:
+	// left, right, bottom, top, near, far
+	glm::vec4 planes[6];
+
+	Frustum() {}
+
+	Frustum(const glm::mat4 &viewProjection)
+	{
+		extract(viewProjection);
+	}
+
+	void extract(const glm::mat4 &m)
+	{
+		// glm is column major, so row i of the matrix is (m[0][i], m[1][i], m[2][i], m[3][i])
+		glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+		glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+		glm::vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+		glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+
+		planes[0] = row3 + row0;
+		planes[1] = row3 - row0;
+		planes[2] = row3 + row1;
+		planes[3] = row3 - row1;
+		planes[4] = row3 + row2;
+		planes[5] = row3 - row2;
+
+		// normalize so the plane equation gives real distances (needed for the sphere test)
+		for (int i = 0; i < 6; i++)
+			planes[i] /= glm::length(glm::vec3(planes[i]));
+	}
+
+	// true if the box is at least partly inside.  Only the corner furthest along each plane normal is tested.
+	bool intersects_aabb(const glm::vec3 &boxMin, const glm::vec3 &boxMax) const
+	{
+		for (int i = 0; i < 6; i++)
+		{
+			glm::vec3 p(planes[i].x >= 0.0f ? boxMax.x : boxMin.x,
+			            planes[i].y >= 0.0f ? boxMax.y : boxMin.y,
+			            planes[i].z >= 0.0f ? boxMax.z : boxMin.z);
+			if (glm::dot(glm::vec3(planes[i]), p) + planes[i].w < 0.0f)
+				return false;
+		}
+		return true;
+	}
+
+	bool intersects_sphere(const glm::vec3 &center, float radius) const
+	{
+		for (int i = 0; i < 6; i++)
+		{
+			if (glm::dot(glm::vec3(planes[i]), center) + planes[i].w < -radius)
+				return false;
+		}
+		return true;
+	}
+};
+
+// Axis aligned box and bounding sphere of a drawable, in its own space until transformed
+struct Bounds
+{
+	glm::vec3 boxMin, boxMax;
+	glm::vec3 center;
+	float radius;
+};
+
+// bounds of count positions (x, y, z floats, stride bytes apart): their box, and the sphere around the box centre
+inline Bounds bounds_of_points(const float *positions, size_t stride, size_t count)
+{
+	Bounds bounds;
+	bounds.boxMin = bounds.boxMax = bounds.center = glm::vec3(0.0f);
+	bounds.radius = 0.0f;
+	if (count == 0)
+		return bounds;
+	bounds.boxMin = bounds.boxMax = glm::vec3(positions[0], positions[1], positions[2]);
+	for (size_t i = 1; i < count; i++)
+	{
+		const float *p = (const float*)((const char*)positions + i * stride);
+		bounds.boxMin = glm::min(bounds.boxMin, glm::vec3(p[0], p[1], p[2]));
+		bounds.boxMax = glm::max(bounds.boxMax, glm::vec3(p[0], p[1], p[2]));
+	}
+	bounds.center = 0.5f * (bounds.boxMin + bounds.boxMax);
+	float radius2 = 0.0f;
+	for (size_t i = 0; i < count; i++)
+	{
+		const float *p = (const float*)((const char*)positions + i * stride);
+		glm::vec3 d = glm::vec3(p[0], p[1], p[2]) - bounds.center;
+		radius2 = std::max(radius2, glm::dot(d, d));
+	}
+	bounds.radius = std::sqrt(radius2);
+	return bounds;
+}
+
+// bounds of a box (the sphere through its corners)
+inline Bounds bounds_of_box(const glm::vec3 &boxMin, const glm::vec3 &boxMax)
+{
+	Bounds bounds;
+	bounds.boxMin = boxMin;
+	bounds.boxMax = boxMax;
+	bounds.center = 0.5f * (boxMin + boxMax);
+	bounds.radius = 0.5f * glm::length(boxMax - boxMin);
+	return bounds;
+}
+
+// bounds enclosing a and b
+inline Bounds bounds_union(const Bounds &a, const Bounds &b)
+{
+	Bounds bounds;
+	bounds.boxMin = glm::min(a.boxMin, b.boxMin);
+	bounds.boxMax = glm::max(a.boxMax, b.boxMax);
+	bounds.center = 0.5f * (bounds.boxMin + bounds.boxMax);
+	bounds.radius = std::max(glm::length(a.center - bounds.center) + a.radius, glm::length(b.center - bounds.center) + b.radius);
+	return bounds;
+}
+
+// bounds under a model matrix: the box around the transformed box (centre moved, half extents through the absolute
+// matrix), and the sphere grown by the largest axis scale
+inline Bounds transform_bounds(const Bounds &bounds, const glm::mat4 &model)
+{
+	glm::vec3 center = 0.5f * (bounds.boxMin + bounds.boxMax), extent = 0.5f * (bounds.boxMax - bounds.boxMin);
+	glm::vec3 worldCenter = glm::vec3(model * glm::vec4(center, 1.0f));
+	glm::vec3 worldExtent(0.0f);
+	for (int column = 0; column < 3; column++)
+		worldExtent += glm::abs(glm::vec3(model[column])) * extent[column];
+
+	Bounds world;
+	world.boxMin = worldCenter - worldExtent;
+	world.boxMax = worldCenter + worldExtent;
+	world.center = glm::vec3(model * glm::vec4(bounds.center, 1.0f));
+	float scale = std::max(glm::length(glm::vec3(model[0])), std::max(glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))));
+	world.radius = bounds.radius * scale;
+	return world;
+}
+
+// One culling pass over everything a frame draws.  The render loop adds the world bounds of each object (add returns its
+// id), cull() tests all the boxes against the frustum and the draws check visible(id).  The boxes are stored as separate
+// min/max x/y/z arrays, so with SSE four of them are tested per plane at once: for a plane the corner furthest along its
+// normal takes max or min on each axis by the sign of the normal, the same choice for all four boxes.
+class FrustumCuller
+{
+public:
+	// counters of the last cull()
+	unsigned int tested, visibleCount;
+	// ids of the visible objects, in the order they were added
+	std::vector<unsigned int> visibleList;
+
+	FrustumCuller() : tested(0), visibleCount(0)
+	{
+	}
+
+	// start a frame (keeps the memory)
+	void clear()
+	{
+		minX.clear(); minY.clear(); minZ.clear();
+		maxX.clear(); maxY.clear(); maxZ.clear();
+		visibleFlags.clear();
+		visibleList.clear();
+	}
+
+	unsigned int add(const Bounds &worldBounds)
+	{
+		minX.push_back(worldBounds.boxMin.x); minY.push_back(worldBounds.boxMin.y); minZ.push_back(worldBounds.boxMin.z);
+		maxX.push_back(worldBounds.boxMax.x); maxY.push_back(worldBounds.boxMax.y); maxZ.push_back(worldBounds.boxMax.z);
+		return (unsigned int)minX.size() - 1;
+	}
+
+	void cull(const Frustum &frustum)
+	{
+		size_t count = minX.size();
+		visibleFlags.assign(count, 0);
+		visibleList.clear();
+		size_t i = 0;
+#ifdef FRUSTUM_SSE
+		for (; i + 4 <= count; i += 4)
+		{
+			__m128 outside = _mm_setzero_ps();
+			for (int p = 0; p < 6; p++)
+			{
+				const glm::vec4 &plane = frustum.planes[p];
+				__m128 x = _mm_loadu_ps(plane.x >= 0.0f ? &maxX[i] : &minX[i]);
+				__m128 y = _mm_loadu_ps(plane.y >= 0.0f ? &maxY[i] : &minY[i]);
+				__m128 z = _mm_loadu_ps(plane.z >= 0.0f ? &maxZ[i] : &minZ[i]);
+				__m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane.x), x), _mm_mul_ps(_mm_set1_ps(plane.y), y)),
+					_mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane.z), z), _mm_set1_ps(plane.w)));
+				outside = _mm_or_ps(outside, _mm_cmplt_ps(distance, _mm_setzero_ps()));
+			}
+			int mask = _mm_movemask_ps(outside);
+			for (int lane = 0; lane < 4; lane++)
+				visibleFlags[i + lane] = (mask & (1 << lane)) ? 0 : 1;
+		}
+#endif
+		for (; i < count; i++)
+			visibleFlags[i] = frustum.intersects_aabb(glm::vec3(minX[i], minY[i], minZ[i]), glm::vec3(maxX[i], maxY[i], maxZ[i])) ? 1 : 0;
+
+		for (i = 0; i < count; i++)
+		{
+			if (visibleFlags[i])
+				visibleList.push_back((unsigned int)i);
+		}
+		tested = (unsigned int)count;
+		visibleCount = (unsigned int)visibleList.size();
+	}
+
+	bool visible(unsigned int id) const
+	{
+		return id < visibleFlags.size() && visibleFlags[id] != 0;
+	}
+
+private:
+	std::vector<float> minX, minY, minZ, maxX, maxY, maxZ;
+	std::vector<unsigned char> visibleFlags;
+};
+#endif
@@ -0,0 +1,90 @@
+#ifndef GL_HANDLES_H
+#define GL_HANDLES_H
+
+#include <glad/glad.h>
+
+// Move-only owners of GL object names.  The object is deleted when its owner is destroyed or reset, and moving hands the
+// name over, so classes holding these can be moved into containers but never copied into a second (double) delete.
+//   GL objects can only be deleted while the context is current: objects that outlive the window (locals of main) have
+//   to be reset before glfwTerminate, which is what the delete_buffers() functions do.
+template <typename Traits>
+class GLHandle
+{
+public:
+	GLHandle() : id(0)
+	{
+	}
+
+	// take ownership of an existing name
+	explicit GLHandle(unsigned int name) : id(name)
+	{
+	}
+
+	GLHandle(GLHandle &&other) : id(other.id)
+	{
+		other.id = 0;
+	}
+
+	GLHandle &operator=(GLHandle &&other)
+	{
+		if (this != &other)
+		{
+			reset();
+			id = other.id;
+			other.id = 0;
+		}
+		return *this;
+	}
+
+	~GLHandle()
+	{
+		reset();
+	}
+
+	// a fresh object
+	static GLHandle create()
+	{
+		unsigned int name = 0;
+		Traits::create(&name);
+		return GLHandle(name);
+	}
+
+	unsigned int get() const { return id; }
+
+	// delete the object (if any) and own name instead
+	void reset(unsigned int name = 0)
+	{
+		if (id != 0)
+			Traits::destroy(id);
+		id = name;
+	}
+
+private:
+	unsigned int id;
+
+	GLHandle(const GLHandle&);
+	GLHandle &operator=(const GLHandle&);
+};
+
+struct VertexArrayTraits
+{
+	static void create(unsigned int *name) { glGenVertexArrays(1, name); }
+	static void destroy(unsigned int name) { glDeleteVertexArrays(1, &name); }
+};
+
+struct BufferTraits
+{
+	static void create(unsigned int *name) { glGenBuffers(1, name); }
+	static void destroy(unsigned int name) { glDeleteBuffers(1, &name); }
+};
+
+struct TextureTraits
+{
+	static void create(unsigned int *name) { glGenTextures(1, name); }
+	static void destroy(unsigned int name) { glDeleteTextures(1, &name); }
+};
+
+typedef GLHandle<VertexArrayTraits> VertexArrayHandle;
+typedef GLHandle<BufferTraits> BufferHandle;
+typedef GLHandle<TextureTraits> TextureHandle;
+#endif
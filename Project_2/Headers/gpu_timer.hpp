@@ -0,0 +1,66 @@
+#ifndef GPU_TIMER_H
+#define GPU_TIMER_H
+
+#include <glad/glad.h>
+
+// GPU time of a block of GL commands, measured with GL_TIME_ELAPSED queries.  A few queries are kept in flight and a
+// result is only read once the GPU has it, so timing never stalls the frame.  The value lags a couple of frames behind.
+//   Only one timer can be running at a time (GL allows one active GL_TIME_ELAPSED query).
+class GpuTimer
+{
+public:
+	// last finished measurement in milliseconds
+	double milliseconds;
+
+	// needs a current GL context
+	GpuTimer() : milliseconds(0.0), next(0), pending(0)
+	{
+		glGenQueries(QUERIES, queries);
+	}
+
+	void begin()
+	{
+		// every query is still in flight, wait for the oldest one rather than reusing it
+		if (pending == QUERIES)
+			collect(true);
+		glBeginQuery(GL_TIME_ELAPSED, queries[next]);
+	}
+
+	void end()
+	{
+		glEndQuery(GL_TIME_ELAPSED);
+		next = (next + 1) % QUERIES;
+		pending++;
+		collect(false);
+	}
+
+	void delete_queries()
+	{
+		glDeleteQueries(QUERIES, queries);
+	}
+
+private:
+	static const int QUERIES = 4;
+	unsigned int queries[QUERIES];
+	int next, pending;
+
+	// read back finished queries, oldest first
+	void collect(bool wait)
+	{
+		while (pending > 0)
+		{
+			unsigned int query = queries[(next - pending + QUERIES) % QUERIES];
+			GLint available = 0;
+			if (!wait)
+				glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+			if (!wait && !available)
+				return;
+			GLuint64 elapsed = 0;
+			glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+			milliseconds = double(elapsed) / 1.0e6;
+			pending--;
+			wait = false;
+		}
+	}
+};
+#endif
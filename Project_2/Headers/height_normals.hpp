@@ -0,0 +1,171 @@
+#ifndef HEIGHT_NORMALS_H
+#define HEIGHT_NORMALS_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <thread>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define HEIGHT_NORMALS_SSE 1
+#endif
+
+// Normals of a height grid from central differences
+//   n = normalize(-slope.x * (h[x+1][y] - h[x-1][y]), 1, -slope.y * (h[x][y+1] - h[x][y-1]))
+// Heights are x-major 0-65535 samples like Heightmap::heights (index x*width + y) and the edges repeat their last sample.
+// slope folds the vertical scale and the two cell spacing into one factor per axis.  Every normal only reads the grid,
+// so rows are independent and the result doesn't depend on triangle order.  Four normals along a row are done at once
+// with SSE where it is available, and big grids spread their rows over threads.
+
+// slope factors for a heightmap drawn at scale over [-1,1]x[0,1]x[-1,1] (pass scale = 1 for the local space normal)
+inline glm::vec2 height_normal_slope(int width, int height, const glm::vec3 &scale)
+{
+	// h = scale.y * sample / 65535, one cell = 2 * scale.x / (width - 1), the difference spans two cells
+	return glm::vec2(scale.y / 65535.0f * float(width - 1) / (4.0f * scale.x),
+	                 scale.y / 65535.0f * float(height - 1) / (4.0f * scale.z));
+}
+
+// normals of row x, written to separate x/y/z arrays of length height
+inline void height_normals_row(const unsigned short *heights, int width, int height, int x, const glm::vec2 &slope,
+	float *nx, float *ny, float *nz)
+{
+	const unsigned short *row = heights + x * width;
+	const unsigned short *up = heights + std::max(x - 1, 0) * width;
+	const unsigned short *down = heights + std::min(x + 1, width - 1) * width;
+
+	// edge columns (and everything when SSE is off) one at a time
+	struct Scalar
+	{
+		static void normal(const unsigned short *row, const unsigned short *up, const unsigned short *down, int height, int y,
+			const glm::vec2 &slope, float *nx, float *ny, float *nz)
+		{
+			float gx = -slope.x * (float(down[y]) - float(up[y]));
+			float gz = -slope.y * (float(row[std::min(y + 1, height - 1)]) - float(row[std::max(y - 1, 0)]));
+			float inv = 1.0f / std::sqrt(gx * gx + gz * gz + 1.0f);
+			nx[y] = gx * inv;
+			ny[y] = inv;
+			nz[y] = gz * inv;
+		}
+	};
+
+	Scalar::normal(row, up, down, height, 0, slope, nx, ny, nz);
+	int y = 1;
+#ifdef HEIGHT_NORMALS_SSE
+	const __m128i zero = _mm_setzero_si128();
+	const __m128 one = _mm_set1_ps(1.0f), half = _mm_set1_ps(0.5f), three = _mm_set1_ps(3.0f);
+	const __m128 sx = _mm_set1_ps(-slope.x), sz = _mm_set1_ps(-slope.y);
+	// the right neighbour of the last lane is y + 4, which has to stay inside the row
+	for (; y + 4 < height; y += 4)
+	{
+		__m128 u = _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i*)(up + y)), zero));
+		__m128 d = _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i*)(down + y)), zero));
+		__m128 l = _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i*)(row + y - 1)), zero));
+		__m128 r = _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i*)(row + y + 1)), zero));
+
+		__m128 gx = _mm_mul_ps(sx, _mm_sub_ps(d, u));
+		__m128 gz = _mm_mul_ps(sz, _mm_sub_ps(r, l));
+		// 1/sqrt from the estimate plus one Newton step (about 23 bits, much cheaper than sqrt and divide)
+		__m128 len2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(gx, gx), _mm_mul_ps(gz, gz)), one);
+		__m128 est = _mm_rsqrt_ps(len2);
+		__m128 inv = _mm_mul_ps(_mm_mul_ps(half, est), _mm_sub_ps(three, _mm_mul_ps(_mm_mul_ps(len2, est), est)));
+
+		_mm_storeu_ps(nx + y, _mm_mul_ps(gx, inv));
+		_mm_storeu_ps(ny + y, inv);
+		_mm_storeu_ps(nz + y, _mm_mul_ps(gz, inv));
+	}
+#endif
+	for (; y < height; y++)
+		Scalar::normal(row, up, down, height, y, slope, nx, ny, nz);
+}
+
+// normals of rows [first, last) as interleaved snorm16 (x, z) pairs, laid out like the heights
+inline void height_normals_rg16_rows(const unsigned short *heights, int width, int height, const glm::vec2 &slope, int first, int last, short *out)
+{
+	std::vector<float> nx(height), ny(height), nz(height);
+	for (int x = first; x < last; x++)
+	{
+		height_normals_row(heights, width, height, x, slope, &nx[0], &ny[0], &nz[0]);
+		short *dst = out + 2 * (size_t)x * height;
+		int y = 0;
+#ifdef HEIGHT_NORMALS_SSE
+		const __m128 range = _mm_set1_ps(32767.0f);
+		for (; y + 8 <= height; y += 8)
+		{
+			__m128i x16 = _mm_packs_epi32(_mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(&nx[y]), range)),
+			                              _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(&nx[y + 4]), range)));
+			__m128i z16 = _mm_packs_epi32(_mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(&nz[y]), range)),
+			                              _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(&nz[y + 4]), range)));
+			_mm_storeu_si128((__m128i*)(dst + 2 * y), _mm_unpacklo_epi16(x16, z16));
+			_mm_storeu_si128((__m128i*)(dst + 2 * y + 8), _mm_unpackhi_epi16(x16, z16));
+		}
+#endif
+		for (; y < height; y++)
+		{
+			dst[2 * y] = (short)std::lround(nx[y] * 32767.0f);
+			dst[2 * y + 1] = (short)std::lround(nz[y] * 32767.0f);
+		}
+	}
+}
+
+// normals of the whole grid for an RG16_SNORM texture.  y is always positive, so the shader gets it back as
+// sqrt(1 - x^2 - z^2).  Large grids are split into bands of rows, one per hardware thread.
+inline void height_normals_rg16(const unsigned short *heights, int width, int height, const glm::vec2 &slope, short *out)
+{
+	int threads = (int)std::max(1u, std::thread::hardware_concurrency());
+	if ((size_t)width * height < 1024 * 1024)
+		threads = 1;
+	int band = (width + threads - 1) / threads;
+
+	std::vector<std::thread> workers;
+	for (int first = band; first < width; first += band)
+		workers.push_back(std::thread(height_normals_rg16_rows, heights, width, height, slope, first, std::min(first + band, width), out));
+	height_normals_rg16_rows(heights, width, height, slope, 0, std::min(band, width), out);
+	for (unsigned int i = 0; i < workers.size(); i++)
+		workers[i].join();
+}
+
+// time the RG16 normal pass on a size x size grid against a plain per-sample loop (run with --benchmark-normals)
+inline void benchmark_normals(int size)
+{
+	std::vector<unsigned short> heights((size_t)size * size);
+	for (int x = 0; x < size; x++)
+		for (int y = 0; y < size; y++)
+			heights[(size_t)x * size + y] = (unsigned short)(32767.5f + 16000.0f * std::sin(x * 0.013f) * std::cos(y * 0.021f) + float((x * 7919 + y * 104729) & 1023));
+	glm::vec2 slope = height_normal_slope(size, size, glm::vec3(1.0f));
+	std::vector<short> fast((size_t)size * size * 2), plain((size_t)size * size * 2);
+
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+	for (int x = 0; x < size; x++)
+	{
+		for (int y = 0; y < size; y++)
+		{
+			const unsigned short *h = &heights[0];
+			float dx = float(h[std::min(x + 1, size - 1) * size + y]) - float(h[std::max(x - 1, 0) * size + y]);
+			float dy = float(h[x * size + std::min(y + 1, size - 1)]) - float(h[x * size + std::max(y - 1, 0)]);
+			glm::vec3 n = glm::normalize(glm::vec3(-slope.x * dx, 1.0f, -slope.y * dy));
+			plain[2 * ((size_t)x * size + y)] = (short)std::lround(n.x * 32767.0f);
+			plain[2 * ((size_t)x * size + y) + 1] = (short)std::lround(n.z * 32767.0f);
+		}
+	}
+	std::chrono::high_resolution_clock::time_point middle = std::chrono::high_resolution_clock::now();
+	height_normals_rg16(&heights[0], size, size, slope, &fast[0]);
+	std::chrono::high_resolution_clock::time_point end = std::chrono::high_resolution_clock::now();
+
+	int maxDiff = 0;
+	for (size_t i = 0; i < fast.size(); i++)
+		maxDiff = std::max(maxDiff, std::abs(int(fast[i]) - int(plain[i])));
+#ifdef HEIGHT_NORMALS_SSE
+	const char *kernel = "SSE";
+#else
+	const char *kernel = "scalar";
+#endif
+	std::printf("Normals for %dx%d heights: per sample %.1f ms, %s rows on %u threads %.1f ms (largest difference %d/32767)\n", size, size,
+		std::chrono::duration<double, std::milli>(middle - start).count(), kernel, std::max(1u, std::thread::hardware_concurrency()),
+		std::chrono::duration<double, std::milli>(end - middle).count(), maxDiff);
+}
+#endif
@@ -6,9 +6,18 @@
 #include <glm/gtc/matrix_transform.hpp>
 
 #include <vector>
+#include <algorithm>
 #include <iostream>
+#include <cstdio>
 
 #include <shader.hpp>
+#include <rtin.hpp>
+#include <height_normals.hpp>
+#include <vertex_cache.hpp>
+#include <gl_handles.hpp>
+#include <texture_cache.hpp>
+#include <frustum.hpp>
+#include <vertex_packing.hpp>
 
 // Reference: https://github.com/nothings/stb/blob/master/stb_image.h#L4
 // To use stb_image, add this in *one* C++ source file.
@@ -30,44 +39,101 @@ public:
 	int width, height;
 
 	// VAO for Heightmap
-	unsigned int VAO;
+	VertexArrayHandle VAO;
+	// the heightmap image as a texture, from the texture cache (uploaded from the same decode as the heights)
+	unsigned int texture;
 
-	// pointer to data
-	unsigned char *data;
+	// height samples kept after loading (x-major like make_vertex, 0-65535).  The LOD terrain samples these.
+	std::vector<unsigned short> heights;
+
+	// placement of the [-1,1]x[0,1]x[-1,1] heightmap in the world
+	glm::vec3 offset = glm::vec3(7.0f, -15.0f, 0.0f);
+	glm::vec3 scale = glm::vec3(30.0f, 15.0f, 30.0f);
+	// of the [-1,1]x[0,1]x[-1,1] grid between its lowest and highest sample (model_matrix() places it)
+	Bounds bounds;
 
 	// Heightmap data
 	std::vector<Vertex> vertices;
 	// indices for EBO
 	std::vector<unsigned int> indices;
-
-
-	// constructor
-	Heightmap(const char* heightmapPath)
+	// triangles drawn * 3, stays valid after release_cpu_data
+	unsigned int indexCount;
+	// how the GPU copy of the vertices is stored: PackedVertex (16 bytes) or Vertex (32), see vertex_packing.hpp
+	bool packVertices;
+	VertexQuantization quantization;
+
+
+	// constructor.  buildMesh = false only keeps the height samples (for the LOD terrain) and skips the mesh.
+	//   maxError > 0 decimates the mesh so it stays within maxError (in 8 bit height steps) of the full grid.
+	//   cacheOrder = false keeps the plain triangle order (to compare the vertex cache ordering against)
+	//   packVertices = false uploads the float vertices instead of the quantized ones
+	Heightmap(const char* heightmapPath, bool buildMesh = true, float maxError = 0.0f, bool cacheOrder = true, bool packVertices = true)
+		: texture(0), indexCount(0), packVertices(packVertices), quantization(VertexQuantization::identity())
 	{
 		// load Heightmap data
+		bounds = bounds_of_box(glm::vec3(-1.0f, 0.0f, -1.0f), glm::vec3(1.0f));
 		load_heightmap(heightmapPath);
 
-		// create Heightmap verts from the data
-		create_heightmap();
+		if (heights.empty())
+			return;
+		std::pair<std::vector<unsigned short>::const_iterator, std::vector<unsigned short>::const_iterator> range = std::minmax_element(heights.begin(), heights.end());
+		bounds = bounds_of_box(glm::vec3(-1.0f, *range.first / 65535.0f, -1.0f), glm::vec3(1.0f, *range.second / 65535.0f, 1.0f));
+
+		if (!buildMesh)
+			return;
 
-		// free image data
-		stbi_image_free(data);
+		if (maxError > 0.0f)
+		{
+			create_decimated(maxError);
+		}
+		else
+		{
+			// create Heightmap verts from the data
+			create_heightmap();
+			compute_normals();
 
-		// create_indices - not using since normals are needed
-		create_indices();
+			create_indices();
+		}
+
+		if (cacheOrder)
+			optimize_indices(maxError > 0.0f);
 
 		setup_heightmap();
 	}
 
+	// normalized height of grid point (x, y), same indexing as make_vertex
+	float get_height(int x, int y) const
+	{
+		return float(heights[x*width + y]) / 65535.0f;
+	}
+
+	// bilinear height between grid points
+	float sample_height(float x, float y) const
+	{
+		x = glm::clamp(x, 0.0f, float(width - 1));
+		y = glm::clamp(y, 0.0f, float(height - 1));
+		int x0 = glm::min(int(x), width - 2), y0 = glm::min(int(y), height - 2);
+		float fx = x - x0, fy = y - y0;
+		return glm::mix(glm::mix(get_height(x0, y0), get_height(x0, y0 + 1), fy),
+		                glm::mix(get_height(x0 + 1, y0), get_height(x0 + 1, y0 + 1), fy), fx);
+	}
+
+	// placement of the grid in the world
+	glm::mat4 model_matrix() const
+	{
+		glm::mat4 heightmap_model;
+		heightmap_model = glm::translate(heightmap_model, offset);
+		heightmap_model = glm::scale(heightmap_model, scale);
+		return heightmap_model;
+	}
+
 	// render the mesh
 	void Draw(Shader shader, unsigned int textureID)
 	{
 		// Set the shader properties
 		shader.use();
-		glm::mat4 heightmap_model;
-		heightmap_model = glm::translate(heightmap_model, glm::vec3(7.0f, -15.0f, 0.0f));
-		heightmap_model = glm::scale(heightmap_model, glm::vec3(30.0f, 15.0f, 30.0f));
-		shader.setMat4("model", heightmap_model);
+		shader.setMat4("model", model_matrix());
+		quantization.apply(shader);
 
 
 		// Set material properties
@@ -78,37 +144,65 @@ public:
 		// active proper texture unit before binding
 		glActiveTexture(GL_TEXTURE0);
 		// and finally bind the textures
-		glBindTexture(GL_TEXTURE_2D, textureID);
+		bind_texture(GL_TEXTURE_2D, textureID);
 
 		// draw mesh
-		glBindVertexArray(VAO);
-		glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
+		glBindVertexArray(VAO.get());
+		glDrawElements(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, 0);
 		glBindVertexArray(0);
 
 		// always good practice to set everything back to defaults once configured.
 		glActiveTexture(GL_TEXTURE0);
 	}
 
+	// free the mesh vertices and indices once they are on the GPU (the height samples stay, the terrain reads them)
+	void release_cpu_data()
+	{
+		std::vector<Vertex>().swap(vertices);
+		std::vector<unsigned int>().swap(indices);
+	}
+
 	void delete_buffers()
 	{
-		glDeleteVertexArrays(1, &VAO);
-		glDeleteBuffers(1, &VBO);
-		glDeleteBuffers(1, &EBO);
+		VAO.reset();
+		VBO.reset();
+		EBO.reset();
+		if (texture)
+			texture_cache().release(texture);
+		texture = 0;
 	}
 
 private:
 
 	/*  Render data  */
-	unsigned int VBO , EBO;
+	BufferHandle VBO , EBO;
 
 	void load_heightmap(const char* heightmapPath)
 	{
-		int nrChannels;
-		data = stbi_load(heightmapPath, &width, &height, &nrChannels, 0);
-		if (!data)
+		// hold the decoded image while the texture is made from it, so the file is decoded once for both
+		DecodedImage image = texture_cache().acquire_pixels(heightmapPath);
+		texture = texture_cache().acquire(heightmapPath);
+		if (!image.pixels)
 		{
 			std::cout << "Failed to load heightmap" << std::endl;
+			texture_cache().release_pixels(heightmapPath);
+			width = height = 0;
+			return;
 		}
+		width = image.width;
+		height = image.height;
+
+		// only one channel is used: RGB maps (moon.png, spiral.jpg) collapse to grey with stb_image's weights, then
+		// widen to 16 bits (255 * 257 = 65535)
+		int n = image.components;
+		heights.resize(width * height);
+		for (int i = 0; i < width * height; i++)
+		{
+			const unsigned char *p = image.pixels + (size_t)i * n;
+			int grey = n < 3 ? p[0] : (p[0] * 77 + p[1] * 150 + p[2] * 29) >> 8;
+			heights[i] = (unsigned short)(grey * 257);
+		}
+		texture_cache().release_pixels(heightmapPath);
 	}
 
 
@@ -119,10 +213,10 @@ private:
 		Vertex v;
 		//XYZ coords
 		v.Position.x = 2.0f*(float(x) / float(width - 1)) - 1.0f;
-		v.Position.y = float(data[x*width + y]) / 255.0f;
+		v.Position.y = get_height(x, y);
 		v.Position.z = 2.0f*(float(y) / float(height - 1)) - 1.0f;
 
-		// Setting normal to default, calculate later.  
+		// Setting normal to default, compute_normals fills it in
 		v.Normal = glm::vec3(0.0f, 0.0f, 0.0f);
 
 		//Texture Coords
@@ -133,6 +227,44 @@ private:
 
 
 
+	// vertex at a fractional grid position (decimated mesh), with the same central difference normal as compute_normals
+	Vertex make_vertex(float x, float y)
+	{
+		Vertex v;
+		v.Position.x = 2.0f*(x / float(width - 1)) - 1.0f;
+		v.Position.y = sample_height(x, y);
+		v.Position.z = 2.0f*(y / float(height - 1)) - 1.0f;
+
+		float dx = 4.0f / float(width - 1), dz = 4.0f / float(height - 1);
+		v.Normal = glm::normalize(glm::vec3(-(sample_height(x + 1.0f, y) - sample_height(x - 1.0f, y)) / dx, 1.0f,
+		                                    -(sample_height(x, y + 1.0f) - sample_height(x, y - 1.0f)) / dz));
+
+		v.TexCoords.x = x / float(width - 1);
+		v.TexCoords.y = y / float(height - 1);
+		return v;
+	}
+
+	// RTIN mesh instead of the full grid.  Vertices are shared between triangles, so it goes straight into setup_heightmap.
+	void create_decimated(float maxError)
+	{
+		Rtin rtin(heights, width, height);
+
+		// how far the mesh shrinks at a few tolerances
+		const float tolerances[] = { 0.5f, 1.0f, 2.0f, 4.0f, 8.0f };
+		std::printf("Heightmap %dx%d: %d triangles at full resolution\n", width, height, 2 * (width - 1) * (height - 1));
+		for (int i = 0; i < 5; i++)
+		{
+			unsigned int count = rtin.triangle_count(tolerances[i] / 255.0f);
+			std::printf("  error %.1f: %u triangles (%.1fx fewer)\n", tolerances[i], count, 2.0f * (width - 1) * (height - 1) / count);
+		}
+
+		std::vector<glm::vec2> grid;
+		rtin.create_mesh(maxError / 255.0f, grid, indices);
+		for (unsigned int i = 0; i < grid.size(); i++)
+			vertices.push_back(make_vertex(grid[i].x, grid[i].y));
+		std::printf("  using error %.1f: %u vertices, %u triangles\n", maxError, (unsigned int)vertices.size(), (unsigned int)indices.size() / 3);
+	}
+
 	void create_heightmap()
 	{
 		// convert heightmap to floats and set texture coordinates
@@ -146,21 +278,23 @@ private:
 		}
 	}
 
-	// Find the normal for each triangle uisng the cross product and then add it to all three vertices of the triangle.  
-	//   The normalization of all the triangles happens in the shader which averages all norms of adjacent triangles.   
-	//   Order of the triangles matters here since you want to normal facing out of the object.  
-	void set_normals(Vertex &p1, Vertex &p2, Vertex &p3)
+	// Normals straight from the height grid (central differences, see height_normals.hpp), so they don't depend on
+	//   the triangles.  Vertices are in grid order, one row of x at a time.
+	void compute_normals()
 	{
-		glm::vec3 normal =  glm::cross(p2.Position - p1.Position, p3.Position - p1.Position);
-		p1.Normal += normal;
-		p2.Normal += normal;
-		p3.Normal += normal;
+		glm::vec2 slope = height_normal_slope(width, height, glm::vec3(1.0f));
+		std::vector<float> nx(height), ny(height), nz(height);
+		for (int x = 0; x < width; x++)
+		{
+			height_normals_row(&heights[0], width, height, x, slope, &nx[0], &ny[0], &nz[0]);
+			for (int y = 0; y < height; y++)
+				vertices[x*width + y].Normal = glm::vec3(nx[y], ny[y], nz[y]);
+		}
 	}
 
-
 	void create_indices()
 	{
-		// convert heightmap to floats and set texture coordinates.  Also set normals for each triangle we define.
+		// two triangles per grid cell
 		for (int x = 0; x < width - 1; x++)
 		{
 			for (int y = 0; y < height - 1; y++)
@@ -177,41 +311,66 @@ private:
 				indices.push_back(b); // 1
 				indices.push_back(c); // 3
 
-				//while here, add normals. 
-				set_normals(vertices[a], vertices[b], vertices[c]);
-
 				// Triangle 2
 				indices.push_back(b); // 1
 				indices.push_back(d); // 2
 				indices.push_back(c); // 3
-
-				//And again, add normals. 
-				set_normals(vertices[b], vertices[d], vertices[c]);
- 
 			}
 
 		}
 	}
 	
 
+	// Reorder the triangles for the post-transform vertex cache (strips for the full grid, Tipsify for the decimated
+	//   mesh) and then the vertices in the order they are used.  After this vertices are no longer in grid order.
+	void optimize_indices(bool decimated)
+	{
+		float before = vertex_cache_acmr(&indices[0], indices.size(), vertices.size());
+		if (decimated)
+		{
+			optimize_vertex_cache(&indices[0], indices.size(), vertices.size());
+		}
+		else
+		{
+			indices.clear();
+			grid_cache_indices(width - 1, height - 1, width, 0, indices);
+		}
+		optimize_vertex_fetch(vertices, &indices[0], indices.size());
+		std::printf("Heightmap vertex cache: ACMR %.3f -> %.3f (%d entry FIFO)\n", before,
+			vertex_cache_acmr(&indices[0], indices.size(), vertices.size()), VERTEX_CACHE_SIZE);
+	}
+
 	void setup_heightmap()
 	{
 		// create buffers/arrays
-		glGenVertexArrays(1, &VAO);
-		glGenBuffers(1, &VBO);
-		glGenBuffers(1, &EBO);
+		VAO = VertexArrayHandle::create();
+		VBO = BufferHandle::create();
+		EBO = BufferHandle::create();
+		indexCount = (unsigned int)indices.size();
+
+		glBindVertexArray(VAO.get());
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO.get());
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
 
-		glBindVertexArray(VAO);
 		// load data into vertex buffers
-		glBindBuffer(GL_ARRAY_BUFFER, VBO);
+		glBindBuffer(GL_ARRAY_BUFFER, VBO.get());
+		if (packVertices)
+		{
+			VertexPackingError error = VertexPackingError();
+			quantization = vertex_quantization(&vertices[0], vertices.size());
+			std::vector<PackedVertex> packed = pack_vertices(&vertices[0], vertices.size(), quantization, error);
+			glBufferData(GL_ARRAY_BUFFER, packed.size() * sizeof(PackedVertex), &packed[0], GL_STATIC_DRAW);
+			setup_packed_vertex_attributes();
+			print_vertex_packing("Heightmap", error, quantization, sizeof(Vertex), sizeof(PackedVertex));
+			glBindVertexArray(0);
+			return;
+		}
+
 		// A great thing about structs is that their memory layout is sequential for all its items.
 		// The effect is that we can simply pass a pointer to the struct and it translates perfectly to a glm::vec3/3/2 array which
 		// again translates to 3/3/2 floats which translates to a byte array.
 		glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
 
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
-
 		// set the vertex attribute pointers
 		// vertex Positions
 		glEnableVertexAttribArray(0);
@@ -0,0 +1,174 @@
+#ifndef IMAGE_DECODER_H
+#define IMAGE_DECODER_H
+
+#include <stb_image.h>
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+// 8 bit pixels as stb_image decodes them (NULL if the file couldn't be read)
+struct DecodedImage
+{
+	int width, height, components;
+	unsigned char *pixels;
+};
+
+// A pool of threads decoding image files with stb_image.  decode() queues a file and returns a future of its pixels,
+// so a loader can queue everything it needs up front and pick the images up (and upload them on the GL thread) in
+// whatever order it likes.  The receiver of an image frees its pixels with stbi_image_free.
+//   The vendored stb_image (v2.14) is only safe to run on several threads at once because of two things done here and
+// in Project2.hpp, and nothing else may decode while the workers do (every decode in the program goes through them):
+//   - its fixed Huffman tables are filled in lazily by the first decode that needs them, so the constructor does one
+//     such decode before it starts the workers (prime_stb_image);
+//   - failures are recorded in a plain global, so the implementation is compiled with STBI_NO_FAILURE_STRINGS and
+//     stbi_failure_reason() is never asked.  The per-process settings (stbi_set_flip_vertically_on_load and the like)
+//     are left alone.
+// Later stb_image releases have const tables and STBI_THREAD_LOCAL, which make both unnecessary.
+class ImageDecoder
+{
+public:
+	// threads = 0 uses one per hardware thread
+	explicit ImageDecoder(unsigned int threads = 0) : decoded(0), busyMicroseconds(0), stopping(false)
+	{
+		if (threads == 0)
+			threads = std::max(1u, std::thread::hardware_concurrency());
+		prime_stb_image();
+		for (unsigned int t = 0; t < threads; t++)
+			workers.push_back(std::thread(&ImageDecoder::work, this));
+	}
+
+	~ImageDecoder()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		for (unsigned int t = 0; t < workers.size(); t++)
+			workers[t].join();
+	}
+
+	// queue a file, channels as stbi_load's req_comp (0 keeps the file's own)
+	std::future<DecodedImage> decode(const std::string &path, int channels = 0)
+	{
+		std::shared_ptr<std::packaged_task<DecodedImage()> > task(new std::packaged_task<DecodedImage()>(
+			[this, path, channels]() { return load(path, channels); }));
+		std::future<DecodedImage> result = task->get_future();
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			queue.push_back(task);
+		}
+		wake.notify_one();
+		return result;
+	}
+
+	// queue several files at once (the six faces of a cube map), the futures are in the same order
+	std::vector<std::future<DecodedImage> > decode_all(const std::vector<std::string> &paths, int channels = 0)
+	{
+		std::vector<std::future<DecodedImage> > results;
+		for (unsigned int i = 0; i < paths.size(); i++)
+			results.push_back(decode(paths[i], channels));
+		return results;
+	}
+
+	unsigned int threads() const
+	{
+		return (unsigned int)workers.size();
+	}
+
+	// images decoded so far and the time the workers spent on them together
+	unsigned int decoded_count() const
+	{
+		return decoded;
+	}
+
+	double busy_milliseconds() const
+	{
+		return busyMicroseconds / 1000.0;
+	}
+
+private:
+	std::vector<std::thread> workers;
+	std::deque<std::shared_ptr<std::packaged_task<DecodedImage()> > > queue;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::atomic<unsigned int> decoded;
+	std::atomic<long long> busyMicroseconds;
+	bool stopping;
+
+	void work()
+	{
+		for (;;)
+		{
+			std::shared_ptr<std::packaged_task<DecodedImage()> > task;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wake.wait(lock, [this]() { return stopping || !queue.empty(); });
+				if (queue.empty())
+					return;
+				task = queue.front();
+				queue.pop_front();
+			}
+			(*task)();
+		}
+	}
+
+	// inflate an empty zlib stream made of one fixed Huffman block, which fills stb_image's fixed tables in before any
+	// worker can race on them
+	static void prime_stb_image()
+	{
+		static const char fixedBlock[] = { 0x78, (char)0x9c, 0x03, 0x00, 0x00, 0x00, 0x00, 0x01 };
+		int length = 0;
+		char *inflated = stbi_zlib_decode_malloc(fixedBlock, sizeof(fixedBlock), &length);
+		stbi_image_free(inflated);
+	}
+
+	DecodedImage load(const std::string &path, int channels)
+	{
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		DecodedImage image;
+		image.pixels = stbi_load(path.c_str(), &image.width, &image.height, &image.components, channels);
+		busyMicroseconds += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - start).count();
+		decoded++;
+		return image;
+	}
+};
+
+// the pool every loader shares
+inline ImageDecoder &image_decoder()
+{
+	static ImageDecoder decoder;
+	return decoder;
+}
+
+// decode a set of images on 1 thread and on every hardware thread and print both times (run with --benchmark-decode)
+inline void benchmark_image_decode(const std::vector<std::string> &paths)
+{
+	unsigned int counts[2] = { 1, std::max(1u, std::thread::hardware_concurrency()) };
+	for (int run = 0; run < 2; run++)
+	{
+		ImageDecoder decoder(counts[run]);
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		std::vector<std::future<DecodedImage> > images = decoder.decode_all(paths);
+		size_t bytes = 0;
+		for (unsigned int i = 0; i < images.size(); i++)
+		{
+			DecodedImage image = images[i].get();
+			bytes += (size_t)image.width * image.height * image.components;
+			stbi_image_free(image.pixels);
+		}
+		std::printf("Decoded %u images (%.1f MB of pixels) on %u threads in %.1f ms\n", (unsigned int)paths.size(), bytes / (1024.0 * 1024.0),
+			decoder.threads(), std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count());
+	}
+}
+#endif
@@ -0,0 +1,64 @@
+#ifndef INSTANCE_BUFFER_H
+#define INSTANCE_BUFFER_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <gl_handles.hpp>
+
+#include <vector>
+
+// Model matrices of an instanced draw (Model::DrawInstanced) in a GL buffer, one glm::mat4 per instance.
+class InstanceBuffer
+{
+public:
+	GLsizei count;	// instances in the buffer
+
+	InstanceBuffer() : count(0), capacity(0)
+	{
+	}
+
+	// replace the matrices.  The buffer only grows; otherwise its storage is orphaned first, so updating it every frame
+	// doesn't wait for draws still reading last frame's matrices.
+	void update(const glm::mat4 *matrices, size_t instances)
+	{
+		if (buffer.get() == 0)
+			buffer = BufferHandle::create();
+		glBindBuffer(GL_ARRAY_BUFFER, buffer.get());
+		if (instances > capacity)
+		{
+			capacity = instances;
+			glBufferData(GL_ARRAY_BUFFER, capacity * sizeof(glm::mat4), matrices, GL_DYNAMIC_DRAW);
+		}
+		else
+		{
+			glBufferData(GL_ARRAY_BUFFER, capacity * sizeof(glm::mat4), NULL, GL_DYNAMIC_DRAW);
+			if (instances > 0)
+				glBufferSubData(GL_ARRAY_BUFFER, 0, instances * sizeof(glm::mat4), matrices);
+		}
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		count = (GLsizei)instances;
+	}
+
+	void update(const std::vector<glm::mat4> &matrices)
+	{
+		update(matrices.empty() ? NULL : &matrices[0], matrices.size());
+	}
+
+	GLuint get() const
+	{
+		return buffer.get();
+	}
+
+	void delete_buffers()
+	{
+		buffer.reset();
+		count = 0;
+		capacity = 0;
+	}
+
+private:
+	BufferHandle buffer;
+	size_t capacity;	// matrices the buffer has room for
+};
+#endif
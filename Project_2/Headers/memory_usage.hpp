@@ -0,0 +1,36 @@
+#ifndef MEMORY_USAGE_H
+#define MEMORY_USAGE_H
+
+#include <cstddef>
+#include <cstdio>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN 1
+#endif
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <unistd.h>
+#endif
+
+// resident set size of this process in bytes (physical memory in use), 0 if it can't be read
+inline size_t resident_set_size()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return 0;
+	return counters.WorkingSetSize;
+#else
+	// second field of statm: resident pages
+	unsigned long size = 0, resident = 0;
+	FILE *file = std::fopen("/proc/self/statm", "r");
+	if (!file)
+		return 0;
+	int read = std::fscanf(file, "%lu %lu", &size, &resident);
+	std::fclose(file);
+	return read == 2 ? (size_t)resident * (size_t)sysconf(_SC_PAGESIZE) : 0;
+#endif
+}
+#endif
@@ -8,6 +8,11 @@
 #include <glm/gtc/matrix_transform.hpp>
 
 #include <shader.hpp>
+#include <gl_handles.hpp>
+#include <texture_paths.hpp>
+#include <texture_cache.hpp>
+#include <frustum.hpp>
+#include <vertex_packing.hpp>
 
 #include <string>
 #include <fstream>
@@ -29,111 +34,237 @@ struct VertexModel {
 	glm::vec3 Bitangent;
 };
 
+// what a texture is for, selects the sampler it is bound to
+enum TextureType : unsigned char
+{
+	TEXTURE_DIFFUSE,
+	TEXTURE_SPECULAR,
+	TEXTURE_NORMAL,
+	TEXTURE_HEIGHT,
+	TEXTURE_TYPE_COUNT
+};
+
+// sampler name prefix of a type (the shaders use texture_diffuseN, texture_specularN, ...)
+inline const char *texture_type_name(TextureType type)
+{
+	static const char *names[TEXTURE_TYPE_COUNT] = { "texture_diffuse", "texture_specular", "texture_normal", "texture_height" };
+	return type < TEXTURE_TYPE_COUNT ? names[type] : names[TEXTURE_DIFFUSE];
+}
+
+inline TextureType texture_type_from_name(const string &name)
+{
+	for (int type = 0; type < TEXTURE_TYPE_COUNT; type++)
+	{
+		if (name == texture_type_name((TextureType)type))
+			return (TextureType)type;
+	}
+	return TEXTURE_DIFFUSE;
+}
+
+// 12 bytes: GL name, interned path (see texture_paths.hpp) and type
 struct Texture {
 	unsigned int id;
-	string type;
-	aiString path;
+	unsigned int pathId;
+	TextureType type;
+};
+
+// Sampler uniforms of a mesh's textures.  Texture i goes to unit i and the sampler texture_diffuseN/specularN/normalN/heightN
+// of the shader points at it.  The names are built once and their locations looked up once per shader program, so binding
+// per frame doesn't allocate or ask the driver for uniform names.
+class TextureBindings
+{
+public:
+	// name the samplers of a texture list (call again if the list changes)
+	void set_textures(const vector<Texture> &textures)
+	{
+		// the N of each type counts from 1
+		unsigned int numbers[TEXTURE_TYPE_COUNT] = { 1, 1, 1, 1 };
+		names.clear();
+		programs.clear();
+		locations.clear();
+		for (unsigned int i = 0; i < textures.size(); i++)
+		{
+			stringstream ss;
+			ss << texture_type_name(textures[i].type) << numbers[textures[i].type]++;
+			names.push_back(ss.str());
+		}
+	}
+
+	// bind textures to their units and set the samplers of shader
+	void bind(const Shader &shader, const vector<Texture> &textures)
+	{
+		const vector<GLint> &samplers = locations_for(shader.ID);
+		for (unsigned int i = 0; i < textures.size() && i < samplers.size(); i++)
+		{
+			glActiveTexture(GL_TEXTURE0 + i); // active proper texture unit before binding
+			// now set the sampler to the correct texture unit
+			if (samplers[i] >= 0)
+				glUniform1i(samplers[i], i);
+			// and finally bind the texture (a stand-in while it is still streaming)
+			bind_texture(GL_TEXTURE_2D, textures[i].id, textures[i].type == TEXTURE_NORMAL);
+		}
+	}
+
+private:
+	vector<string> names;
+	vector<unsigned int> programs;	// programs seen so far, with their sampler locations
+	vector<vector<GLint> > locations;
+
+	const vector<GLint> &locations_for(unsigned int program)
+	{
+		for (unsigned int p = 0; p < programs.size(); p++)
+		{
+			if (programs[p] == program)
+				return locations[p];
+		}
+		// first draw with this program
+		programs.push_back(program);
+		locations.push_back(vector<GLint>(names.size()));
+		for (unsigned int i = 0; i < names.size(); i++)
+			locations.back()[i] = glGetUniformLocation(program, names[i].c_str());
+		return locations.back();
+	}
 };
 
+// attribute pointers of an interleaved VertexModel buffer bound to GL_ARRAY_BUFFER, for the bound VAO
+inline void setup_vertex_model_attributes()
+{
+	// vertex Positions
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(VertexModel), (void*)0);
+	// vertex normals
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(VertexModel), (void*)offsetof(VertexModel, Normal));
+	// vertex texture coords
+	glEnableVertexAttribArray(2);
+	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(VertexModel), (void*)offsetof(VertexModel, TexCoords));
+	// vertex tangent
+	glEnableVertexAttribArray(3);
+	glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(VertexModel), (void*)offsetof(VertexModel, Tangent));
+	// vertex bitangent
+	glEnableVertexAttribArray(4);
+	glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(VertexModel), (void*)offsetof(VertexModel, Bitangent));
+}
+
+// first of the four attribute locations (one per column) of the per-instance model matrix in the *_instanced vertex shaders
+const GLuint INSTANCE_MATRIX_ATTRIBUTE = 5;
+
+// per-instance model matrices for the bound VAO: instanceBuffer holds one glm::mat4 per instance, and each column steps
+// once per instance instead of once per vertex
+inline void setup_instance_attributes(GLuint instanceBuffer)
+{
+	glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+	for (GLuint column = 0; column < 4; column++)
+	{
+		glEnableVertexAttribArray(INSTANCE_MATRIX_ATTRIBUTE + column);
+		glVertexAttribPointer(INSTANCE_MATRIX_ATTRIBUTE + column, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(column * sizeof(glm::vec4)));
+		glVertexAttribDivisor(INSTANCE_MATRIX_ATTRIBUTE + column, 1);
+	}
+}
+
 class Mesh {
 public:
 	/*  Mesh Data  */
 	vector<VertexModel> vertices;
 	vector<unsigned int> indices;
+	vector<vector<unsigned int> > lods;	// coarser index lists over the same vertices (see mesh_simplifier.hpp), may be empty
 	vector<Texture> textures;
-	unsigned int VAO;
+	TextureBindings bindings;
+	unsigned int indexCount;	// stays valid after release_cpu_data
+	Bounds bounds;	// of the vertices, in model space
+	VertexQuantization quantization;	// of the packed vertex buffer, identity for float vertices
+	VertexArrayHandle VAO;
 
 	/*  Functions  */
-	// constructor
-	Mesh(vector<VertexModel> vertices, vector<unsigned int> indices, vector<Texture> textures)
+	// constructor.  createBuffers = false keeps the data on the CPU only, for owners that pack several meshes into
+	// shared buffers (see Model); such a mesh can't Draw itself.  Meshes own their GL objects, so they can be moved
+	// (pass the vectors with std::move to avoid copying them) but not copied.  packVertices = false uploads the float
+	// vertices instead of PackedVertexModel ones (see vertex_packing.hpp).
+	Mesh(vector<VertexModel> vertices, vector<unsigned int> indices, vector<Texture> textures, bool createBuffers = true, bool packVertices = true)
+		: indexCount((unsigned int)indices.size()), quantization(VertexQuantization::identity())
 	{
-		this->vertices = vertices;
-		this->indices = indices;
-		this->textures = textures;
+		// the arguments are our own copies, take them over instead of copying again
+		this->vertices.swap(vertices);
+		this->indices.swap(indices);
+		this->textures.swap(textures);
+		bindings.set_textures(this->textures);
+		// a mesh may come without vertices (model.hpp skips those when packing), its bounds are then empty
+		bounds = bounds_of_box(glm::vec3(0.0f), glm::vec3(0.0f));
+		if (!this->vertices.empty())
+			bounds = bounds_of_points(&this->vertices[0].Position.x, sizeof(VertexModel), this->vertices.size());
 
 		// now that we have all the required data, set the vertex buffers and its attribute pointers.
-		setupMesh();
+		if (createBuffers)
+			setupMesh(this->vertices.data(), this->indices.data(), packVertices);
 	}
 
 	// render the mesh
 	void Draw(Shader shader)
 	{
 		// bind appropriate textures
-		unsigned int diffuseNr = 1;
-		unsigned int specularNr = 1;
-		unsigned int normalNr = 1;
-		unsigned int heightNr = 1;
-		for (unsigned int i = 0; i < textures.size(); i++)
-		{
-			glActiveTexture(GL_TEXTURE0 + i); // active proper texture unit before binding
-											  // retrieve texture number (the N in diffuse_textureN)
-			stringstream ss;
-			string number;
-			string name = textures[i].type;
-			if (name == "texture_diffuse")
-				ss << diffuseNr++; // transfer unsigned int to stream
-			else if (name == "texture_specular")
-				ss << specularNr++; // transfer unsigned int to stream
-			else if (name == "texture_normal")
-				ss << normalNr++; // transfer unsigned int to stream
-			else if (name == "texture_height")
-				ss << heightNr++; // transfer unsigned int to stream
-			number = ss.str();
-			// now set the sampler to the correct texture unit
-			glUniform1i(glGetUniformLocation(shader.ID, (name + number).c_str()), i);
-			// and finally bind the texture
-			glBindTexture(GL_TEXTURE_2D, textures[i].id);
-		}
+		bindings.bind(shader, textures);
+		quantization.apply(shader);
 
 		// draw mesh
-		glBindVertexArray(VAO);
-		glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
+		glBindVertexArray(VAO.get());
+		glDrawElements(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, 0);
 		glBindVertexArray(0);
 
 		// always good practice to set everything back to defaults once configured.
 		glActiveTexture(GL_TEXTURE0);
 	}
 
+	// free the vertices and indices once they are on the GPU (textures stay, Draw needs them)
+	void release_cpu_data()
+	{
+		vector<VertexModel>().swap(vertices);
+		vector<unsigned int>().swap(indices);
+		vector<vector<unsigned int> >().swap(lods);
+	}
+
+	void delete_buffers()
+	{
+		VAO.reset();
+		VBO.reset();
+		EBO.reset();
+	}
+
 private:
 	/*  Render data  */
-	unsigned int VBO, EBO;
+	BufferHandle VBO, EBO;
 
 	/*  Functions    */
 	// initializes all the buffer objects/arrays
-	void setupMesh()
+	void setupMesh(const VertexModel *vertexData, const unsigned int *indexData, bool packVertices)
 	{
 		// create buffers/arrays
-		glGenVertexArrays(1, &VAO);
-		glGenBuffers(1, &VBO);
-		glGenBuffers(1, &EBO);
+		VAO = VertexArrayHandle::create();
+		VBO = BufferHandle::create();
+		EBO = BufferHandle::create();
+
+		glBindVertexArray(VAO.get());
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO.get());
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), indexData, GL_STATIC_DRAW);
 
-		glBindVertexArray(VAO);
 		// load data into vertex buffers
-		glBindBuffer(GL_ARRAY_BUFFER, VBO);
+		glBindBuffer(GL_ARRAY_BUFFER, VBO.get());
+		if (packVertices)
+		{
+			VertexPackingError error = VertexPackingError();
+			quantization = vertex_quantization(vertexData, vertices.size());
+			vector<PackedVertexModel> packed = pack_model_vertices(vertexData, vertices.size(), quantization, error);
+			glBufferData(GL_ARRAY_BUFFER, packed.size() * sizeof(PackedVertexModel), packed.data(), GL_STATIC_DRAW);
+			setup_packed_vertex_model_attributes();
+			glBindVertexArray(0);
+			return;
+		}
 		// A great thing about structs is that their memory layout is sequential for all its items.
 		// The effect is that we can simply pass a pointer to the struct and it translates perfectly to a glm::vec3/2 array which
 		// again translates to 3/2 floats which translates to a byte array.
-		glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(VertexModel), &vertices[0], GL_STATIC_DRAW);
-
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
+		glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(VertexModel), vertexData, GL_STATIC_DRAW);
 
 		// set the vertex attribute pointers
-		// vertex Positions
-		glEnableVertexAttribArray(0);
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(VertexModel), (void*)0);
-		// vertex normals
-		glEnableVertexAttribArray(1);
-		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(VertexModel), (void*)offsetof(VertexModel, Normal));
-		// vertex texture coords
-		glEnableVertexAttribArray(2);
-		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(VertexModel), (void*)offsetof(VertexModel, TexCoords));
-		// vertex tangent
-		glEnableVertexAttribArray(3);
-		glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(VertexModel), (void*)offsetof(VertexModel, Tangent));
-		// vertex bitangent
-		glEnableVertexAttribArray(4);
-		glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(VertexModel), (void*)offsetof(VertexModel, Bitangent));
+		setup_vertex_model_attributes();
 
 		glBindVertexArray(0);
 	}
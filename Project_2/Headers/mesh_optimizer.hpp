@@ -0,0 +1,95 @@
+#ifndef MESH_OPTIMIZER_H
+#define MESH_OPTIMIZER_H
+
+#include <mesh.hpp>
+#include <vertex_cache.hpp>
+
+#include <vector>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+
+// Post-import optimization of model meshes.  Assimp's OBJ importer gives every face corner its own vertex and keeps the
+// file's face order, so a mesh is close to a triangle soup for the GPU.  optimize_model_mesh welds the duplicates and
+// reorders the triangles for the vertex cache (Tipsify) and for overdraw, then the vertices for fetch locality.
+
+// what optimize_model_mesh changed
+struct MeshOptimizeStats
+{
+	unsigned int verticesBefore, verticesAfter;
+	float acmrBefore, acmrAfter;
+};
+
+// Merge vertices with the same position, normal and texture coordinate.  Their tangents and bitangents are averaged,
+// which is what Assimp computes for vertices it joins itself.
+inline void weld_model_vertices(vector<VertexModel> &vertices, vector<unsigned int> &indices)
+{
+	// position, normal and texture coordinate are the first bytes of the vertex
+	const size_t keySize = offsetof(VertexModel, Tangent);
+	size_t tableSize = 1;
+	while (tableSize < 2 * vertices.size())
+		tableSize *= 2;
+	std::vector<unsigned int> table(tableSize, 0);	// welded index + 1, 0 = empty
+
+	std::vector<VertexModel> welded;
+	std::vector<unsigned int> remap(vertices.size());
+	std::vector<glm::vec3> tangents, bitangents;
+	welded.reserve(vertices.size());
+	for (size_t v = 0; v < vertices.size(); v++)
+	{
+		const unsigned char *key = (const unsigned char*)&vertices[v];
+		unsigned long long hash = 14695981039346656037ULL;
+		for (size_t i = 0; i < keySize; i++)
+			hash = (hash ^ key[i]) * 1099511628211ULL;
+
+		size_t slot = (size_t)hash & (tableSize - 1);
+		while (table[slot] != 0 && std::memcmp(&welded[table[slot] - 1], key, keySize) != 0)
+			slot = (slot + 1) & (tableSize - 1);
+		if (table[slot] == 0)
+		{
+			welded.push_back(vertices[v]);
+			tangents.push_back(glm::vec3(0.0f));
+			bitangents.push_back(glm::vec3(0.0f));
+			table[slot] = (unsigned int)welded.size();
+		}
+		unsigned int target = table[slot] - 1;
+		remap[v] = target;
+
+		// some importers leave NaN tangents on degenerate UVs, those shouldn't spoil the neighbours
+		const VertexModel &vertex = vertices[v];
+		if (std::isfinite(vertex.Tangent.x + vertex.Tangent.y + vertex.Tangent.z))
+			tangents[target] += vertex.Tangent;
+		if (std::isfinite(vertex.Bitangent.x + vertex.Bitangent.y + vertex.Bitangent.z))
+			bitangents[target] += vertex.Bitangent;
+	}
+	for (size_t v = 0; v < welded.size(); v++)
+	{
+		if (glm::dot(tangents[v], tangents[v]) > 0.0f)
+			welded[v].Tangent = glm::normalize(tangents[v]);
+		if (glm::dot(bitangents[v], bitangents[v]) > 0.0f)
+			welded[v].Bitangent = glm::normalize(bitangents[v]);
+	}
+	for (size_t i = 0; i < indices.size(); i++)
+		indices[i] = remap[indices[i]];
+	vertices.swap(welded);
+}
+
+// weld, order for the vertex cache, order the clusters for overdraw and renumber the vertices in use order
+inline MeshOptimizeStats optimize_model_mesh(vector<VertexModel> &vertices, vector<unsigned int> &indices)
+{
+	MeshOptimizeStats stats;
+	stats.verticesBefore = (unsigned int)vertices.size();
+	stats.acmrBefore = vertex_cache_acmr(indices.empty() ? NULL : &indices[0], indices.size(), vertices.size());
+	// only triangle lists (Assimp can still hand out point and line meshes)
+	if (!indices.empty() && indices.size() % 3 == 0)
+	{
+		weld_model_vertices(vertices, indices);
+		optimize_vertex_cache(&indices[0], indices.size(), vertices.size());
+		optimize_overdraw(&indices[0], indices.size(), &vertices[0].Position.x, sizeof(VertexModel), vertices.size());
+		optimize_vertex_fetch(vertices, &indices[0], indices.size());
+	}
+	stats.verticesAfter = (unsigned int)vertices.size();
+	stats.acmrAfter = vertex_cache_acmr(indices.empty() ? NULL : &indices[0], indices.size(), vertices.size());
+	return stats;
+}
+#endif
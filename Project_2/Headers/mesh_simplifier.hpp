@@ -0,0 +1,292 @@
+#ifndef MESH_SIMPLIFIER_H
+#define MESH_SIMPLIFIER_H
+
+#include <mesh.hpp>
+#include <vertex_cache.hpp>
+
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include <cmath>
+#include <cstring>
+
+// Levels of detail for model meshes by quadric error metric simplification.
+//   Reference: Garland & Heckbert, "Surface Simplification Using Quadric Error Metrics"
+// Every vertex carries the (area weighted) planes of its triangles as a quadric, and the cheapest edges are collapsed
+// first: the cost is the mean squared distance of the new position to all the planes merged into it.  An edge collapses
+// onto one of its endpoints, so a simplified mesh indexes a subset of the original vertices.  All levels share one
+// vertex buffer and every vertex that survives keeps its texture coordinate, normal and tangent frame exactly.
+//   Vertices on a seam (several vertices at one position: texture or normal discontinuities) and on an open border are
+// never moved, which keeps UV seams, hard edges and the outline of open surfaces in place.  A collapse is refused if it
+// would flip or fold a triangle, or join vertices whose normals are far apart.
+
+// levels a mesh gets: the full mesh and up to three simplified ones
+const int MODEL_LOD_LEVELS = 4;
+
+struct Quadric
+{
+	// symmetric 4x4 matrix of the plane equations, and the total weight (area) folded in
+	double a2, b2, c2, ab, ac, bc, ad, bd, cd, d2, w;
+};
+
+inline void quadric_add_plane(Quadric &q, const glm::vec3 &n, float d, float weight)
+{
+	q.a2 += weight * n.x * n.x;
+	q.b2 += weight * n.y * n.y;
+	q.c2 += weight * n.z * n.z;
+	q.ab += weight * n.x * n.y;
+	q.ac += weight * n.x * n.z;
+	q.bc += weight * n.y * n.z;
+	q.ad += weight * n.x * d;
+	q.bd += weight * n.y * d;
+	q.cd += weight * n.z * d;
+	q.d2 += weight * d * d;
+	q.w += weight;
+}
+
+inline void quadric_add(Quadric &q, const Quadric &r)
+{
+	q.a2 += r.a2; q.b2 += r.b2; q.c2 += r.c2;
+	q.ab += r.ab; q.ac += r.ac; q.bc += r.bc;
+	q.ad += r.ad; q.bd += r.bd; q.cd += r.cd;
+	q.d2 += r.d2; q.w += r.w;
+}
+
+// mean squared distance of p to the planes of q
+inline float quadric_error(const Quadric &q, const glm::vec3 &p)
+{
+	double x = p.x, y = p.y, z = p.z;
+	double e = q.a2 * x * x + q.b2 * y * y + q.c2 * z * z + 2.0 * (q.ab * x * y + q.ac * x * z + q.bc * y * z)
+		+ 2.0 * (q.ad * x + q.bd * y + q.cd * z) + q.d2;
+	return q.w > 0.0 ? (float)std::max(0.0, e / q.w) : 0.0f;
+}
+
+// Simplify a triangle list towards targetIndexCount indices, without moving the surface further than targetError (in
+// the mesh's units).  Returns the new index list; error receives the largest distance of any collapse done.
+inline vector<unsigned int> simplify_model_mesh(const vector<VertexModel> &vertices, const vector<unsigned int> &indices,
+	size_t targetIndexCount, float targetError, float *error = NULL)
+{
+	size_t vertexCount = vertices.size();
+	vector<unsigned int> result(indices);
+	float maxCost = 0.0f;
+
+	// vertices sharing a position (seams)
+	vector<unsigned int> position(vertexCount), positionUses;
+	{
+		std::unordered_map<unsigned long long, unsigned int> positions;
+		positions.reserve(vertexCount);
+		for (size_t v = 0; v < vertexCount; v++)
+		{
+			const glm::vec3 &p = vertices[v].Position;
+			unsigned int bits[3];
+			std::memcpy(bits, &p, sizeof(bits));
+			unsigned long long key = ((unsigned long long)bits[0] * 73856093ULL) ^ ((unsigned long long)bits[1] * 19349663ULL << 21) ^ ((unsigned long long)bits[2] * 83492791ULL << 42);
+			// collisions of the hashed key are resolved by comparing the positions
+			for (;;)
+			{
+				std::unordered_map<unsigned long long, unsigned int>::iterator found = positions.find(key);
+				if (found == positions.end())
+				{
+					positions[key] = (unsigned int)v;
+					position[v] = (unsigned int)v;
+					break;
+				}
+				if (vertices[found->second].Position == p)
+				{
+					position[v] = found->second;
+					break;
+				}
+				key++;
+			}
+		}
+		positionUses.assign(vertexCount, 0);
+		for (size_t v = 0; v < vertexCount; v++)
+			positionUses[position[v]]++;
+	}
+
+	// open edges (used by one triangle, counted between positions so seams aren't borders)
+	vector<char> locked(vertexCount, 0);
+	{
+		std::unordered_map<unsigned long long, unsigned int> edges;
+		edges.reserve(indices.size());
+		for (size_t i = 0; i < indices.size(); i++)
+		{
+			unsigned int a = position[indices[i]], b = position[indices[i - i % 3 + (i + 1) % 3]];
+			edges[((unsigned long long)std::min(a, b) << 32) | std::max(a, b)]++;
+		}
+		for (size_t i = 0; i < indices.size(); i++)
+		{
+			unsigned int v = indices[i], w = indices[i - i % 3 + (i + 1) % 3];
+			unsigned int a = position[v], b = position[w];
+			if (edges[((unsigned long long)std::min(a, b) << 32) | std::max(a, b)] == 1)
+				locked[v] = locked[w] = 1;
+		}
+		for (size_t v = 0; v < vertexCount; v++)
+		{
+			if (positionUses[position[v]] > 1)
+				locked[v] = 1;
+		}
+	}
+
+	// planes of the triangles around every vertex
+	Quadric zero;
+	std::memset(&zero, 0, sizeof(zero));
+	vector<Quadric> quadrics(vertexCount, zero);
+	for (size_t t = 0; t + 2 < indices.size(); t += 3)
+	{
+		const glm::vec3 &p0 = vertices[indices[t]].Position, &p1 = vertices[indices[t + 1]].Position, &p2 = vertices[indices[t + 2]].Position;
+		glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+		float length = glm::length(n);
+		if (length <= 0.0f)
+			continue;
+		n /= length;
+		float d = -glm::dot(n, p0);
+		for (int k = 0; k < 3; k++)
+			quadric_add_plane(quadrics[indices[t + k]], n, d, 0.5f * length);
+	}
+
+	struct Collapse
+	{
+		float cost;
+		unsigned int from, to;
+		bool operator<(const Collapse &other) const { return cost < other.cost; }
+	};
+	vector<Collapse> collapses;
+	vector<unsigned int> remap(vertexCount), offsets(vertexCount + 1), adjacency;
+	vector<char> touched(vertexCount);
+	float limit = targetError * targetError;
+
+	// passes of independent collapses (no vertex involved twice), cheapest first, until the target is met
+	while (result.size() > targetIndexCount)
+	{
+		size_t triangleCount = result.size() / 3, targetTriangles = targetIndexCount / 3;
+
+		// vertex -> triangles of the current mesh
+		std::fill(offsets.begin(), offsets.end(), 0);
+		for (size_t i = 0; i < result.size(); i++)
+			offsets[result[i] + 1]++;
+		for (size_t v = 0; v < vertexCount; v++)
+			offsets[v + 1] += offsets[v];
+		adjacency.resize(result.size());
+		vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+		for (size_t i = 0; i < result.size(); i++)
+			adjacency[fill[result[i]]++] = (unsigned int)(i / 3);
+
+		collapses.clear();
+		for (size_t i = 0; i < result.size(); i++)
+		{
+			unsigned int a = result[i], b = result[i - i % 3 + (i + 1) % 3];
+			for (int direction = 0; direction < 2; direction++, std::swap(a, b))
+			{
+				if (locked[a])
+					continue;
+				Quadric q = quadrics[a];
+				quadric_add(q, quadrics[b]);
+				Collapse collapse = { quadric_error(q, vertices[b].Position), a, b };
+				if (collapse.cost <= limit)
+					collapses.push_back(collapse);
+			}
+		}
+		if (collapses.empty())
+			break;
+		std::sort(collapses.begin(), collapses.end());
+
+		for (size_t v = 0; v < vertexCount; v++)
+			remap[v] = (unsigned int)v;
+		std::fill(touched.begin(), touched.end(), 0);
+		size_t removed = 0;
+		for (size_t c = 0; c < collapses.size() && triangleCount - removed > targetTriangles; c++)
+		{
+			unsigned int a = collapses[c].from, b = collapses[c].to;
+			if (touched[a] || touched[b])
+				continue;
+			// normals far apart are a crease the seam test missed (a welded hard edge)
+			if (glm::dot(vertices[a].Normal, vertices[b].Normal) < 0.5f)
+				continue;
+
+			// a's triangles with b moved in must keep facing the same way, the ones containing b disappear
+			bool flips = false;
+			size_t gone = 0;
+			for (unsigned int k = offsets[a]; k < offsets[a + 1] && !flips; k++)
+			{
+				unsigned int t = adjacency[k];
+				unsigned int i0 = remap[result[3 * t]], i1 = remap[result[3 * t + 1]], i2 = remap[result[3 * t + 2]];
+				if (i0 == i1 || i1 == i2 || i0 == i2)
+					continue;
+				if (i0 == b || i1 == b || i2 == b)
+				{
+					gone++;
+					continue;
+				}
+				const glm::vec3 &p0 = vertices[i0].Position, &p1 = vertices[i1].Position, &p2 = vertices[i2].Position;
+				glm::vec3 before = glm::cross(p1 - p0, p2 - p0);
+				const glm::vec3 &q0 = i0 == a ? vertices[b].Position : p0;
+				const glm::vec3 &q1 = i1 == a ? vertices[b].Position : p1;
+				const glm::vec3 &q2 = i2 == a ? vertices[b].Position : p2;
+				glm::vec3 after = glm::cross(q1 - q0, q2 - q0);
+				float lengths = glm::length(before) * glm::length(after);
+				if (lengths <= 0.0f || glm::dot(before, after) < 0.2f * lengths)
+					flips = true;
+			}
+			if (flips)
+				continue;
+
+			remap[a] = b;
+			quadric_add(quadrics[b], quadrics[a]);
+			touched[a] = touched[b] = 1;
+			removed += gone;
+			maxCost = std::max(maxCost, collapses[c].cost);
+		}
+		if (removed == 0)
+			break;
+
+		// apply the collapses and drop the triangles that became degenerate
+		size_t write = 0;
+		for (size_t t = 0; t < result.size(); t += 3)
+		{
+			unsigned int i0 = remap[result[t]], i1 = remap[result[t + 1]], i2 = remap[result[t + 2]];
+			if (i0 == i1 || i1 == i2 || i0 == i2)
+				continue;
+			result[write++] = i0;
+			result[write++] = i1;
+			result[write++] = i2;
+		}
+		result.resize(write);
+	}
+
+	if (error)
+		*error = std::sqrt(maxCost);
+	return result;
+}
+
+// Coarser index lists for a mesh (level 0, the mesh itself, isn't included).  Each level aims at half the triangles of
+// the one before within an error that doubles per level, starting at 0.5% of the mesh's size; a level that can't
+// remove at least a fifth of the triangles ends the chain.  The lists are ordered for the vertex cache.
+inline vector<vector<unsigned int> > build_model_lods(const vector<VertexModel> &vertices, const vector<unsigned int> &indices)
+{
+	vector<vector<unsigned int> > lods;
+	if (indices.size() < 3 * 64 || indices.size() % 3 != 0)
+		return lods;
+	glm::vec3 low(vertices[0].Position), high(vertices[0].Position);
+	for (size_t v = 1; v < vertices.size(); v++)
+	{
+		low = glm::min(low, vertices[v].Position);
+		high = glm::max(high, vertices[v].Position);
+	}
+	float size = glm::length(high - low);
+
+	const vector<unsigned int> *previous = &indices;
+	float relativeError = 0.005f;
+	for (int level = 1; level < MODEL_LOD_LEVELS; level++, relativeError *= 2.0f)
+	{
+		size_t target = previous->size() / 6 * 3;
+		vector<unsigned int> lod = simplify_model_mesh(vertices, *previous, target, relativeError * size);
+		if (lod.empty() || lod.size() * 5 > previous->size() * 4)
+			break;
+		optimize_vertex_cache(&lod[0], lod.size(), vertices.size());
+		lods.push_back(lod);
+		previous = &lods.back();
+	}
+	return lods;
+}
+#endif
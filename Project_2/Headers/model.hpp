@@ -11,61 +11,736 @@
 
 #include <mesh.hpp>
 #include <shader.hpp>
+#include <model_cache.hpp>
+#include <mesh_optimizer.hpp>
+#include <mesh_simplifier.hpp>
+#include <obj_loader.hpp>
+#include <gl_handles.hpp>
+#include <texture_cache.hpp>
 
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
 #include <map>
+#include <unordered_map>
 #include <vector>
+#include <chrono>
+#include <utility>
+#include <cstring>
+#include <cstdio>
+#include <algorithm>
+#include <future>
 
 
 using namespace std;
 
 unsigned int TextureFromFile(const char *path, const string &directory, bool gamma = false);
 
+// a material texture of a mesh before it is on the GPU
+struct TextureRef
+{
+	string type;
+	string path;	// relative to the model directory, as the material names it
+	unsigned int pathId;	// interned canonical directory/path, set by import()
+};
+
 class Model
 {
 public:
 	/*  Model Data */
 	vector<Texture> textures_loaded;	// stores all the textures loaded so far, optimization to make sure textures aren't loaded more than once.
+	unordered_map<unsigned int, unsigned int> textureIndex;	// path id -> textures_loaded entry
 	vector<Mesh> meshes;
+	Bounds bounds;	// of every mesh, in model space (set by upload())
 	string directory;
 	bool gammaCorrection;
+	bool optimizeMeshes;	// run imported meshes through optimize_model_mesh (set before loading)
+	bool objReader;	// read .obj files with obj_loader.hpp instead of Assimp, which stays for everything else (set before loading)
+	bool multiDraw;	// one glMultiDrawElementsBaseVertex per material, false draws (and binds textures) mesh by mesh
+	bool buildLods;	// give optimized meshes simplified levels of detail at import (set before loading)
+	float lodPixels;	// screen diameter below which a mesh starts dropping levels of detail (see select_lod)
+	bool packVertices;	// upload PackedVertexModel (20 bytes) instead of VertexModel (56) vertices (set before upload)
+	VertexQuantization quantization;	// of the whole vertex buffer, identity for float vertices (set by upload())
+	double importMilliseconds;	// CPU time of the last import()
+
+	// counters of the last Draw
+	unsigned int drawCalls;
+	unsigned int trianglesDrawn;	// at the selected levels of detail
+	unsigned int trianglesFullDetail;	// the same meshes at full detail
+	double submitMilliseconds;	// CPU time spent issuing it
+
+	// Assimp post processing, also part of the model cache key
+	static const unsigned int importFlags = aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_CalcTangentSpace;
 
 	/*  Functions   */
-	// constructor, expects a filepath to a 3D model.
-	Model(string const &path, bool gamma = false) : gammaCorrection(gamma)
+	// empty model, to be filled by import() and upload() (see ModelLoader)
+	Model() : gammaCorrection(false), optimizeMeshes(true), objReader(true), multiDraw(true), buildLods(true), lodPixels(512.0f), packVertices(true),
+		quantization(VertexQuantization::identity()), importMilliseconds(0.0), drawCalls(0), trianglesDrawn(0), trianglesFullDetail(0), submitMilliseconds(0.0)
 	{
-		loadModel(path);
 	}
 
-	// draws the model, and thus all its meshes
+	// constructor, expects a filepath to a 3D model.  useCache = false always imports with Assimp and leaves the cache alone.
+	Model(string const &path, bool gamma = false, bool useCache = true) : gammaCorrection(gamma), optimizeMeshes(true), objReader(true), multiDraw(true),
+		buildLods(true), lodPixels(512.0f), packVertices(true), quantization(VertexQuantization::identity()), importMilliseconds(0.0), drawCalls(0), trianglesDrawn(0), trianglesFullDetail(0), submitMilliseconds(0.0)
+	{
+		if (import(path, useCache))
+			upload();
+	}
+
+	// draws the model, and thus all its meshes: all of them come from one VAO, one draw call per material
 	void Draw(Shader shader)
+	{
+		chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+		drawCalls = trianglesDrawn = trianglesFullDetail = 0;
+		if (groups.empty())
+			return;
+		quantization.apply(shader);
+		glBindVertexArray(VAO.get());
+		for (unsigned int g = 0; g < groups.size(); g++)
+		{
+			const DrawGroup &group = groups[g];
+			for (unsigned int i = 0; i < group.counts.size(); i++)
+			{
+				trianglesDrawn += group.counts[i] / 3;
+				trianglesFullDetail += group.lods[i].counts[0] / 3;
+			}
+			if (multiDraw)
+			{
+				meshes[group.mesh].bindings.bind(shader, meshes[group.mesh].textures);
+				glMultiDrawElementsBaseVertex(GL_TRIANGLES, &group.counts[0], GL_UNSIGNED_INT, (const void**)&group.offsets[0], (GLsizei)group.counts.size(), &group.baseVertices[0]);
+				drawCalls++;
+				continue;
+			}
+			for (unsigned int i = 0; i < group.counts.size(); i++)
+			{
+				meshes[group.mesh].bindings.bind(shader, meshes[group.mesh].textures);
+				glDrawElementsBaseVertex(GL_TRIANGLES, group.counts[i], GL_UNSIGNED_INT, (void*)group.offsets[i], group.baseVertices[i]);
+				drawCalls++;
+			}
+		}
+		glBindVertexArray(0);
+
+		// always good practice to set everything back to defaults once configured.
+		glActiveTexture(GL_TEXTURE0);
+		submitMilliseconds = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+	}
+
+	// Choose the level of detail of every mesh from the size of its bounding sphere on screen: full detail while the
+	// diameter is at least lodPixels, one level coarser each time it halves below that.  Call before Draw with the matrices
+	// it draws with; the choice holds until the next call (full detail until the first one, and always with lodPixels 0).
+	void select_lod(const glm::mat4 &model, const glm::mat4 &view, const glm::mat4 &projection, float viewportHeight)
+	{
+		glm::mat4 modelView = view * model;
+		// the largest axis scale of the model matrix grows the spheres
+		float scale = std::sqrt(std::max(glm::dot(glm::vec3(model[0]), glm::vec3(model[0])),
+			std::max(glm::dot(glm::vec3(model[1]), glm::vec3(model[1])), glm::dot(glm::vec3(model[2]), glm::vec3(model[2])))));
+		// projection[1][1] = cot(fovy / 2), so a sphere of radius r at distance d is r * cot * height / d pixels across
+		float pixels = projection[1][1] * viewportHeight;
+		for (unsigned int g = 0; g < groups.size(); g++)
+		{
+			DrawGroup &group = groups[g];
+			for (unsigned int i = 0; i < group.counts.size(); i++)
+			{
+				const MeshLods &lod = group.lods[i];
+				unsigned int level = 0;
+				float distance = glm::length(glm::vec3(modelView * glm::vec4(lod.center, 1.0f)));
+				float radius = lod.radius * scale;
+				if (lodPixels > 0.0f && distance > radius)
+				{
+					float diameter = radius * pixels / distance;
+					for (float limit = lodPixels; level + 1 < lod.levels && diameter < limit; limit *= 0.5f)
+						level++;
+				}
+				group.counts[i] = lod.counts[level];
+				group.offsets[i] = lod.offsets[level];
+			}
+		}
+	}
+
+	// Draws count copies of the model, with the model matrices in instanceBuffer (one glm::mat4 per instance, see
+	// InstanceBuffer) instead of the model uniform; the shader has to be a *_instanced one.  One draw call per mesh however
+	// many instances there are.  The instances are drawn at full detail, select_lod only sizes a single transform.
+	void DrawInstanced(Shader shader, GLuint instanceBuffer, GLsizei count)
+	{
+		chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+		drawCalls = trianglesDrawn = trianglesFullDetail = 0;
+		if (groups.empty() || count <= 0)
+			return;
+		// the same buffers as Draw with the instance attributes on top, in a VAO of their own so Draw never sees them
+		if (instanceVAO.get() == 0)
+		{
+			instanceVAO = VertexArrayHandle::create();
+			glBindVertexArray(instanceVAO.get());
+			glBindBuffer(GL_ARRAY_BUFFER, VBO.get());
+			setupVertexAttributes();
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO.get());
+		}
+		quantization.apply(shader);
+		glBindVertexArray(instanceVAO.get());
+		setup_instance_attributes(instanceBuffer);
+		for (unsigned int g = 0; g < groups.size(); g++)
+		{
+			const DrawGroup &group = groups[g];
+			meshes[group.mesh].bindings.bind(shader, meshes[group.mesh].textures);
+			for (unsigned int i = 0; i < group.counts.size(); i++)
+			{
+				glDrawElementsInstancedBaseVertex(GL_TRIANGLES, group.lods[i].counts[0], GL_UNSIGNED_INT, group.lods[i].offsets[0], count, group.baseVertices[i]);
+				drawCalls++;
+				trianglesDrawn += group.lods[i].counts[0] / 3 * count;
+			}
+		}
+		trianglesFullDetail = trianglesDrawn;
+		glBindVertexArray(0);
+
+		glActiveTexture(GL_TEXTURE0);
+		submitMilliseconds = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+	}
+
+	// free the meshes' vertices and indices, the GPU has its own copy after upload()
+	void release_cpu_data()
 	{
 		for (unsigned int i = 0; i < meshes.size(); i++)
-			meshes[i].Draw(shader);
+			meshes[i].release_cpu_data();
+	}
+
+	// delete the GL objects (while the context is still there)
+	void delete_buffers()
+	{
+		groups.clear();
+		instanceVAO.reset();
+		VAO.reset();
+		VBO.reset();
+		EBO.reset();
+		for (unsigned int i = 0; i < textures_loaded.size(); i++)
+			texture_cache().release(textures_loaded[i].id);
+		textures_loaded.clear();
+		textureIndex.clear();
+	}
+
+	// CPU half of loading: reads the model cache (see model_cache.hpp) or imports the file with Assimp, then decodes
+	// every texture the materials use that isn't in the texture cache yet.  Touches no GL state, so several models can import on different threads.
+	//   Returns false (and leaves nothing to upload) if the file couldn't be imported.
+	bool import(string const &path, bool useCache = true)
+	{
+		chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+		// retrieve the directory path of the filepath
+		directory = path.substr(0, path.find_last_of('/'));
+		imported.clear();
+
+		// printf rather than cout, so lines from models importing at the same time don't interleave
+		ModelCacheKey key;
+		bool keyed = useCache && model_cache_key(path, key);
+		bool cached = keyed && readCache(path, key);
+		if (!cached)
+		{
+			// plain OBJ files skip Assimp, anything else (or an OBJ the reader doesn't take) goes through it
+			if (!objReader || !obj_file(path) || !importObj(path))
+			{
+				// read file via ASSIMP
+				Assimp::Importer importer;
+				const aiScene* scene = importer.ReadFile(path, importFlags);
+				// check for errors
+				if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) // if is Not Zero
+				{
+					std::printf("ERROR::ASSIMP:: %s\n", importer.GetErrorString());
+					importMilliseconds = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+					return false;
+				}
+
+				// process ASSIMP's root node recursively
+				processNode(scene->mRootNode, scene);
+			}
+			if (optimizeMeshes)
+				optimizeImported(path);
+			if (optimizeMeshes && buildLods)
+				simplifyImported(path);
+
+			if (keyed)
+				writeCache(path, key);
+		}
+		decodeTextures();
+
+		importMilliseconds = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+		unsigned int decodedCount = 0;
+		for (unsigned int i = 0; i < images.size(); i++)
+			decodedCount += images[i].decoded ? 1 : 0;
+		std::printf("Model %s: %u meshes %s, %u of %u textures decoded in %.1f ms\n", path.c_str(), (unsigned int)imported.size(),
+			cached ? "from cache" : "imported", decodedCount, (unsigned int)images.size(), importMilliseconds);
+		return true;
+	}
+
+	// GL half of loading: takes the textures from the texture cache (handing it the pixels import() decoded), creates the
+	// mesh buffers and releases the CPU side copies.  Has to run on the thread that owns the GL context.
+	void upload()
+	{
+		chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+		for (unsigned int i = 0; i < images.size(); i++)
+		{
+			PendingTexture &pending = images[i];
+			Texture texture;
+			// a texture that was resident at import may have been released since, then the cache decodes it here
+			texture.id = texture_cache().acquire_decoded(texture_paths().path(pending.pathId), TextureSampling(), pending.image, pending.decoded);
+			texture.pathId = pending.pathId;
+			texture.type = pending.type;
+			textureIndex[texture.pathId] = (unsigned int)textures_loaded.size();
+			textures_loaded.push_back(texture);  // store it as texture loaded for entire model, to ensure we won't unnecesery load duplicate textures.
+		}
+		images.clear();
+
+		size_t textureRecords = 0;
+		for (unsigned int m = 0; m < imported.size(); m++)
+		{
+			vector<Texture> textures;
+			for (unsigned int t = 0; t < imported[m].textures.size(); t++)
+				textures.push_back(findTexture(imported[m].textures[t].pathId));
+			textureRecords += textures.size();
+			meshes.push_back(Mesh(std::move(imported[m].vertices), std::move(imported[m].indices), std::move(textures), false));
+			meshes.back().lods.swap(imported[m].lods);
+		}
+		imported.clear();
+		setupBuffers();
+
+		std::printf("Model %s: uploaded in %.1f ms, %u texture records in %u bytes\n", directory.c_str(),
+			chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count(),
+			(unsigned int)(textureRecords + textures_loaded.size()), (unsigned int)((textureRecords + textures_loaded.size()) * sizeof(Texture)));
+	}
+
+	// time reading the geometry of each file with Assimp (ReadFile and the copy into MeshData) and with the OBJ reader,
+	// best of runs each, and print both (run with --benchmark-obj).  Neither decodes textures or touches the model cache.
+	static void benchmark_import(const vector<string> &paths, int runs = 3)
+	{
+		for (unsigned int i = 0; i < paths.size(); i++)
+		{
+			double assimpBest = 0.0, objBest = 0.0;
+			unsigned int counts[2][3] = { { 0, 0, 0 }, { 0, 0, 0 } };	// meshes, vertices, triangles
+			for (int run = 0; run < runs; run++)
+			{
+				for (int reader = 0; reader < 2; reader++)
+				{
+					Model model;
+					chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+					if (reader == 0)
+					{
+						Assimp::Importer importer;
+						const aiScene* scene = importer.ReadFile(paths[i], importFlags);
+						if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode)
+						{
+							std::printf("ERROR::ASSIMP:: %s\n", importer.GetErrorString());
+							return;
+						}
+						model.processNode(scene->mRootNode, scene);
+					}
+					else if (!model.importObj(paths[i]))
+						return;
+					double milliseconds = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+					double &best = reader == 0 ? assimpBest : objBest;
+					best = run == 0 ? milliseconds : std::min(best, milliseconds);
+					counts[reader][0] = (unsigned int)model.imported.size();
+					counts[reader][1] = counts[reader][2] = 0;
+					for (unsigned int m = 0; m < model.imported.size(); m++)
+					{
+						counts[reader][1] += (unsigned int)model.imported[m].vertices.size();
+						counts[reader][2] += (unsigned int)model.imported[m].indices.size() / 3;
+					}
+				}
+			}
+			std::printf("Import %s: Assimp %.1f ms (%u meshes, %u vertices, %u triangles), OBJ reader %.1f ms (%u meshes, %u vertices, %u triangles), %.1fx\n",
+				paths[i].c_str(), assimpBest, counts[0][0], counts[0][1], counts[0][2], objBest, counts[1][0], counts[1][1], counts[1][2],
+				objBest > 0.0 ? assimpBest / objBest : 0.0);
+		}
 	}
 
 private:
+	/*  Render data  */
+	// every mesh in one vertex and one index buffer, sorted by material
+	VertexArrayHandle VAO, instanceVAO;
+	BufferHandle VBO, EBO;
+
+	// the levels of detail of a mesh in the index buffer, and the bounding sphere select_lod sizes them by
+	struct MeshLods
+	{
+		glm::vec3 center;
+		float radius;
+		unsigned int levels;	// 1 if the mesh has no simplified levels
+		GLsizei counts[MODEL_LOD_LEVELS];
+		const void *offsets[MODEL_LOD_LEVELS];
+	};
+
+	// meshes sharing their textures, drawn together
+	struct DrawGroup
+	{
+		unsigned int mesh;	// a mesh of the group, for its textures
+		vector<GLsizei> counts;	// of the selected levels of detail
+		vector<const void*> offsets;	// into the index buffer, in bytes
+		vector<GLint> baseVertices;
+		vector<MeshLods> lods;
+	};
+	vector<DrawGroup> groups;
+
+	// a mesh between import() and upload()
+	struct MeshData
+	{
+		vector<VertexModel> vertices;
+		vector<unsigned int> indices;
+		vector<vector<unsigned int> > lods;
+		vector<TextureRef> textures;
+	};
+
+	// a texture of the model between import() and upload(), type is the one of its first use
+	struct PendingTexture
+	{
+		unsigned int pathId;
+		TextureType type;
+		bool decoded;	// false if the texture cache already had it at import, or has a container for it
+		DecodedImage image;	// stbi_load result (pixels NULL if decoding failed)
+	};
+
+	vector<MeshData> imported;
+	vector<PendingTexture> images;
+
 	/*  Functions   */
-	// loads a model with supported ASSIMP extensions from file and stores the resulting meshes in the meshes vector.
-	void loadModel(string const &path)
+	// pack the meshes into the shared buffers, grouped by material (meshes with the same texture list)
+	void setupBuffers()
+	{
+		struct Material
+		{
+			// texture lists are compared by GL name and type, equal lists mean the same material
+			static bool less(const vector<Texture> &a, const vector<Texture> &b)
+			{
+				if (a.size() != b.size())
+					return a.size() < b.size();
+				for (unsigned int i = 0; i < a.size(); i++)
+				{
+					if (a[i].id != b[i].id)
+						return a[i].id < b[i].id;
+					if (a[i].type != b[i].type)
+						return a[i].type < b[i].type;
+				}
+				return false;
+			}
+		};
+		vector<unsigned int> order;
+		size_t vertexCount = 0, indexCount = 0;
+		quantization = VertexQuantization::identity();
+		for (unsigned int m = 0; m < meshes.size(); m++)
+		{
+			if (meshes[m].vertices.empty() || meshes[m].indices.empty())
+				continue;
+			if (packVertices)
+			{
+				VertexQuantization mesh = vertex_quantization(&meshes[m].vertices[0], meshes[m].vertices.size());
+				quantization = order.empty() ? mesh : vertex_quantization_union(quantization, mesh);
+			}
+			order.push_back(m);
+			vertexCount += meshes[m].vertices.size();
+			indexCount += meshes[m].indices.size();
+			for (unsigned int l = 0; l < meshes[m].lods.size(); l++)
+				indexCount += meshes[m].lods[l].size();
+		}
+		if (order.empty())
+			return;
+		std::stable_sort(order.begin(), order.end(), [this](unsigned int a, unsigned int b) { return Material::less(meshes[a].textures, meshes[b].textures); });
+
+		VAO = VertexArrayHandle::create();
+		VBO = BufferHandle::create();
+		EBO = BufferHandle::create();
+		glBindVertexArray(VAO.get());
+		glBindBuffer(GL_ARRAY_BUFFER, VBO.get());
+		size_t vertexSize = packVertices ? sizeof(PackedVertexModel) : sizeof(VertexModel);
+		glBufferData(GL_ARRAY_BUFFER, vertexCount * vertexSize, NULL, GL_STATIC_DRAW);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO.get());
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexCount * sizeof(unsigned int), NULL, GL_STATIC_DRAW);
+
+		// indices stay relative to their mesh, the base vertex moves them to its place in the vertex buffer.  The levels of
+		// detail of a mesh follow its full index list.
+		size_t baseVertex = 0, firstIndex = 0;
+		VertexPackingError packingError = VertexPackingError();
+		for (unsigned int i = 0; i < order.size(); i++)
+		{
+			const Mesh &mesh = meshes[order[i]];
+			if (packVertices)
+			{
+				vector<PackedVertexModel> packed = pack_model_vertices(&mesh.vertices[0], mesh.vertices.size(), quantization, packingError);
+				glBufferSubData(GL_ARRAY_BUFFER, baseVertex * vertexSize, packed.size() * vertexSize, &packed[0]);
+			}
+			else
+				glBufferSubData(GL_ARRAY_BUFFER, baseVertex * vertexSize, mesh.vertices.size() * vertexSize, &mesh.vertices[0]);
+
+			bounds = i == 0 ? mesh.bounds : bounds_union(bounds, mesh.bounds);
+
+			MeshLods lod;
+			lod.center = mesh.bounds.center;
+			lod.radius = mesh.bounds.radius;
+			lod.levels = (unsigned int)std::min(mesh.lods.size() + 1, (size_t)MODEL_LOD_LEVELS);
+			for (unsigned int l = 0; l < lod.levels; l++)
+			{
+				const vector<unsigned int> &indices = l == 0 ? mesh.indices : mesh.lods[l - 1];
+				glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, firstIndex * sizeof(unsigned int), indices.size() * sizeof(unsigned int), &indices[0]);
+				lod.counts[l] = (GLsizei)indices.size();
+				lod.offsets[l] = (const void*)(firstIndex * sizeof(unsigned int));
+				firstIndex += indices.size();
+			}
+
+			if (groups.empty() || Material::less(meshes[groups.back().mesh].textures, mesh.textures))
+			{
+				groups.push_back(DrawGroup());
+				groups.back().mesh = order[i];
+			}
+			DrawGroup &group = groups.back();
+			group.counts.push_back(lod.counts[0]);
+			group.offsets.push_back(lod.offsets[0]);
+			group.baseVertices.push_back((GLint)baseVertex);
+			group.lods.push_back(lod);
+			baseVertex += mesh.vertices.size();
+		}
+		setupVertexAttributes();
+		glBindVertexArray(0);
+		if (packVertices)
+			print_vertex_packing((directory + " model").c_str(), packingError, quantization, sizeof(VertexModel), sizeof(PackedVertexModel));
+	}
+
+	// attribute pointers of the bound VAO for the vertex buffer bound to GL_ARRAY_BUFFER, in the format upload() chose
+	void setupVertexAttributes()
+	{
+		if (packVertices)
+			setup_packed_vertex_model_attributes();
+		else
+			setup_vertex_model_attributes();
+	}
+
+	// weld and reorder every imported mesh (see mesh_optimizer.hpp) and log what it gained
+	void optimizeImported(string const &path)
+	{
+		chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+		unsigned int before = 0, after = 0;
+		for (unsigned int m = 0; m < imported.size(); m++)
+		{
+			MeshOptimizeStats stats = optimize_model_mesh(imported[m].vertices, imported[m].indices);
+			std::printf("  %s mesh %u: %u triangles, %u -> %u vertices, ACMR %.3f -> %.3f\n", path.c_str(), m, (unsigned int)imported[m].indices.size() / 3,
+				stats.verticesBefore, stats.verticesAfter, stats.acmrBefore, stats.acmrAfter);
+			before += stats.verticesBefore;
+			after += stats.verticesAfter;
+		}
+		std::printf("  %s: %u -> %u vertices, optimized in %.1f ms\n", path.c_str(), before, after,
+			chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count());
+	}
+
+	// simplified levels of detail of every imported mesh (see mesh_simplifier.hpp).  They need the welded meshes: before
+	// welding every corner is its own vertex and looks like a seam.
+	void simplifyImported(string const &path)
+	{
+		chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+		size_t triangles[MODEL_LOD_LEVELS] = { 0 };
+		for (unsigned int m = 0; m < imported.size(); m++)
+		{
+			imported[m].lods = build_model_lods(imported[m].vertices, imported[m].indices);
+			// a mesh without a level keeps drawing its previous one there
+			for (unsigned int l = 0; l < MODEL_LOD_LEVELS; l++)
+			{
+				unsigned int level = (unsigned int)std::min((size_t)l, imported[m].lods.size());
+				triangles[l] += (level == 0 ? imported[m].indices.size() : imported[m].lods[level - 1].size()) / 3;
+			}
+		}
+		std::printf("  %s: levels of detail", path.c_str());
+		for (unsigned int l = 0; l < MODEL_LOD_LEVELS; l++)
+			std::printf("%s%u", l == 0 ? " " : " / ", (unsigned int)triangles[l]);
+		std::printf(" triangles, simplified in %.1f ms\n", chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count());
+	}
+
+	// ModelCacheHeader::options matching the current settings
+	unsigned int cacheOptions() const
+	{
+		unsigned int options = objReader ? MODEL_CACHE_OBJ_READER : 0;
+		if (!optimizeMeshes)
+			return options;
+		return options | MODEL_CACHE_OPTIMIZED | (buildLods ? MODEL_CACHE_LODS : 0);
+	}
+
+	// decode each texture the imported meshes reference once, in order of first use.  Textures another model (or loader)
+	// already put in the texture cache are only shared at upload, not decoded again, and converted ones (see
+	// texture_container.hpp) are uploaded from their container.  The others are decoded together
+	// on the image decoder's threads.
+	void decodeTextures()
+	{
+		unordered_map<unsigned int, bool> decoded;
+		vector<future<DecodedImage> > decoding;
+		for (unsigned int m = 0; m < imported.size(); m++)
+		{
+			for (unsigned int t = 0; t < imported[m].textures.size(); t++)
+			{
+				TextureRef &ref = imported[m].textures[t];
+				ref.pathId = texture_paths().intern(canonical_texture_path(directory + '/' + ref.path));
+				if (decoded[ref.pathId])
+					continue;
+				decoded[ref.pathId] = true;
+
+				PendingTexture pending;
+				pending.pathId = ref.pathId;
+				pending.type = texture_type_from_name(ref.type);
+				pending.decoded = texture_cache().needs_decode(texture_paths().path(ref.pathId));
+				pending.image.width = pending.image.height = pending.image.components = 0;
+				pending.image.pixels = NULL;
+				if (pending.decoded)
+					decoding.push_back(image_decoder().decode(texture_paths().path(ref.pathId)));
+				images.push_back(pending);
+			}
+		}
+		for (unsigned int i = 0, d = 0; i < images.size(); i++)
+		{
+			if (images[i].decoded)
+				images[i].image = decoding[d++].get();
+		}
+	}
+
+	// meshes from the cache file, false (and nothing loaded) if it is missing, stale or damaged
+	bool readCache(string const &path, const ModelCacheKey &key)
+	{
+		MappedFile file;
+		if (!file.open(model_cache_path(path)) || file.size < sizeof(ModelCacheHeader))
+			return false;
+
+		ModelCacheHeader header;
+		memcpy(&header, file.data, sizeof(header));
+		if (memcmp(header.magic, "RCMC", 4) != 0 || header.version != MODEL_CACHE_VERSION || header.importFlags != importFlags ||
+			header.vertexSize != sizeof(VertexModel) || header.sourceSize != key.size || header.sourceTime != key.time || header.sourceHash != key.hash ||
+			header.options != cacheOptions())
+			return false;
+
+		// a truncated cache doesn't leave half a model behind
+		vector<MeshData> cached(header.meshCount);
+		size_t offset = sizeof(header);
+		for (unsigned int m = 0; m < header.meshCount; m++)
+		{
+			MeshData &mesh = cached[m];
+			ModelCacheMesh counts;
+			if (file.size - offset < sizeof(ModelCacheMesh))
+				return false;
+			memcpy(&counts, file.data + offset, sizeof(ModelCacheMesh));
+			offset += sizeof(ModelCacheMesh);
+			if (counts.lodCount >= (unsigned int)MODEL_LOD_LEVELS)
+				return false;
+			for (unsigned int t = 0; t < counts.textureCount; t++)
+			{
+				ModelCacheTexture texture;
+				if (file.size - offset < sizeof(texture))
+					return false;
+				memcpy(&texture, file.data + offset, sizeof(texture));
+				offset += sizeof(texture);
+				size_t length = ((size_t)texture.typeLength + texture.pathLength + 3) & ~(size_t)3;
+				if (file.size - offset < length)
+					return false;
+				const char *text = (const char*)file.data + offset;
+				TextureRef ref;
+				ref.pathId = 0;
+				ref.type.assign(text, texture.typeLength);
+				ref.path.assign(text + texture.typeLength, texture.pathLength);
+				mesh.textures.push_back(ref);
+				offset += length;
+			}
+			size_t vertexBytes = (size_t)counts.vertexCount * sizeof(VertexModel);
+			size_t indexBytes = (size_t)counts.indexCount * sizeof(unsigned int);
+			if (file.size - offset < vertexBytes + indexBytes)
+				return false;
+			const VertexModel *vertices = (const VertexModel*)(file.data + offset);
+			const unsigned int *indices = (const unsigned int*)(file.data + offset + vertexBytes);
+			mesh.vertices.assign(vertices, vertices + counts.vertexCount);
+			mesh.indices.assign(indices, indices + counts.indexCount);
+			offset += vertexBytes + indexBytes;
+			for (unsigned int l = 0; l < counts.lodCount; l++)
+			{
+				unsigned int lodCount;
+				if (file.size - offset < sizeof(lodCount))
+					return false;
+				memcpy(&lodCount, file.data + offset, sizeof(lodCount));
+				offset += sizeof(lodCount);
+				if ((file.size - offset) / sizeof(unsigned int) < lodCount)
+					return false;
+				const unsigned int *lodIndices = (const unsigned int*)(file.data + offset);
+				mesh.lods.push_back(vector<unsigned int>(lodIndices, lodIndices + lodCount));
+				offset += (size_t)lodCount * sizeof(unsigned int);
+			}
+		}
+
+		imported.swap(cached);
+		return true;
+	}
+
+	// write the processed meshes next to the asset (through a temporary file, so a crash never leaves a broken cache)
+	void writeCache(string const &path, const ModelCacheKey &key)
 	{
-		// read file via ASSIMP
-		Assimp::Importer importer;
-		const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_CalcTangentSpace);
-		// check for errors
-		if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) // if is Not Zero
+		string cachePath = model_cache_path(path);
+		string tempPath = cachePath + ".tmp";
+		ofstream out(tempPath.c_str(), ios::binary);
+		if (!out)
 		{
-			cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << endl;
+			std::printf("Could not write model cache %s\n", cachePath.c_str());
 			return;
 		}
-		// retrieve the directory path of the filepath
-		directory = path.substr(0, path.find_last_of('/'));
 
-		// process ASSIMP's root node recursively
-		processNode(scene->mRootNode, scene);
+		ModelCacheHeader header = { { 'R', 'C', 'M', 'C' }, MODEL_CACHE_VERSION, importFlags, (unsigned int)sizeof(VertexModel),
+			key.size, key.time, key.hash, (unsigned int)imported.size(), cacheOptions() };
+		out.write((const char*)&header, sizeof(header));
+		for (unsigned int m = 0; m < imported.size(); m++)
+		{
+			const MeshData &mesh = imported[m];
+			ModelCacheMesh counts = { (unsigned int)mesh.vertices.size(), (unsigned int)mesh.indices.size(), (unsigned int)mesh.textures.size(),
+				(unsigned int)mesh.lods.size() };
+			out.write((const char*)&counts, sizeof(counts));
+			for (unsigned int t = 0; t < mesh.textures.size(); t++)
+			{
+				ModelCacheTexture texture = { (unsigned int)mesh.textures[t].type.size(), (unsigned int)mesh.textures[t].path.size() };
+				out.write((const char*)&texture, sizeof(texture));
+				out.write(mesh.textures[t].type.c_str(), texture.typeLength);
+				out.write(mesh.textures[t].path.c_str(), texture.pathLength);
+				const char padding[4] = { 0, 0, 0, 0 };
+				out.write(padding, (4 - (texture.typeLength + texture.pathLength) % 4) % 4);
+			}
+			if (!mesh.vertices.empty())
+				out.write((const char*)&mesh.vertices[0], mesh.vertices.size() * sizeof(VertexModel));
+			if (!mesh.indices.empty())
+				out.write((const char*)&mesh.indices[0], mesh.indices.size() * sizeof(unsigned int));
+			for (unsigned int l = 0; l < mesh.lods.size(); l++)
+			{
+				unsigned int lodCount = (unsigned int)mesh.lods[l].size();
+				out.write((const char*)&lodCount, sizeof(lodCount));
+				out.write((const char*)&mesh.lods[l][0], lodCount * sizeof(unsigned int));
+			}
+		}
+		out.close();
+
+		if (!out)
+		{
+			std::printf("Could not write model cache %s\n", cachePath.c_str());
+			std::remove(tempPath.c_str());
+			return;
+		}
+		std::remove(cachePath.c_str());
+		std::rename(tempPath.c_str(), cachePath.c_str());
+	}
+
+	// read an OBJ file with the OBJ reader into imported, false if it didn't take the file
+	bool importObj(string const &path)
+	{
+		vector<ObjMesh> meshes;
+		if (!load_obj(path, meshes))
+			return false;
+		for (unsigned int m = 0; m < meshes.size(); m++)
+		{
+			imported.push_back(MeshData());
+			MeshData &data = imported.back();
+			data.vertices.swap(meshes[m].vertices);
+			data.indices.swap(meshes[m].indices);
+			for (unsigned int t = 0; t < meshes[m].textures.size(); t++)
+			{
+				TextureRef ref;
+				ref.type = meshes[m].textures[t].type;
+				ref.path = meshes[m].textures[t].path;
+				ref.pathId = 0;
+				data.textures.push_back(ref);
+			}
+		}
+		return true;
 	}
 
 	// processes a node in a recursive fashion. Processes each individual mesh located at the node and repeats this process on its children nodes (if any).
@@ -77,7 +752,8 @@ private:
 			// the node object only contains indices to index the actual objects in the scene. 
 			// the scene contains all the data, node is just to keep stuff organized (like relations between nodes).
 			aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-			meshes.push_back(processMesh(mesh, scene));
+			imported.push_back(MeshData());
+			processMesh(mesh, scene, imported.back());
 		}
 		// after we've processed all of the meshes (if any) we then recursively process each of the children nodes
 		for (unsigned int i = 0; i < node->mNumChildren; i++)
@@ -87,12 +763,12 @@ private:
 
 	}
 
-	Mesh processMesh(aiMesh *mesh, const aiScene *scene)
+	void processMesh(aiMesh *mesh, const aiScene *scene, MeshData &data)
 	{
 		// data to fill
-		vector<VertexModel> vertices;
-		vector<unsigned int> indices;
-		vector<Texture> textures;
+		vector<VertexModel> &vertices = data.vertices;
+		vector<unsigned int> &indices = data.indices;
+		vector<TextureRef> &textures = data.textures;
 
 		// Walk through each of the mesh's vertices
 		for (unsigned int i = 0; i < mesh->mNumVertices; i++)
@@ -151,93 +827,53 @@ private:
 		// normal: texture_normalN
 
 		// 1. diffuse maps
-		vector<Texture> diffuseMaps = loadMaterialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse");
+		vector<TextureRef> diffuseMaps = loadMaterialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse");
 		textures.insert(textures.end(), diffuseMaps.begin(), diffuseMaps.end());
 		// 2. specular maps
-		vector<Texture> specularMaps = loadMaterialTextures(material, aiTextureType_SPECULAR, "texture_specular");
+		vector<TextureRef> specularMaps = loadMaterialTextures(material, aiTextureType_SPECULAR, "texture_specular");
 		textures.insert(textures.end(), specularMaps.begin(), specularMaps.end());
 		// 3. normal maps
-		std::vector<Texture> normalMaps = loadMaterialTextures(material, aiTextureType_HEIGHT, "texture_normal");
+		std::vector<TextureRef> normalMaps = loadMaterialTextures(material, aiTextureType_HEIGHT, "texture_normal");
 		textures.insert(textures.end(), normalMaps.begin(), normalMaps.end());
 		// 4. height maps
-		std::vector<Texture> heightMaps = loadMaterialTextures(material, aiTextureType_AMBIENT, "texture_height");
+		std::vector<TextureRef> heightMaps = loadMaterialTextures(material, aiTextureType_AMBIENT, "texture_height");
 		textures.insert(textures.end(), heightMaps.begin(), heightMaps.end());
-
-		// return a mesh object created from the extracted mesh data
-		return Mesh(vertices, indices, textures);
 	}
 
-	// checks all material textures of a given type and loads the textures if they're not loaded yet.
-	// the required info is returned as a Texture struct.
-	vector<Texture> loadMaterialTextures(aiMaterial *mat, aiTextureType type, string typeName)
+	// the material textures of a given type
+	vector<TextureRef> loadMaterialTextures(aiMaterial *mat, aiTextureType type, string typeName)
 	{
-		vector<Texture> textures;
+		vector<TextureRef> textures;
 		for (unsigned int i = 0; i < mat->GetTextureCount(type); i++)
 		{
 			aiString str;
 			mat->GetTexture(type, i, &str);
-			// check if texture was loaded before and if so, continue to next iteration: skip loading a new texture
-			bool skip = false;
-			for (unsigned int j = 0; j < textures_loaded.size(); j++)
-			{
-				if (std::strcmp(textures_loaded[j].path.C_Str(), str.C_Str()) == 0)
-				{
-					textures.push_back(textures_loaded[j]);
-					skip = true; // a texture with the same filepath has already been loaded, continue to next one. (optimization)
-					break;
-				}
-			}
-			if (!skip)
-			{   // if texture hasn't been loaded already, load it
-				Texture texture;
-				texture.id = TextureFromFile(str.C_Str(), this->directory);
-				texture.type = typeName;
-				texture.path = str;
-				textures.push_back(texture);
-				textures_loaded.push_back(texture);  // store it as texture loaded for entire model, to ensure we won't unnecesery load duplicate textures.
-			}
+			TextureRef ref;
+			ref.type = typeName;
+			ref.path = str.C_Str();
+			ref.pathId = 0;
+			textures.push_back(ref);
 		}
 		return textures;
 	}
+
+	// the uploaded texture with this path.  A texture used under several types keeps the type of its first use.
+	Texture findTexture(unsigned int pathId)
+	{
+		unordered_map<unsigned int, unsigned int>::const_iterator found = textureIndex.find(pathId);
+		if (found != textureIndex.end())
+			return textures_loaded[found->second];
+		Texture texture = { 0, pathId, TEXTURE_DIFFUSE };
+		return texture;
+	}
 };
 
 
+// a mipmapped, repeating texture from the texture cache.  Shared with every other user of the file: give it back with
+// texture_cache().release.
 unsigned int TextureFromFile(const char *path, const string &directory, bool gamma)
 {
 	string filename = string(path);
 	filename = directory + '/' + filename;
-
-	unsigned int textureID;
-	glGenTextures(1, &textureID);
-
-	int width, height, nrComponents;
-	unsigned char *data = stbi_load(filename.c_str(), &width, &height, &nrComponents, 0);
-	if (data)
-	{
-		GLenum format;
-		if (nrComponents == 1)
-			format = GL_RED;
-		else if (nrComponents == 3)
-			format = GL_RGB;
-		else if (nrComponents == 4)
-			format = GL_RGBA;
-
-		glBindTexture(GL_TEXTURE_2D, textureID);
-		glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-		glGenerateMipmap(GL_TEXTURE_2D);
-
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-		stbi_image_free(data);
-	}
-	else
-	{
-		std::cout << "Texture failed to load at path: " << path << std::endl;
-		stbi_image_free(data);
-	}
-
-	return textureID;
+	return texture_cache().acquire(filename);
 }
@@ -0,0 +1,85 @@
+#ifndef MODEL_CACHE_H
+#define MODEL_CACHE_H
+
+#include <mapped_file.hpp>
+
+#include <string>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+// Processed model cache.  After an Assimp import the meshes (VertexModel arrays, indices and texture references) are
+// written to "<asset>.meshcache" next to the asset, and later runs map that file and upload it without Assimp.
+// The cache is only used while the asset still has the recorded size, modification time and content hash, and was
+// written with the same import flags, OBJ reader setting, mesh optimization and level of detail settings and VertexModel layout.  Delete the .meshcache files to force a fresh import.
+//
+// Layout (native endianness, the cache never leaves the machine that wrote it):
+//   ModelCacheHeader
+//   per mesh: ModelCacheMesh, its textures (ModelCacheTexture + type + path, padded to 4 bytes), vertices, indices,
+//             then per level of detail its index count and indices
+
+const unsigned int MODEL_CACHE_VERSION = 3;
+
+// ModelCacheHeader::options
+const unsigned int MODEL_CACHE_OPTIMIZED = 1;	// meshes went through optimize_model_mesh
+const unsigned int MODEL_CACHE_LODS = 2;	// meshes have their levels of detail (build_model_lods)
+const unsigned int MODEL_CACHE_OBJ_READER = 4;	// .obj files were read with obj_loader.hpp rather than Assimp
+
+struct ModelCacheHeader
+{
+	char magic[4];	// "RCMC"
+	unsigned int version;
+	unsigned int importFlags;
+	unsigned int vertexSize;	// sizeof(VertexModel)
+	unsigned long long sourceSize;
+	long long sourceTime;
+	unsigned long long sourceHash;
+	unsigned int meshCount;
+	unsigned int options;
+};
+
+struct ModelCacheMesh
+{
+	unsigned int vertexCount;
+	unsigned int indexCount;
+	unsigned int textureCount;
+	unsigned int lodCount;
+};
+
+struct ModelCacheTexture
+{
+	unsigned int typeLength;
+	unsigned int pathLength;
+};
+
+// what the cache is keyed on
+struct ModelCacheKey
+{
+	unsigned long long size;
+	long long time;
+	unsigned long long hash;
+};
+
+// FNV-1a over the whole asset.  The file is mapped, so this reads it once at memory speed.
+inline bool model_cache_key(const std::string &path, ModelCacheKey &key)
+{
+	struct stat st;
+	if (stat(path.c_str(), &st) != 0)
+		return false;
+	key.size = (unsigned long long)st.st_size;
+	key.time = (long long)st.st_mtime;
+
+	MappedFile file;
+	if (!file.open(path))
+		return false;
+	unsigned long long hash = 14695981039346656037ULL;
+	for (size_t i = 0; i < file.size; i++)
+		hash = (hash ^ file.data[i]) * 1099511628211ULL;
+	key.hash = hash;
+	return true;
+}
+
+inline std::string model_cache_path(const std::string &path)
+{
+	return path + ".meshcache";
+}
+#endif
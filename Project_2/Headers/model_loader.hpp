@@ -0,0 +1,100 @@
+#ifndef MODEL_LOADER_H
+#define MODEL_LOADER_H
+
+#include <model.hpp>
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+
+// Loads several models at once.  The CPU half of each load (cache read or Assimp import, vertex conversion, texture
+// decoding, see Model::import) runs on a pool of worker threads, one model per job, while the calling thread uploads
+// every model to GL as soon as its import is done.  The whole batch then takes about as long as the slowest model.
+//   load() has to be called on the thread that owns the GL context.
+class ModelLoader
+{
+public:
+	// queue a model for the next load(), the model has to stay alive until then
+	void add(Model &model, const std::string &path, bool gamma = false, bool useCache = true)
+	{
+		model.gammaCorrection = gamma;
+		Job job = { &model, path, useCache, false };
+		jobs.push_back(job);
+	}
+
+	// import all queued models in parallel and upload them, returns when every model is ready to draw
+	void load()
+	{
+		if (jobs.empty())
+			return;
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		unsigned int threads = std::min((unsigned int)jobs.size(), std::max(1u, std::thread::hardware_concurrency()));
+
+		std::atomic<unsigned int> next(0);
+		std::mutex mutex;
+		std::condition_variable done;
+		std::deque<unsigned int> finished;
+		std::vector<std::thread> workers;
+		for (unsigned int t = 0; t < threads; t++)
+		{
+			workers.push_back(std::thread([this, &next, &mutex, &done, &finished]()
+			{
+				for (unsigned int i = next++; i < jobs.size(); i = next++)
+				{
+					jobs[i].imported = jobs[i].model->import(jobs[i].path, jobs[i].useCache);
+					std::lock_guard<std::mutex> lock(mutex);
+					finished.push_back(i);
+					done.notify_one();
+				}
+			}));
+		}
+
+		// upload in the order the imports finish
+		double uploadMilliseconds = 0.0;
+		for (unsigned int uploaded = 0; uploaded < jobs.size(); uploaded++)
+		{
+			unsigned int i;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				done.wait(lock, [&finished]() { return !finished.empty(); });
+				i = finished.front();
+				finished.pop_front();
+			}
+			std::chrono::high_resolution_clock::time_point uploadStart = std::chrono::high_resolution_clock::now();
+			if (jobs[i].imported)
+				jobs[i].model->upload();
+			uploadMilliseconds += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - uploadStart).count();
+		}
+		for (unsigned int t = 0; t < workers.size(); t++)
+			workers[t].join();
+
+		double slowest = 0.0, sum = 0.0;
+		for (unsigned int i = 0; i < jobs.size(); i++)
+		{
+			slowest = std::max(slowest, jobs[i].model->importMilliseconds);
+			sum += jobs[i].model->importMilliseconds;
+		}
+		std::printf("Loaded %u models in %.1f ms on %u threads (imports: slowest %.1f ms, together %.1f ms; GL upload %.1f ms)\n",
+			(unsigned int)jobs.size(), std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count(),
+			threads, slowest, sum, uploadMilliseconds);
+		jobs.clear();
+	}
+
+private:
+	struct Job
+	{
+		Model *model;
+		std::string path;
+		bool useCache;
+		bool imported;
+	};
+	std::vector<Job> jobs;
+};
+#endif
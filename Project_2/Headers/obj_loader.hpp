@@ -0,0 +1,605 @@
+#ifndef OBJ_LOADER_H
+#define OBJ_LOADER_H
+
+#include <mesh.hpp>
+#include <mapped_file.hpp>
+
+#include <glm/glm.hpp>
+
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <fstream>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+// Wavefront OBJ/MTL reader for plain OBJ assets (all the scene models), so they skip Assimp's general importer.
+//   The file is mapped and cut into line aligned chunks, one per hardware thread, which are parsed in parallel; the
+//   triangles are then welded straight into VertexModel/index arrays.  The result matches what Model got from Assimp with
+//   aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_CalcTangentSpace: one mesh per object and material, polygons
+//   fanned into triangles, v flipped, and the MTL's map_Kd, map_Ks, map_Bump and map_Ka as texture_diffuse,
+//   texture_specular, texture_normal and texture_height.
+//   Tangents follow MikkTSpace's rules for a vertex: each triangle's tangent is projected onto the plane of the vertex
+//   normal and weighted by the corner angle, and corners whose UV frames have opposite handedness get separate vertices.
+//   Files it doesn't take (faces without normals, indices out of range) make load_obj return false, callers fall back to Assimp.
+
+struct ObjTexture
+{
+	std::string type;	// texture_diffuse, texture_specular, texture_normal or texture_height
+	std::string path;	// as the MTL names it, relative to the OBJ's directory
+};
+
+struct ObjMesh
+{
+	std::vector<VertexModel> vertices;
+	std::vector<unsigned int> indices;
+	std::vector<ObjTexture> textures;
+};
+
+// marks a missing texture coordinate or normal in a face corner
+const int OBJ_NO_INDEX = INT_MIN;
+
+// what one chunk of the file holds, in file order
+struct ObjChunk
+{
+	enum StatementType { OBJECT, MATERIAL, LIBRARY };
+	struct Statement
+	{
+		StatementType type;
+		size_t triangle;	// triangles of the chunk before it
+		std::string name;
+	};
+
+	std::vector<float> positions, texCoords, normals;	// 3, 2 and 3 floats each
+	std::vector<int> corners;	// position, texture coordinate and normal index of each triangle corner, 0-based
+	std::vector<size_t> relative;	// corners[] slots of negative indices, still counted from the chunk's first element
+	std::vector<Statement> statements;
+	size_t badLines;	// faces with an index of 0 or that didn't parse
+
+	ObjChunk() : badLines(0) {}
+};
+
+inline const char *obj_skip_space(const char *p, const char *end)
+{
+	while (p < end && (*p == ' ' || *p == '\t'))
+		p++;
+	return p;
+}
+
+inline const char *obj_token_end(const char *p, const char *end)
+{
+	while (p < end && *p != ' ' && *p != '\t')
+		p++;
+	return p;
+}
+
+// the text after keyword if the line starts with it (followed by a space), else NULL
+inline const char *obj_keyword(const char *p, const char *end, const char *keyword)
+{
+	size_t length = std::strlen(keyword);
+	if ((size_t)(end - p) <= length || std::memcmp(p, keyword, length) != 0 || (p[length] != ' ' && p[length] != '\t'))
+		return NULL;
+	return p + length;
+}
+
+// strtof for the plain decimals OBJ files hold ("-0.125", "1.5e-3"), without the locale or a copy of the token.
+// Returns the end of the number, or NULL if there is none.
+inline const char *obj_parse_float(const char *p, const char *end, float &value)
+{
+	static const double powers[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+		1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+	p = obj_skip_space(p, end);
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+'))
+		negative = *p++ == '-';
+	// up to 19 significant digits, the rest only move the decimal point
+	unsigned long long mantissa = 0;
+	int exponent = 0, significant = 0;
+	bool digits = false, fraction = false;
+	for (; p < end; p++)
+	{
+		if (*p == '.' && !fraction)
+		{
+			fraction = true;
+			continue;
+		}
+		if (*p < '0' || *p > '9')
+			break;
+		digits = true;
+		if (significant < 19)
+		{
+			mantissa = mantissa * 10 + (*p - '0');
+			significant += mantissa != 0 ? 1 : 0;
+			exponent -= fraction ? 1 : 0;
+		}
+		else if (!fraction)
+			exponent++;
+	}
+	if (!digits)
+		return NULL;
+	if (p < end && (*p == 'e' || *p == 'E'))
+	{
+		const char *q = p + 1;
+		bool negativeExponent = false;
+		if (q < end && (*q == '-' || *q == '+'))
+			negativeExponent = *q++ == '-';
+		if (q < end && *q >= '0' && *q <= '9')
+		{
+			int e = 0;
+			for (; q < end && *q >= '0' && *q <= '9'; q++)
+				e = std::min(e * 10 + (*q - '0'), 1000);
+			exponent += negativeExponent ? -e : e;
+			p = q;
+		}
+	}
+	double result = (double)mantissa;
+	if (exponent < 0)
+		result /= exponent >= -22 ? powers[-exponent] : std::pow(10.0, -exponent);
+	else if (exponent > 0)
+		result *= exponent <= 22 ? powers[exponent] : std::pow(10.0, exponent);
+	value = (float)(negative ? -result : result);
+	return p;
+}
+
+// a face index, NULL if there is none
+inline const char *obj_parse_index(const char *p, const char *end, int &value)
+{
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+'))
+		negative = *p++ == '-';
+	if (p >= end || *p < '0' || *p > '9')
+		return NULL;
+	long long v = 0;
+	for (; p < end && *p >= '0' && *p <= '9'; p++)
+		v = std::min(v * 10 + (*p - '0'), (long long)INT_MAX);
+	value = (int)(negative ? -v : v);
+	return p;
+}
+
+// the rest of the line without surrounding blanks
+inline std::string obj_rest_of_line(const char *p, const char *end)
+{
+	p = obj_skip_space(p, end);
+	while (end > p && (end[-1] == ' ' || end[-1] == '\t'))
+		end--;
+	return std::string(p, end);
+}
+
+// parse the lines in [begin, end) (the caller cut the file at line starts)
+inline void obj_parse_chunk(const char *begin, const char *end, ObjChunk *chunkPointer)
+{
+	ObjChunk &chunk = *chunkPointer;
+	// corners of the current polygon, with whether each index was relative
+	struct Corner
+	{
+		int index[3];
+		bool relative[3];
+	};
+	std::vector<Corner> polygon;
+	for (const char *p = begin; p < end;)
+	{
+		const char *lineEnd = (const char*)std::memchr(p, '\n', end - p);
+		if (!lineEnd)
+			lineEnd = end;
+		const char *line = obj_skip_space(p, lineEnd);
+		const char *e = lineEnd;
+		if (e > line && e[-1] == '\r')
+			e--;
+		p = lineEnd + 1;
+
+		const char *q;
+		if ((q = obj_keyword(line, e, "v")) != NULL)
+		{
+			float v[3] = { 0.0f, 0.0f, 0.0f };
+			for (int k = 0; k < 3 && q; k++)
+				q = obj_parse_float(q, e, v[k]);
+			chunk.positions.insert(chunk.positions.end(), v, v + 3);
+		}
+		else if ((q = obj_keyword(line, e, "vt")) != NULL)
+		{
+			// a missing v reads as 0, like Assimp
+			float v[2] = { 0.0f, 0.0f };
+			for (int k = 0; k < 2 && q; k++)
+				q = obj_parse_float(q, e, v[k]);
+			chunk.texCoords.insert(chunk.texCoords.end(), v, v + 2);
+		}
+		else if ((q = obj_keyword(line, e, "vn")) != NULL)
+		{
+			float v[3] = { 0.0f, 0.0f, 0.0f };
+			for (int k = 0; k < 3 && q; k++)
+				q = obj_parse_float(q, e, v[k]);
+			chunk.normals.insert(chunk.normals.end(), v, v + 3);
+		}
+		else if ((q = obj_keyword(line, e, "f")) != NULL)
+		{
+			// v, v/vt, v//vn or v/vt/vn per corner, 1-based or negative (counted back from the last element so far)
+			size_t counts[3] = { chunk.positions.size() / 3, chunk.texCoords.size() / 2, chunk.normals.size() / 3 };
+			polygon.clear();
+			bool valid = true;
+			for (q = obj_skip_space(q, e); q < e && valid; q = obj_skip_space(q, e))
+			{
+				Corner corner = { { OBJ_NO_INDEX, OBJ_NO_INDEX, OBJ_NO_INDEX }, { false, false, false } };
+				for (int k = 0; k < 3 && valid; k++)
+				{
+					if (k > 0)
+					{
+						if (q >= e || *q != '/')
+							break;
+						q++;
+						// v//vn skips the texture coordinate
+						if (k == 1 && q < e && *q == '/')
+							continue;
+					}
+					int index;
+					q = obj_parse_index(q, e, index);
+					valid = q != NULL && index != 0;
+					if (!valid)
+						break;
+					corner.relative[k] = index < 0;
+					corner.index[k] = index < 0 ? (int)counts[k] + index : index - 1;
+				}
+				if (valid && q < e && *q != ' ' && *q != '\t')
+					valid = false;
+				polygon.push_back(corner);
+			}
+			if (!valid || polygon.size() < 3)
+			{
+				chunk.badLines++;
+				continue;
+			}
+			// fan the polygon into triangles
+			for (size_t t = 1; t + 1 < polygon.size(); t++)
+			{
+				const Corner *triangle[3] = { &polygon[0], &polygon[t], &polygon[t + 1] };
+				for (int c = 0; c < 3; c++)
+				{
+					for (int k = 0; k < 3; k++)
+					{
+						if (triangle[c]->relative[k])
+							chunk.relative.push_back(chunk.corners.size());
+						chunk.corners.push_back(triangle[c]->index[k]);
+					}
+				}
+			}
+		}
+		else if ((q = obj_keyword(line, e, "o")) != NULL || (q = obj_keyword(line, e, "g")) != NULL)
+		{
+			ObjChunk::Statement statement = { ObjChunk::OBJECT, chunk.corners.size() / 9, obj_rest_of_line(q, e) };
+			chunk.statements.push_back(statement);
+		}
+		else if ((q = obj_keyword(line, e, "usemtl")) != NULL)
+		{
+			ObjChunk::Statement statement = { ObjChunk::MATERIAL, chunk.corners.size() / 9, obj_rest_of_line(q, e) };
+			chunk.statements.push_back(statement);
+		}
+		else if ((q = obj_keyword(line, e, "mtllib")) != NULL)
+		{
+			ObjChunk::Statement statement = { ObjChunk::LIBRARY, chunk.corners.size() / 9, obj_rest_of_line(q, e) };
+			chunk.statements.push_back(statement);
+		}
+		// comments, smoothing groups, lines, points and free-form geometry are skipped
+	}
+}
+
+// textures of every material in an MTL file, in the order Model lists them (diffuse, specular, normal, height)
+inline void load_obj_materials(const std::string &path, std::map<std::string, std::vector<ObjTexture> > &materials)
+{
+	std::ifstream file(path.c_str(), std::ios::binary);
+	if (!file)
+	{
+		std::printf("OBJ reader: no material library %s\n", path.c_str());
+		return;
+	}
+	static const char *keywords[] = { "map_kd", "map_ks", "map_bump", "bump", "map_ka" };
+	static const char *types[] = { "texture_diffuse", "texture_specular", "texture_normal", "texture_normal", "texture_height" };
+	static const int order[] = { 0, 1, 2, 2, 3 };
+	std::string line, material;
+	std::vector<int> slots;	// order of each texture of the current material
+	while (std::getline(file, line))
+	{
+		const char *p = obj_skip_space(line.c_str(), line.c_str() + line.size());
+		const char *e = line.c_str() + line.size();
+		if (e > p && e[-1] == '\r')
+			e--;
+		const char *keywordEnd = obj_token_end(p, e);
+		std::string keyword(p, keywordEnd);
+		std::transform(keyword.begin(), keyword.end(), keyword.begin(), ::tolower);
+		if (keyword == "newmtl")
+		{
+			material = obj_rest_of_line(keywordEnd, e);
+			materials[material].clear();
+			slots.clear();
+			continue;
+		}
+		for (int k = 0; k < 5; k++)
+		{
+			if (keyword != keywords[k])
+				continue;
+			// options (-bm 0.5, -s 1 1 1, -clamp on, ...) come before the file name
+			const char *q = obj_skip_space(keywordEnd, e);
+			while (q < e && *q == '-')
+			{
+				// the option, then its numbers or on/off (never the last word, that is the file)
+				q = obj_skip_space(obj_token_end(q, e), e);
+				for (const char *tokenEnd = obj_token_end(q, e); tokenEnd < e; tokenEnd = obj_token_end(q, e))
+				{
+					float number;
+					std::string word(q, tokenEnd);
+					if (obj_parse_float(q, tokenEnd, number) != tokenEnd && word != "on" && word != "off")
+						break;
+					q = obj_skip_space(tokenEnd, e);
+				}
+			}
+			ObjTexture texture = { types[k], obj_rest_of_line(q, e) };
+			std::vector<ObjTexture> &textures = materials[material];
+			if (texture.path.empty())
+				break;
+			// one texture per slot, the first one wins
+			if (std::find(slots.begin(), slots.end(), order[k]) != slots.end())
+				break;
+			size_t at = std::upper_bound(slots.begin(), slots.end(), order[k]) - slots.begin();
+			slots.insert(slots.begin() + at, order[k]);
+			textures.insert(textures.begin() + at, texture);
+			break;
+		}
+	}
+}
+
+// vertex key while welding: the corner's indices and the handedness of its triangle's UV frame
+struct ObjVertexKey
+{
+	int position, texCoord, normal, side;
+	bool operator==(const ObjVertexKey &other) const
+	{
+		return position == other.position && texCoord == other.texCoord && normal == other.normal && side == other.side;
+	}
+};
+
+struct ObjVertexKeyHash
+{
+	size_t operator()(const ObjVertexKey &key) const
+	{
+		size_t h = (size_t)(unsigned int)key.position * 0x9E3779B1u;
+		h ^= (size_t)(unsigned int)key.texCoord * 0x85EBCA77u + (h << 6) + (h >> 2);
+		h ^= (size_t)(unsigned int)key.normal * 0xC2B2AE3Du + (h << 6) + (h >> 2);
+		return h ^ (size_t)key.side;
+	}
+};
+
+// weld the triangles (corners as in ObjChunk) of one mesh and give the vertices their tangents
+inline void obj_build_mesh(const std::vector<float> &positions, const std::vector<float> &texCoords, const std::vector<float> &normals,
+	const std::vector<int> &corners, ObjMesh &mesh)
+{
+	size_t triangleCount = corners.size() / 9;
+	std::unordered_map<ObjVertexKey, unsigned int, ObjVertexKeyHash> welded;
+	welded.reserve(triangleCount * 2);
+	std::vector<float> sides;
+	mesh.indices.reserve(triangleCount * 3);
+	for (size_t t = 0; t < triangleCount; t++)
+	{
+		const int *c = &corners[9 * t];
+		glm::vec3 p[3], n[3];
+		glm::vec2 uv[3];
+		for (int k = 0; k < 3; k++)
+		{
+			p[k] = glm::vec3(positions[3 * c[3 * k]], positions[3 * c[3 * k] + 1], positions[3 * c[3 * k] + 2]);
+			n[k] = glm::vec3(normals[3 * c[3 * k + 2]], normals[3 * c[3 * k + 2] + 1], normals[3 * c[3 * k + 2] + 2]);
+			// aiProcess_FlipUVs
+			uv[k] = c[3 * k + 1] == OBJ_NO_INDEX ? glm::vec2(0.0f) : glm::vec2(texCoords[2 * c[3 * k + 1]], 1.0f - texCoords[2 * c[3 * k + 1] + 1]);
+		}
+
+		// the triangle's tangent frame, in the file's UVs like Assimp (which flips them afterwards): the bitangent follows
+		// v up the image, as the normal maps' green channel does.  A triangle without UV area adds no tangent.
+		glm::vec3 e1 = p[1] - p[0], e2 = p[2] - p[0];
+		glm::vec2 d1 = uv[1] - uv[0], d2 = uv[2] - uv[0];
+		d1.y = -d1.y;
+		d2.y = -d2.y;
+		float area = d1.x * d2.y - d2.x * d1.y;
+		glm::vec3 tangent(0.0f), bitangent(0.0f);
+		if (std::fabs(area) > 1e-20f)
+		{
+			tangent = (e1 * d2.y - e2 * d1.y) / area;
+			bitangent = (e2 * d1.x - e1 * d2.x) / area;
+		}
+		float side = glm::dot(glm::cross(glm::cross(e1, e2), tangent), bitangent) < 0.0f ? -1.0f : 1.0f;
+
+		for (int k = 0; k < 3; k++)
+		{
+			ObjVertexKey key = { c[3 * k], c[3 * k + 1], c[3 * k + 2], side < 0.0f ? 1 : 0 };
+			std::pair<std::unordered_map<ObjVertexKey, unsigned int, ObjVertexKeyHash>::iterator, bool> inserted =
+				welded.insert(std::make_pair(key, (unsigned int)mesh.vertices.size()));
+			if (inserted.second)
+			{
+				VertexModel vertex;
+				vertex.Position = p[k];
+				vertex.Normal = n[k];
+				vertex.TexCoords = uv[k];
+				vertex.Tangent = glm::vec3(0.0f);
+				vertex.Bitangent = glm::vec3(0.0f);
+				mesh.vertices.push_back(vertex);
+				sides.push_back(side);
+			}
+			unsigned int index = inserted.first->second;
+			mesh.indices.push_back(index);
+
+			// projected onto the vertex's tangent plane and weighted by the angle of the corner
+			glm::vec3 normal = n[k];
+			float length = glm::length(normal);
+			if (length > 0.0f)
+				normal /= length;
+			glm::vec3 projected = tangent - normal * glm::dot(normal, tangent);
+			glm::vec3 a = p[(k + 1) % 3] - p[k], b = p[(k + 2) % 3] - p[k];
+			float lengths = glm::length(a) * glm::length(b), projectedLength = glm::length(projected);
+			if (lengths > 0.0f && projectedLength > 0.0f && std::isfinite(projectedLength))
+				mesh.vertices[index].Tangent += projected / projectedLength * std::acos(glm::clamp(glm::dot(a, b) / lengths, -1.0f, 1.0f));
+		}
+	}
+
+	for (size_t v = 0; v < mesh.vertices.size(); v++)
+	{
+		VertexModel &vertex = mesh.vertices[v];
+		glm::vec3 normal = glm::length(vertex.Normal) > 0.0f ? glm::normalize(vertex.Normal) : glm::vec3(0.0f, 1.0f, 0.0f);
+		float length = glm::length(vertex.Tangent);
+		// no UV area around the vertex: any tangent perpendicular to the normal
+		if (length > 1e-12f)
+			vertex.Tangent /= length;
+		else
+			vertex.Tangent = glm::normalize(glm::cross(normal, std::fabs(normal.x) < 0.9f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f)));
+		vertex.Bitangent = glm::cross(normal, vertex.Tangent) * sides[v];
+	}
+}
+
+// is path an .obj file (by its extension)
+inline bool obj_file(const std::string &path)
+{
+	size_t dot = path.find_last_of('.');
+	if (dot == std::string::npos || path.find_first_of("/\\", dot) != std::string::npos)
+		return false;
+	std::string extension = path.substr(dot + 1);
+	std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+	return extension == "obj";
+}
+
+// Read an OBJ file and the MTL files it names into meshes.  Returns false (meshes left empty) if the file can't be read
+// or holds something this reader doesn't take.
+inline bool load_obj(const std::string &path, std::vector<ObjMesh> &meshes)
+{
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+	meshes.clear();
+	MappedFile file;
+	if (!file.open(path))
+		return false;
+	const char *data = (const char*)file.data;
+	size_t size = file.size;
+
+	// one chunk per thread, at least 256 KB each, every one starting at a line
+	unsigned int threads = (unsigned int)std::min((size_t)std::max(1u, std::thread::hardware_concurrency()), size / (256 * 1024) + 1);
+	std::vector<size_t> bounds(1, 0);
+	for (unsigned int t = 1; t < threads; t++)
+	{
+		size_t at = std::max(size * t / threads, bounds.back());
+		const char *newline = at < size ? (const char*)std::memchr(data + at, '\n', size - at) : NULL;
+		bounds.push_back(newline ? (size_t)(newline - data) + 1 : size);
+	}
+	bounds.push_back(size);
+	std::vector<ObjChunk> chunks(threads);
+	std::vector<std::thread> workers;
+	for (unsigned int t = 1; t < threads; t++)
+		workers.push_back(std::thread(obj_parse_chunk, data + bounds[t], data + bounds[t + 1], &chunks[t]));
+	obj_parse_chunk(data, data + bounds[1], &chunks[0]);
+	for (unsigned int i = 0; i < workers.size(); i++)
+		workers[i].join();
+	std::chrono::high_resolution_clock::time_point parsed = std::chrono::high_resolution_clock::now();
+
+	// join the chunks: relative indices get the counts of the chunks before them, triangles go to their object and material
+	std::vector<float> positions, texCoords, normals;
+	std::vector<std::string> libraries;
+	std::vector<std::vector<int> > meshCorners;
+	std::vector<std::string> meshMaterials;
+	std::map<std::pair<std::string, std::string>, unsigned int> meshIndex;
+	std::string object, material;
+	int current = -1;
+	size_t badLines = 0;
+	for (unsigned int c = 0; c < chunks.size(); c++)
+	{
+		ObjChunk &chunk = chunks[c];
+		int prefix[3] = { (int)(positions.size() / 3), (int)(texCoords.size() / 2), (int)(normals.size() / 3) };
+		for (size_t i = 0; i < chunk.relative.size(); i++)
+			chunk.corners[chunk.relative[i]] += prefix[chunk.relative[i] % 3];
+		positions.insert(positions.end(), chunk.positions.begin(), chunk.positions.end());
+		texCoords.insert(texCoords.end(), chunk.texCoords.begin(), chunk.texCoords.end());
+		normals.insert(normals.end(), chunk.normals.begin(), chunk.normals.end());
+		badLines += chunk.badLines;
+
+		size_t triangleCount = chunk.corners.size() / 9, next = 0;
+		for (size_t s = 0; s <= chunk.statements.size(); s++)
+		{
+			size_t until = s < chunk.statements.size() ? chunk.statements[s].triangle : triangleCount;
+			if (until > next)
+			{
+				if (current < 0)
+				{
+					std::pair<std::map<std::pair<std::string, std::string>, unsigned int>::iterator, bool> found =
+						meshIndex.insert(std::make_pair(std::make_pair(object, material), (unsigned int)meshCorners.size()));
+					if (found.second)
+					{
+						meshCorners.push_back(std::vector<int>());
+						meshMaterials.push_back(material);
+					}
+					current = (int)found.first->second;
+				}
+				meshCorners[current].insert(meshCorners[current].end(), chunk.corners.begin() + 9 * next, chunk.corners.begin() + 9 * until);
+				next = until;
+			}
+			if (s == chunk.statements.size())
+				break;
+			const ObjChunk::Statement &statement = chunk.statements[s];
+			if (statement.type == ObjChunk::OBJECT)
+				object = statement.name;
+			else if (statement.type == ObjChunk::MATERIAL)
+				material = statement.name;
+			else
+				libraries.push_back(statement.name);
+			if (statement.type != ObjChunk::LIBRARY)
+				current = -1;
+		}
+		std::vector<float>().swap(chunk.positions);
+		std::vector<float>().swap(chunk.texCoords);
+		std::vector<float>().swap(chunk.normals);
+		std::vector<int>().swap(chunk.corners);
+	}
+
+	// Model needs a normal on every vertex, and every index has to point at something
+	int counts[3] = { (int)(positions.size() / 3), (int)(texCoords.size() / 2), (int)(normals.size() / 3) };
+	size_t triangles = 0;
+	for (unsigned int m = 0; m < meshCorners.size(); m++)
+	{
+		const std::vector<int> &corners = meshCorners[m];
+		triangles += corners.size() / 9;
+		for (size_t i = 0; i < corners.size(); i++)
+		{
+			int k = (int)(i % 3);
+			bool missing = corners[i] == OBJ_NO_INDEX;
+			if ((missing && k != 1) || (!missing && (corners[i] < 0 || corners[i] >= counts[k])))
+			{
+				std::printf("OBJ reader: %s has %s, leaving it to Assimp\n", path.c_str(), missing ? "faces without normals" : "indices out of range");
+				return false;
+			}
+		}
+	}
+	if (triangles == 0)
+	{
+		std::printf("OBJ reader: %s has no faces, leaving it to Assimp\n", path.c_str());
+		return false;
+	}
+
+	std::map<std::string, std::vector<ObjTexture> > materials;
+	std::string directory = path.find_last_of("/\\") == std::string::npos ? std::string(".") : path.substr(0, path.find_last_of("/\\"));
+	for (unsigned int l = 0; l < libraries.size(); l++)
+		load_obj_materials(directory + "/" + libraries[l], materials);
+
+	unsigned int vertexCount = 0;
+	for (unsigned int m = 0; m < meshCorners.size(); m++)
+	{
+		if (meshCorners[m].empty())
+			continue;
+		meshes.push_back(ObjMesh());
+		obj_build_mesh(positions, texCoords, normals, meshCorners[m], meshes.back());
+		std::map<std::string, std::vector<ObjTexture> >::const_iterator found = materials.find(meshMaterials[m]);
+		if (found != materials.end())
+			meshes.back().textures = found->second;
+		vertexCount += (unsigned int)meshes.back().vertices.size();
+	}
+	std::chrono::high_resolution_clock::time_point end = std::chrono::high_resolution_clock::now();
+	std::printf("OBJ %s: %u meshes, %u triangles, %u vertices, parsed on %u threads in %.1f ms, welded in %.1f ms%s\n", path.c_str(),
+		(unsigned int)meshes.size(), (unsigned int)triangles, vertexCount, threads, std::chrono::duration<double, std::milli>(parsed - start).count(),
+		std::chrono::duration<double, std::milli>(end - parsed).count(), badLines ? " (skipped broken faces)" : "");
+	return true;
+}
+#endif
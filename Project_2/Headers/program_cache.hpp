@@ -0,0 +1,177 @@
+#ifndef PROGRAM_CACHE_H
+#define PROGRAM_CACHE_H
+
+#include <glad/glad.h>
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstdio>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#include <sys/types.h>
+#endif
+
+// On-disk cache of linked programs (glGetProgramBinary / glProgramBinary).  After a program is linked from source its
+// binary is written to "<cache directory>/<key>.glbin", and later runs hand that binary to the driver instead of
+// compiling.  The key hashes the GL vendor, renderer and version strings and the full text of every stage (so #defines
+// in the sources are part of it): a driver update or an edited shader simply misses.  Should the driver still refuse a
+// binary, the program is built from source and the file replaced.
+//
+// Layout (native endianness, the cache never leaves the machine that wrote it):
+//   ProgramCacheHeader, then the binary
+
+const unsigned int PROGRAM_CACHE_VERSION = 1;
+
+struct ProgramCacheHeader
+{
+	char magic[4];	// "RCPB"
+	unsigned int version;
+	unsigned long long key;
+	unsigned int format;	// binaryFormat from glGetProgramBinary
+	unsigned int length;
+};
+
+// what the programs of this run did (printed by main)
+struct ProgramCacheStats
+{
+	unsigned int loaded;	// programs taken from the cache
+	unsigned int compiled;	// programs built from source
+	unsigned int rejected;	// cached binaries the driver refused
+	unsigned int written;
+};
+
+inline ProgramCacheStats &program_cache_stats()
+{
+	static ProgramCacheStats stats = ProgramCacheStats();
+	return stats;
+}
+
+// main turns the cache off with --no-program-cache
+inline bool &program_cache_enabled()
+{
+	static bool enabled = true;
+	return enabled;
+}
+
+// the driver can hand out program binaries and take them back
+inline bool program_binaries_supported()
+{
+	if (glGetProgramBinary == NULL || glProgramBinary == NULL || glProgramParameteri == NULL)
+		return false;
+	GLint formats = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+	return formats > 0;
+}
+
+// FNV-1a over the driver strings and the stage sources (each with its length, so text can't move between stages)
+inline unsigned long long program_cache_key(const std::string *sources, unsigned int count)
+{
+	unsigned long long hash = 14695981039346656037ULL;
+	const GLenum strings[3] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+	for (int s = 0; s < 3; s++)
+	{
+		const char *text = (const char*)glGetString(strings[s]);
+		for (; text && *text; text++)
+			hash = (hash ^ (unsigned char)*text) * 1099511628211ULL;
+		hash = (hash ^ 0xffu) * 1099511628211ULL;
+	}
+	for (unsigned int i = 0; i < count; i++)
+	{
+		unsigned long long length = sources[i].size();
+		for (int b = 0; b < 8; b++)
+			hash = (hash ^ ((length >> (8 * b)) & 0xffu)) * 1099511628211ULL;
+		for (size_t c = 0; c < sources[i].size(); c++)
+			hash = (hash ^ (unsigned char)sources[i][c]) * 1099511628211ULL;
+	}
+	return hash;
+}
+
+// the cache lives in a "cache" directory next to the shader sources
+inline std::string program_cache_directory(const std::string &shaderPath)
+{
+	size_t slash = shaderPath.find_last_of("/\\");
+	return (slash == std::string::npos ? std::string(".") : shaderPath.substr(0, slash)) + "/cache";
+}
+
+inline std::string program_cache_path(const std::string &directory, unsigned long long key)
+{
+	char name[32];
+	std::snprintf(name, sizeof(name), "%016llx.glbin", key);
+	return directory + "/" + name;
+}
+
+// link program from its cached binary; false (and program left unlinked) if there is none or the driver refused it
+inline bool load_program_binary(GLuint program, const std::string &directory, unsigned long long key)
+{
+	std::string path = program_cache_path(directory, key);
+	std::ifstream in(path.c_str(), std::ios::binary);
+	if (!in)
+		return false;
+	ProgramCacheHeader header;
+	std::vector<char> binary;
+	bool valid = in.read((char*)&header, sizeof(header)) && std::string(header.magic, 4) == "RCPB" &&
+		header.version == PROGRAM_CACHE_VERSION && header.key == key && header.length > 0;
+	if (valid)
+	{
+		binary.resize(header.length);
+		valid = (bool)in.read(&binary[0], header.length);
+	}
+	in.close();
+
+	GLint linked = 0;
+	if (valid)
+	{
+		glProgramBinary(program, (GLenum)header.format, &binary[0], (GLsizei)header.length);
+		glGetProgramiv(program, GL_LINK_STATUS, &linked);
+	}
+	if (!linked)
+	{
+		// truncated, or the driver no longer takes it: build from source and write a new one
+		program_cache_stats().rejected++;
+		std::remove(path.c_str());
+		return false;
+	}
+	program_cache_stats().loaded++;
+	return true;
+}
+
+// write the binary of a linked program (linked with GL_PROGRAM_BINARY_RETRIEVABLE_HINT)
+inline void save_program_binary(GLuint program, const std::string &directory, unsigned long long key)
+{
+	GLint length = 0;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0)
+		return;
+	std::vector<char> binary(length);
+	GLenum format = 0;
+	glGetProgramBinary(program, length, &length, &format, &binary[0]);
+	if (length <= 0)
+		return;
+
+#ifdef _WIN32
+	_mkdir(directory.c_str());
+#else
+	mkdir(directory.c_str(), 0755);
+#endif
+	std::string path = program_cache_path(directory, key);
+	std::string tempPath = path + ".tmp";
+	std::ofstream out(tempPath.c_str(), std::ios::binary);
+	ProgramCacheHeader header = { { 'R', 'C', 'P', 'B' }, PROGRAM_CACHE_VERSION, key, (unsigned int)format, (unsigned int)length };
+	out.write((const char*)&header, sizeof(header));
+	out.write(&binary[0], length);
+	out.close();
+	if (!out)
+	{
+		std::printf("Could not write program cache %s\n", path.c_str());
+		std::remove(tempPath.c_str());
+		return;
+	}
+	std::remove(path.c_str());
+	std::rename(tempPath.c_str(), path.c_str());
+	program_cache_stats().written++;
+}
+#endif
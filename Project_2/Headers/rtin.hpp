@@ -0,0 +1,178 @@
+#ifndef RTIN_H
+#define RTIN_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+
+// Right-triangulated irregular network (RTIN) decimation of a height grid.
+//   Reference: Evans, Kirkpatrick & Townsend, "Right-Triangulated Irregular Networks", and Vladimir Agafonkin's "Martini"
+// The grid is split recursively into right triangles along their hypotenuses.  The error of a split is the distance between
+// the height at the hypotenuse midpoint and the straight line between its ends, and every error is raised to the largest one
+// below it.  Pulling out a mesh for a tolerance is then a walk down the tree that stops wherever the error is small enough,
+// and neighbouring triangles always agree on their shared edges so the mesh has no cracks.
+class Rtin
+{
+public:
+	// samples along each side of the RTIN grid, the smallest 2^k + 1 covering the heightmap
+	int gridSize;
+
+	// heights are x-major like Heightmap::heights
+	Rtin(const std::vector<unsigned short> &heights, int width, int height) : sourceWidth(width), sourceHeight(height)
+	{
+		gridSize = 2;
+		while (gridSize - 1 < std::max(width, height) - 1)
+			gridSize = (gridSize - 1) * 2 + 1;
+
+		// resample onto the RTIN grid.  When the heightmap already is 2^k + 1 this is an exact copy, otherwise it is the
+		// bilinear surface the full resolution grid describes.
+		terrain.resize(gridSize * gridSize);
+		for (int x = 0; x < gridSize; x++)
+		{
+			for (int y = 0; y < gridSize; y++)
+			{
+				glm::vec2 p = to_source(x, y);
+				int x0 = std::min((int)p.x, width - 2), y0 = std::min((int)p.y, height - 2);
+				float fx = p.x - x0, fy = p.y - y0;
+				float h00 = heights[x0 * width + y0], h01 = heights[x0 * width + y0 + 1];
+				float h10 = heights[(x0 + 1) * width + y0], h11 = heights[(x0 + 1) * width + y0 + 1];
+				terrain[y * gridSize + x] = ((h00 * (1 - fy) + h01 * fy) * (1 - fx) + (h10 * (1 - fy) + h11 * fy) * fx) / 65535.0f;
+			}
+		}
+
+		compute_errors();
+	}
+
+	// triangles a mesh with the given tolerance (normalized heights) would have
+	unsigned int triangle_count(float maxError) const
+	{
+		int max = gridSize - 1;
+		return count_triangles(0, 0, max, max, max, 0, maxError) + count_triangles(max, max, 0, 0, 0, max, maxError);
+	}
+
+	// welded, indexed mesh within maxError of the full grid.  Positions are heightmap grid coordinates (possibly fractional).
+	void create_mesh(float maxError, std::vector<glm::vec2> &positions, std::vector<unsigned int> &indices) const
+	{
+		std::vector<int> vertexIndex(gridSize * gridSize, -1);
+		int max = gridSize - 1;
+		emit_triangles(0, 0, max, max, max, 0, maxError, vertexIndex, positions, indices);
+		emit_triangles(max, max, 0, 0, 0, max, maxError, vertexIndex, positions, indices);
+	}
+
+private:
+	int sourceWidth, sourceHeight;
+	std::vector<float> terrain;
+	// error of splitting the triangles whose hypotenuse midpoint is this sample
+	std::vector<float> errors;
+
+	glm::vec2 to_source(int x, int y) const
+	{
+		return glm::vec2(float(x) * float(sourceWidth - 1) / float(gridSize - 1), float(y) * float(sourceHeight - 1) / float(gridSize - 1));
+	}
+
+	void compute_errors()
+	{
+		// triangles are numbered like a heap (id 2 and 3 are the two halves of the grid, 2n and 2n+1 the children of n).
+		// Walking the ids backwards visits every child before its parent.
+		int tileSize = gridSize - 1;
+		long long numTriangles = (long long)tileSize * tileSize * 2 - 2;
+		long long numParentTriangles = numTriangles - (long long)tileSize * tileSize;
+		errors.assign(gridSize * gridSize, 0.0f);
+
+		for (long long i = numTriangles - 1; i >= 0; i--)
+		{
+			// recover the hypotenuse (a, b) of triangle i from the bits of its id
+			long long id = i + 2;
+			int ax = 0, ay = 0, bx = 0, by = 0, cx = 0, cy = 0;
+			if (id & 1)
+				bx = by = cx = tileSize;
+			else
+				ax = ay = cy = tileSize;
+			while ((id >>= 1) > 1)
+			{
+				int mx = (ax + bx) >> 1;
+				int my = (ay + by) >> 1;
+				if (id & 1)
+				{
+					bx = ax; by = ay;
+					ax = cx; ay = cy;
+				}
+				else
+				{
+					ax = bx; ay = by;
+					bx = cx; by = cy;
+				}
+				cx = mx; cy = my;
+			}
+
+			int mx = (ax + bx) >> 1;
+			int my = (ay + by) >> 1;
+			cx = mx + my - ay;
+			cy = my + ax - mx;
+
+			int middle = my * gridSize + mx;
+			float interpolated = (terrain[ay * gridSize + ax] + terrain[by * gridSize + bx]) * 0.5f;
+			errors[middle] = std::max(errors[middle], std::fabs(interpolated - terrain[middle]));
+
+			if (i < numParentTriangles)
+			{
+				int left = ((ay + cy) >> 1) * gridSize + ((ax + cx) >> 1);
+				int right = ((by + cy) >> 1) * gridSize + ((bx + cx) >> 1);
+				errors[middle] = std::max(errors[middle], std::max(errors[left], errors[right]));
+			}
+		}
+	}
+
+	bool split(int ax, int ay, int bx, int by, int cx, int cy, float maxError) const
+	{
+		int mx = (ax + bx) >> 1;
+		int my = (ay + by) >> 1;
+		return std::abs(ax - cx) + std::abs(ay - cy) > 1 && errors[my * gridSize + mx] > maxError;
+	}
+
+	unsigned int count_triangles(int ax, int ay, int bx, int by, int cx, int cy, float maxError) const
+	{
+		if (!split(ax, ay, bx, by, cx, cy, maxError))
+			return 1;
+		int mx = (ax + bx) >> 1;
+		int my = (ay + by) >> 1;
+		return count_triangles(cx, cy, ax, ay, mx, my, maxError) + count_triangles(bx, by, cx, cy, mx, my, maxError);
+	}
+
+	void emit_triangles(int ax, int ay, int bx, int by, int cx, int cy, float maxError,
+		std::vector<int> &vertexIndex, std::vector<glm::vec2> &positions, std::vector<unsigned int> &indices) const
+	{
+		if (split(ax, ay, bx, by, cx, cy, maxError))
+		{
+			int mx = (ax + bx) >> 1;
+			int my = (ay + by) >> 1;
+			emit_triangles(cx, cy, ax, ay, mx, my, maxError, vertexIndex, positions, indices);
+			emit_triangles(bx, by, cx, cy, mx, my, maxError, vertexIndex, positions, indices);
+			return;
+		}
+
+		// same winding as Heightmap::create_indices
+		if ((bx - ax) * (cy - ay) - (by - ay) * (cx - ax) > 0)
+		{
+			std::swap(bx, cx);
+			std::swap(by, cy);
+		}
+		indices.push_back(weld(ax, ay, vertexIndex, positions));
+		indices.push_back(weld(bx, by, vertexIndex, positions));
+		indices.push_back(weld(cx, cy, vertexIndex, positions));
+	}
+
+	unsigned int weld(int x, int y, std::vector<int> &vertexIndex, std::vector<glm::vec2> &positions) const
+	{
+		int &index = vertexIndex[y * gridSize + x];
+		if (index < 0)
+		{
+			index = positions.size();
+			positions.push_back(to_source(x, y));
+		}
+		return index;
+	}
+};
+#endif
@@ -4,16 +4,194 @@
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 
+#include <program_cache.hpp>
+
 #include <string>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <cstring>
 #include <fstream>
 #include <sstream>
 #include <iostream>
 
+// glUniform* for each type the shaders use, by location
+inline void set_uniform(GLint location, bool value) { glUniform1i(location, (int)value); }
+inline void set_uniform(GLint location, int value) { glUniform1i(location, value); }
+inline void set_uniform(GLint location, float value) { glUniform1f(location, value); }
+inline void set_uniform(GLint location, const glm::vec2 &value) { glUniform2fv(location, 1, &value[0]); }
+inline void set_uniform(GLint location, const glm::vec3 &value) { glUniform3fv(location, 1, &value[0]); }
+inline void set_uniform(GLint location, const glm::vec4 &value) { glUniform4fv(location, 1, &value[0]); }
+inline void set_uniform(GLint location, const glm::mat2 &mat) { glUniformMatrix2fv(location, 1, GL_FALSE, &mat[0][0]); }
+inline void set_uniform(GLint location, const glm::mat3 &mat) { glUniformMatrix3fv(location, 1, GL_FALSE, &mat[0][0]); }
+inline void set_uniform(GLint location, const glm::mat4 &mat) { glUniformMatrix4fv(location, 1, GL_FALSE, &mat[0][0]); }
+
+// A uniform whose location was looked up once (Shader::uniform), so setting it is a bare glUniform* call.  Like the
+// Shader setters it sets the uniform of the program in use; an inactive uniform has location -1, which GL ignores.
+template <typename T>
+class Uniform
+{
+public:
+	GLint location;
+
+	Uniform() : location(-1) {}
+	explicit Uniform(GLint location) : location(location) {}
+
+	void set(const T &value) const { set_uniform(location, value); }
+	bool active() const { return location >= 0; }
+};
+
+// Name of a uniform for the Shader setters: a string literal or a std::string, taken without copying either
+struct UniformName
+{
+	const char *str;
+
+	UniformName(const char *str) : str(str) {}
+	UniformName(const std::string &str) : str(str.c_str()) {}
+};
+
+// Locations of a program's active uniforms, read once after linking (glGetActiveUniform) into an open addressing hash
+// table, so the setters find a name without asking the driver.  Arrays are entered as "name" and as "name[i]" for each
+// element; the members of arrays of structs ("pointLights[0].position") are active uniforms of their own already.
+class UniformTable
+{
+public:
+	explicit UniformTable(GLuint program)
+	{
+		GLint count = 0, maxLength = 0;
+		glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &count);
+		glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+		std::vector<GLchar> buffer(std::max(maxLength, 1) + 1, 0);
+		for (GLint u = 0; u < count; u++)
+		{
+			GLsizei length = 0;
+			GLint size = 0;
+			GLenum type = 0;
+			glGetActiveUniform(program, (GLuint)u, (GLsizei)buffer.size(), &length, &size, &type, &buffer[0]);
+			std::string name(&buffer[0], length);
+			GLint location = glGetUniformLocation(program, name.c_str());
+			if (location < 0)
+				continue;	// a member of a uniform block, it is set through the block's buffer
+			// arrays are reported as "name[0]" by most drivers and as "name" by some
+			bool array = size > 1 || (name.size() > 3 && name.compare(name.size() - 3, 3, "[0]") == 0);
+			if (array && name.compare(name.size() - 3, 3, "[0]") == 0)
+				name.erase(name.size() - 3);
+			add(name, location);
+			for (GLint i = 0; array && i < size; i++)
+			{
+				std::stringstream element;
+				element << name << "[" << i << "]";
+				add(element.str(), glGetUniformLocation(program, element.str().c_str()));
+			}
+		}
+		// at most half full, so a probe ends at an empty slot soon
+		unsigned int slotCount = 16;
+		while (slotCount < 2 * names.size())
+			slotCount *= 2;
+		slots.assign(slotCount, -1);
+		for (unsigned int e = 0; e < names.size(); e++)
+		{
+			unsigned int slot = hashes[e] & (slotCount - 1);
+			while (slots[slot] >= 0)
+				slot = (slot + 1) & (slotCount - 1);
+			slots[slot] = (int)e;
+		}
+	}
+
+	// location of the uniform called name, -1 if the program has no such active uniform
+	GLint find(const char *name) const
+	{
+		unsigned int hash = hash_name(name);
+		unsigned int mask = (unsigned int)slots.size() - 1;
+		for (unsigned int slot = hash & mask; slots[slot] >= 0; slot = (slot + 1) & mask)
+		{
+			unsigned int e = (unsigned int)slots[slot];
+			if (hashes[e] == hash && names[e] == name)
+				return locations[e];
+		}
+		return -1;
+	}
+
+	unsigned int size() const { return (unsigned int)names.size(); }
+
+private:
+	std::vector<std::string> names;
+	std::vector<unsigned int> hashes;
+	std::vector<GLint> locations;
+	std::vector<int> slots;	// index into names, -1 when empty
+
+	// FNV-1a
+	static unsigned int hash_name(const char *name)
+	{
+		unsigned int hash = 2166136261u;
+		for (; *name; name++)
+			hash = (hash ^ (unsigned char)*name) * 16777619u;
+		return hash;
+	}
+
+	void add(const std::string &name, GLint location)
+	{
+		if (location < 0)
+			return;
+		names.push_back(name);
+		hashes.push_back(hash_name(name.c_str()));
+		locations.push_back(location);
+	}
+};
+
+// GL_KHR_parallel_shader_compile (the same as GL_ARB_parallel_shader_compile); the glad loader here is generated without
+// extensions, so its names are declared here
+#ifndef GL_KHR_parallel_shader_compile
+#define GL_MAX_SHADER_COMPILER_THREADS_KHR 0x91B0
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+typedef void (APIENTRYP PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)(GLuint count);
+#endif
+
+// How Shaders are built.  Deferred (the default): the constructor only submits the compiles and the link, and their
+// status is checked when the program is first used (Shader::finish), so the driver can work on all the programs at
+// once - on its own threads with parallel shader compile.  Not deferred: every constructor waits for its program.
+struct ShaderBuildSettings
+{
+	bool deferred;
+	bool parallel;	// the driver compiles in the background (enable_parallel_shader_compile)
+};
+
+inline ShaderBuildSettings &shader_build_settings()
+{
+	static ShaderBuildSettings settings = { true, false };
+	return settings;
+}
+
+// ask the driver to compile and link on its own threads; false if it has no parallel shader compile.  Call once after
+// glad is loaded, with the same loader.
+inline bool enable_parallel_shader_compile(GLADloadproc load)
+{
+	GLint count = 0;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+	bool found = false;
+	for (GLint i = 0; i < count && !found; i++)
+	{
+		const char *name = (const char*)glGetStringi(GL_EXTENSIONS, (GLuint)i);
+		found = name != NULL && (std::strcmp(name, "GL_KHR_parallel_shader_compile") == 0 || std::strcmp(name, "GL_ARB_parallel_shader_compile") == 0);
+	}
+	if (!found)
+		return false;
+	PFNGLMAXSHADERCOMPILERTHREADSKHRPROC maxShaderCompilerThreads = (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)load("glMaxShaderCompilerThreadsKHR");
+	if (maxShaderCompilerThreads == NULL)
+		maxShaderCompilerThreads = (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)load("glMaxShaderCompilerThreadsARB");
+	// as many threads as the driver wants
+	if (maxShaderCompilerThreads != NULL)
+		maxShaderCompilerThreads(0xFFFFFFFFu);
+	shader_build_settings().parallel = true;
+	return true;
+}
+
 class Shader
 {
 public:
 	unsigned int ID;
-	// constructor generates the shader on the fly
+	// constructor generates the shader on the fly.  With deferred builds (see ShaderBuildSettings) it returns once the
+	// compiles and the link are submitted, and the first use() or uniform lookup waits for them and reports errors.
 	// ------------------------------------------------------------------------
 	Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr)
 	{
@@ -57,116 +235,199 @@ public:
 		{
 			std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
 		}
-		const char* vShaderCode = vertexCode.c_str();
-		const char * fShaderCode = fragmentCode.c_str();
-		// 2. compile shaders
-		unsigned int vertex, fragment;
-		int success;
-		char infoLog[512];
-		// vertex shader
-		vertex = glCreateShader(GL_VERTEX_SHADER);
-		glShaderSource(vertex, 1, &vShaderCode, NULL);
-		glCompileShader(vertex);
-		checkCompileErrors(vertex, "VERTEX");
-		// fragment Shader
-		fragment = glCreateShader(GL_FRAGMENT_SHADER);
-		glShaderSource(fragment, 1, &fShaderCode, NULL);
-		glCompileShader(fragment);
-		checkCompileErrors(fragment, "FRAGMENT");
-		// if geometry shader is given, compile geometry shader
-		unsigned int geometry;
-		if (geometryPath != nullptr)
+		// 2. the linked program from the program cache (program_cache.hpp) if this driver has built these sources before,
+		// otherwise compile and link them (finish keeps the binary for next time)
+		ID = glCreateProgram();
+		state = std::make_shared<BuildState>();
+		std::string cacheDirectory = program_cache_directory(vertexPath);
+		std::string sources[3] = { vertexCode, fragmentCode, geometryCode };
+		bool useCache = program_cache_enabled() && !vertexCode.empty() && !fragmentCode.empty() && program_binaries_supported();
+		unsigned long long cacheKey = useCache ? program_cache_key(sources, 3) : 0;
+		if (!useCache || !load_program_binary(ID, cacheDirectory, cacheKey))
 		{
-			const char * gShaderCode = geometryCode.c_str();
-			geometry = glCreateShader(GL_GEOMETRY_SHADER);
-			glShaderSource(geometry, 1, &gShaderCode, NULL);
-			glCompileShader(geometry);
-			checkCompileErrors(geometry, "GEOMETRY");
+			program_cache_stats().compiled++;
+			if (useCache)
+			{
+				glProgramParameteri(ID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+				state->saveBinary = true;
+				state->cacheDirectory = cacheDirectory;
+				state->cacheKey = cacheKey;
+			}
+			submit(vertexCode, fragmentCode, geometryPath != nullptr ? &geometryCode : nullptr);
 		}
-		// shader Program
-		ID = glCreateProgram();
-		glAttachShader(ID, vertex);
-		glAttachShader(ID, fragment);
-		if (geometryPath != nullptr)
-			glAttachShader(ID, geometry);
-		glLinkProgram(ID);
-		checkCompileErrors(ID, "PROGRAM");
-		// delete the shaders as they're linked into our program now and no longer necessery
-		glDeleteShader(vertex);
-		glDeleteShader(fragment);
-		if (geometryPath != nullptr)
-			glDeleteShader(geometry);
-
+		if (!shader_build_settings().deferred)
+			finish();
 	}
 	// activate the shader
 	// ------------------------------------------------------------------------
-	void use()
+	void use() const
 	{
+		finish();
 		glUseProgram(ID);
 	}
+	// wait for the program's compile and link, report their errors and look up its uniforms; true if it linked.  Only
+	// the first call does anything, and use() and the uniform lookups make it, so a program is waited for when it is
+	// first needed.
+	bool finish() const
+	{
+		BuildState &build = *state;
+		if (build.finished)
+			return build.linked;
+		build.finished = true;
+		for (unsigned int s = 0; s < build.stageCount; s++)
+		{
+			checkCompileErrors(build.stages[s], build.stageTypes[s]);
+			// delete the shaders as they're linked into our program now and no longer necessery
+			glDeleteShader(build.stages[s]);
+		}
+		checkCompileErrors(ID, "PROGRAM");
+		GLint linked = 0;
+		glGetProgramiv(ID, GL_LINK_STATUS, &linked);
+		build.linked = linked != 0;
+		if (build.linked && build.saveBinary)
+			save_program_binary(ID, build.cacheDirectory, build.cacheKey);
+		// look up every uniform once, the setters then only hash the name
+		if (build.lookupUniforms)
+			build.uniforms.reset(new UniformTable(ID));
+		return build.linked;
+	}
+	// finish() won't wait: the driver is done with the program (always true without parallel shader compile, where the
+	// compile and link calls themselves do the work)
+	bool ready() const
+	{
+		if (state->finished || !shader_build_settings().parallel)
+			return true;
+		GLint done = 0;
+		glGetProgramiv(ID, GL_COMPLETION_STATUS_KHR, &done);
+		return done != 0;
+	}
+	// no uniform table: the setters ask the driver with glGetUniformLocation on every call
+	void dropUniformTable()
+	{
+		state->lookupUniforms = false;
+		state->uniforms.reset();
+	}
+	// location of a uniform of this program, -1 if it is not active
+	GLint location(const UniformName &name) const
+	{
+		finish();
+		const UniformTable *uniforms = state->uniforms.get();
+		return uniforms ? uniforms->find(name.str) : glGetUniformLocation(ID, name.str);
+	}
+	// typed handle of a uniform, to look its name up once and set it every frame
+	template <typename T>
+	Uniform<T> uniform(const UniformName &name) const
+	{
+		return Uniform<T>(location(name));
+	}
 	// utility uniform functions
 	// ------------------------------------------------------------------------
-	void setBool(const std::string &name, bool value) const
+	void setBool(const UniformName &name, bool value) const
 	{
-		glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+		set_uniform(location(name), value);
 	}
 	// ------------------------------------------------------------------------
-	void setInt(const std::string &name, int value) const
+	void setInt(const UniformName &name, int value) const
 	{
-		glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+		set_uniform(location(name), value);
 	}
 	// ------------------------------------------------------------------------
-	void setFloat(const std::string &name, float value) const
+	void setFloat(const UniformName &name, float value) const
 	{
-		glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+		set_uniform(location(name), value);
 	}
 	// ------------------------------------------------------------------------
-	void setVec2(const std::string &name, const glm::vec2 &value) const
+	void setVec2(const UniformName &name, const glm::vec2 &value) const
 	{
-		glUniform2fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+		set_uniform(location(name), value);
 	}
-	void setVec2(const std::string &name, float x, float y) const
+	void setVec2(const UniformName &name, float x, float y) const
 	{
-		glUniform2f(glGetUniformLocation(ID, name.c_str()), x, y);
+		glUniform2f(location(name), x, y);
 	}
 	// ------------------------------------------------------------------------
-	void setVec3(const std::string &name, const glm::vec3 &value) const
+	void setVec3(const UniformName &name, const glm::vec3 &value) const
 	{
-		glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+		set_uniform(location(name), value);
 	}
-	void setVec3(const std::string &name, float x, float y, float z) const
+	void setVec3(const UniformName &name, float x, float y, float z) const
 	{
-		glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z);
+		glUniform3f(location(name), x, y, z);
 	}
 	// ------------------------------------------------------------------------
-	void setVec4(const std::string &name, const glm::vec4 &value) const
+	void setVec4(const UniformName &name, const glm::vec4 &value) const
 	{
-		glUniform4fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+		set_uniform(location(name), value);
 	}
-	void setVec4(const std::string &name, float x, float y, float z, float w)
+	void setVec4(const UniformName &name, float x, float y, float z, float w)
 	{
-		glUniform4f(glGetUniformLocation(ID, name.c_str()), x, y, z, w);
+		glUniform4f(location(name), x, y, z, w);
 	}
 	// ------------------------------------------------------------------------
-	void setMat2(const std::string &name, const glm::mat2 &mat) const
+	void setMat2(const UniformName &name, const glm::mat2 &mat) const
 	{
-		glUniformMatrix2fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+		set_uniform(location(name), mat);
 	}
 	// ------------------------------------------------------------------------
-	void setMat3(const std::string &name, const glm::mat3 &mat) const
+	void setMat3(const UniformName &name, const glm::mat3 &mat) const
 	{
-		glUniformMatrix3fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+		set_uniform(location(name), mat);
 	}
 	// ------------------------------------------------------------------------
-	void setMat4(const std::string &name, const glm::mat4 &mat) const
+	void setMat4(const UniformName &name, const glm::mat4 &mat) const
 	{
-		glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+		set_uniform(location(name), mat);
 	}
 
 private:
+	// how far the program got, shared by the copies of the Shader (it is passed by value)
+	struct BuildState
+	{
+		bool finished;
+		bool linked;
+		bool saveBinary;	// write the linked binary to the program cache
+		bool lookupUniforms;
+		GLuint stages[3];	// compiled shaders, deleted once checked
+		const char *stageTypes[3];
+		unsigned int stageCount;
+		std::string cacheDirectory;
+		unsigned long long cacheKey;
+		std::unique_ptr<UniformTable> uniforms;	// active uniforms once finished
+
+		BuildState() : finished(false), linked(false), saveBinary(false), lookupUniforms(true), stageCount(0), cacheKey(0)
+		{
+		}
+	};
+	std::shared_ptr<BuildState> state;
+
+	// submit the compiles of the stages and the link into ID without waiting for any of them (finish checks them)
+	void submit(const std::string &vertexCode, const std::string &fragmentCode, const std::string *geometryCode)
+	{
+		compile(GL_VERTEX_SHADER, vertexCode, "VERTEX");
+		compile(GL_FRAGMENT_SHADER, fragmentCode, "FRAGMENT");
+		// if geometry shader is given, compile geometry shader
+		if (geometryCode != nullptr)
+			compile(GL_GEOMETRY_SHADER, *geometryCode, "GEOMETRY");
+		// shader Program
+		for (unsigned int s = 0; s < state->stageCount; s++)
+			glAttachShader(ID, state->stages[s]);
+		glLinkProgram(ID);
+	}
+
+	void compile(GLenum type, const std::string &code, const char *typeName)
+	{
+		const char *source = code.c_str();
+		GLuint shader = glCreateShader(type);
+		glShaderSource(shader, 1, &source, NULL);
+		glCompileShader(shader);
+		state->stages[state->stageCount] = shader;
+		state->stageTypes[state->stageCount] = typeName;
+		state->stageCount++;
+	}
+
 	// utility function for checking shader compilation/linking errors.
 	// ------------------------------------------------------------------------
-	void checkCompileErrors(GLuint shader, std::string type)
+	static void checkCompileErrors(GLuint shader, std::string type)
 	{
 		GLint success;
 		GLchar infoLog[1024];
@@ -0,0 +1,423 @@
+#ifndef TERRAIN_H
+#define TERRAIN_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <vector>
+#include <iostream>
+#include <algorithm>
+#include <limits>
+#include <cmath>
+
+#include <shader.hpp>
+#include <heightmap.hpp>
+#include <terrain_tiles.hpp>
+#include <frustum.hpp>
+#include <vertex_cache.hpp>
+
+// Quadtree terrain with continuous distance-dependent level of detail (CDLOD).
+//   Reference: Filip Strugar, "Continuous Distance-Dependent Level of Detail for Rendering Heightmaps"
+// Every node is drawn with the same small grid patch.  The vertex shader places the patch over the node, reads the
+// height from a texture and slides odd vertices onto the next coarser grid as the camera moves away, so levels
+// blend into each other instead of popping.  The number of nodes drawn only depends on the view, not on the size
+// of the heightmap.  Heights come either from a Heightmap held in memory or from a TerrainTiles file streamed around
+// the camera.
+
+struct TerrainNode {
+	// first grid cell covered and number of cells along each side
+	int x, y, size;
+	// 0 is the finest level
+	int level;
+	// world space bounds from the height data
+	glm::vec3 boxMin, boxMax;
+	// child node indices, -1 if the child lies outside the heightmap (or this is a leaf)
+	int children[4];
+};
+
+struct TerrainSelection {
+	// node to draw, its lod level and which quadrants of its patch to draw (bit i = child i)
+	int node;
+	int level;
+	int quadrants;
+};
+
+class Terrain
+{
+public:
+	// quads along each side of the shared patch (even, so the patch splits into 4 quadrants)
+	static const int PATCH_SIZE = 32;
+
+	// lod selection: a grid quad should cover about pixelError pixels on screen
+	float pixelError = 4.0f;
+	// fraction of each lod range after which vertices start morphing to the next level
+	float morphStartRatio = 0.66f;
+
+	// number of levels in the quadtree
+	int levels;
+
+	// counters from the last update()
+	unsigned int nodesTested = 0;
+	unsigned int nodesSelected = 0;
+	unsigned int trianglesDrawn = 0;
+
+	std::vector<TerrainNode> nodes;
+	std::vector<TerrainSelection> selection;
+
+	// constructor, builds the quadtree bounds and the height texture from the heightmap samples
+	Terrain(const Heightmap &heightmap) : width(heightmap.width), height(heightmap.height),
+		offset(heightmap.offset), scale(heightmap.scale), tiles(NULL), source(&heightmap)
+	{
+		create_quadtree();
+		create_height_texture(heightmap);
+		create_normal_texture(heightmap);
+		setup_patch();
+		source = NULL;
+	}
+
+	// constructor for streamed terrain, the quadtree bounds come from the tile file's bounds table
+	Terrain(TerrainTiles &terrainTiles) : heightTexture(0), normalTexture(0), width(terrainTiles.header.sizeX), height(terrainTiles.header.sizeY),
+		offset(terrainTiles.offset), scale(terrainTiles.scale), tiles(&terrainTiles), source(NULL)
+	{
+		if (tiles->header.tileSize % PATCH_SIZE != 0)
+			std::cout << "Terrain tile size should be a multiple of " << PATCH_SIZE << std::endl;
+		create_quadtree();
+		setup_patch();
+	}
+
+	// choose the nodes to draw for this frame (distance/screen-space error selection and frustum culling)
+	void update(const glm::vec3 &cameraPos, const glm::mat4 &projection, const glm::mat4 &view, float fovy, float viewportHeight)
+	{
+		camera = cameraPos;
+		frustum.extract(projection * view);
+
+		// page tiles in around the camera first so this frame can already use them
+		if (tiles)
+			tiles->update(cameraPos);
+
+		// distance at which one quad of a level covers pixelError pixels, doubled each level
+		float cellWorld = std::max(scale.x * 2.0f / float(width - 1), scale.z * 2.0f / float(height - 1));
+		float pixelsPerUnit = viewportHeight / (2.0f * std::tan(glm::radians(fovy) * 0.5f));
+		ranges.resize(levels);
+		morphRanges.resize(levels);
+		float prev = 0.0f;
+		for (int i = 0; i < levels; i++)
+		{
+			float quad = cellWorld * float(1 << i);
+			float range = quad * 2.0f * pixelsPerUnit / pixelError;
+			// a node has to fit in its own band or it can't finish morphing before the next level takes over
+			range = std::max(range, prev + 1.5f * quad * PATCH_SIZE);
+			morphRanges[i] = glm::vec2(prev + (range - prev) * morphStartRatio, range);
+			ranges[i] = range;
+			prev = range;
+		}
+		// the coarsest level covers everything and has nothing to morph into
+		ranges[levels - 1] = std::numeric_limits<float>::max();
+		morphRanges[levels - 1] = glm::vec2(0.0f, 0.0f);
+
+		selection.clear();
+		nodesTested = 0;
+		trianglesDrawn = 0;
+		if (!nodes.empty())
+			select_node(0, levels - 1);
+		nodesSelected = selection.size();
+	}
+
+	// render the selected nodes
+	void Draw(Shader shader, unsigned int textureID)
+	{
+		// Set the shader properties
+		shader.use();
+		shader.setVec3("material.specular", 0.3f, 0.3f, 0.3f);
+		shader.setFloat("material.shininess", 64.0f);
+		// every sampler gets its own unit, samplers of different types may not share one
+		shader.setInt("heightmap", 1);
+		shader.setInt("tileHeights", 2);
+		shader.setInt("tileTable", 3);
+		shader.setInt("normalMap", 4);
+		shader.setBool("streamed", tiles != NULL);
+		shader.setFloat("tileSize", tiles ? float(tiles->header.tileSize) : 0.0f);
+		shader.setVec2("gridSize", float(width), float(height));
+		shader.setVec3("terrainOffset", offset);
+		shader.setVec3("terrainScale", scale);
+		shader.setVec3("cameraPos", camera);
+
+		// diffuse on unit 0 like the heightmap, heights (or the streaming overview) on unit 1, resident tiles on 2 and 3,
+		// precomputed normals of an in-memory heightmap on 4
+		glActiveTexture(GL_TEXTURE0);
+		bind_texture(GL_TEXTURE_2D, textureID);
+		glActiveTexture(GL_TEXTURE1);
+		glBindTexture(GL_TEXTURE_2D, tiles ? tiles->overviewTexture : heightTexture);
+		glActiveTexture(GL_TEXTURE2);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, tiles ? tiles->tileArray : 0);
+		glActiveTexture(GL_TEXTURE3);
+		glBindTexture(GL_TEXTURE_2D, tiles ? tiles->tileTable : 0);
+		glActiveTexture(GL_TEXTURE4);
+		glBindTexture(GL_TEXTURE_2D, normalTexture);
+
+		glBindVertexArray(VAO);
+		const int quadrantIndices = (PATCH_SIZE / 2) * (PATCH_SIZE / 2) * 6;
+		for (unsigned int i = 0; i < selection.size(); i++)
+		{
+			const TerrainNode &node = nodes[selection[i].node];
+			int level = selection[i].level;
+			shader.setVec2("nodeOrigin", float(node.x), float(node.y));
+			shader.setFloat("nodeScale", float(node.size) / float(PATCH_SIZE));
+			shader.setVec2("morphRange", morphRanges[level]);
+
+			// draw runs of neighbouring quadrants with one call (quadrants are stored back to back in the EBO)
+			int q = 0;
+			while (q < 4)
+			{
+				if (!(selection[i].quadrants & (1 << q)))
+				{
+					q++;
+					continue;
+				}
+				int first = q;
+				while (q < 4 && (selection[i].quadrants & (1 << q)))
+					q++;
+				glDrawElements(GL_TRIANGLES, (q - first) * quadrantIndices, GL_UNSIGNED_SHORT,
+					(void*)(first * quadrantIndices * sizeof(unsigned short)));
+			}
+		}
+		glBindVertexArray(0);
+
+		// always good practice to set everything back to defaults once configured.
+		glActiveTexture(GL_TEXTURE0);
+	}
+
+	void delete_buffers()
+	{
+		glDeleteVertexArrays(1, &VAO);
+		glDeleteBuffers(1, &VBO);
+		glDeleteBuffers(1, &EBO);
+		glDeleteTextures(1, &heightTexture);
+		glDeleteTextures(1, &normalTexture);
+		if (tiles)
+			tiles->delete_textures();
+	}
+
+private:
+	/*  Render data  */
+	unsigned int VAO, VBO, EBO;
+	unsigned int heightTexture, normalTexture;
+
+	int width, height;
+	glm::vec3 offset, scale;
+
+	// streamed height source (NULL for an in-memory heightmap)
+	TerrainTiles *tiles;
+	// in-memory height source, only while building the quadtree
+	const Heightmap *source;
+
+	// per-frame selection state
+	glm::vec3 camera;
+	Frustum frustum;
+	std::vector<float> ranges;
+	std::vector<glm::vec2> morphRanges;
+
+	glm::vec3 grid_to_world(int x, int y, float h) const
+	{
+		return offset + scale * glm::vec3(2.0f * float(x) / float(width - 1) - 1.0f, h, 2.0f * float(y) / float(height - 1) - 1.0f);
+	}
+
+	// does a sphere of the given radius around the camera touch the node's box
+	bool in_range(const TerrainNode &node, float range) const
+	{
+		glm::vec3 closest = glm::clamp(camera, node.boxMin, node.boxMax);
+		glm::vec3 d = closest - camera;
+		return glm::dot(d, d) <= range * range;
+	}
+
+	// returns false if the node is beyond this level's range so the parent has to cover it
+	bool select_node(int index, int level)
+	{
+		const TerrainNode &node = nodes[index];
+		nodesTested++;
+		if (!in_range(node, ranges[level]))
+			return false;
+		// outside the view: handled, nothing to draw
+		if (!frustum.intersects_aabb(node.boxMin, node.boxMax))
+			return true;
+
+		if (level == 0 || !in_range(node, ranges[level - 1]))
+		{
+			add_selection(index, level, 0xF);
+			return true;
+		}
+
+		// children that are too far for the finer level get drawn by this node's quadrants
+		int quadrants = 0;
+		for (int i = 0; i < 4; i++)
+		{
+			if (node.children[i] >= 0 && !select_node(node.children[i], level - 1))
+				quadrants |= 1 << i;
+		}
+		if (quadrants)
+			add_selection(index, level, quadrants);
+		return true;
+	}
+
+	void add_selection(int index, int level, int quadrants)
+	{
+		// skip the quadrants that fall off the edge of the heightmap
+		for (int q = 0; q < 4; q++)
+			if (level > 0 && nodes[index].children[q] < 0)
+				quadrants &= ~(1 << q);
+
+		TerrainSelection s;
+		s.node = index;
+		s.level = level;
+		s.quadrants = quadrants;
+		selection.push_back(s);
+		for (int q = 0; q < 4; q++)
+			if (quadrants & (1 << q))
+				trianglesDrawn += (PATCH_SIZE / 2) * (PATCH_SIZE / 2) * 2;
+	}
+
+	void create_quadtree()
+	{
+		levels = 1;
+		int cells = std::max(width, height) - 1;
+		while (PATCH_SIZE * (1 << (levels - 1)) < cells)
+			levels++;
+
+		if (cells <= 0)
+			return;
+		build_node(0, 0, PATCH_SIZE * (1 << (levels - 1)), levels - 1);
+		std::cout << "Terrain quadtree: " << levels << " levels, " << nodes.size() << " nodes" << std::endl;
+	}
+
+	// build a node and its children, returns its index (or -1 if it lies outside the heightmap)
+	int build_node(int x, int y, int size, int level)
+	{
+		if (x >= width - 1 || y >= height - 1)
+			return -1;
+
+		int index = nodes.size();
+		TerrainNode node;
+		node.x = x;
+		node.y = y;
+		node.size = size;
+		node.level = level;
+		for (int i = 0; i < 4; i++)
+			node.children[i] = -1;
+		nodes.push_back(node);
+
+		float hMin = 1.0f, hMax = 0.0f;
+		if (level == 0 && tiles)
+		{
+			// leaves never straddle tiles, so the tile's range bounds them
+			tiles->tile_bounds(x / tiles->header.tileSize, y / tiles->header.tileSize, hMin, hMax);
+		}
+		else if (level == 0)
+		{
+			// leaves scan their samples (including the shared far edge)
+			for (int i = x; i <= std::min(x + size, width - 1); i++)
+			{
+				for (int j = y; j <= std::min(y + size, height - 1); j++)
+				{
+					float h = source->get_height(i, j);
+					hMin = std::min(hMin, h);
+					hMax = std::max(hMax, h);
+				}
+			}
+		}
+		else
+		{
+			// inner nodes take the union of their children
+			int half = size / 2;
+			int children[4];
+			children[0] = build_node(x, y, half, level - 1);
+			children[1] = build_node(x + half, y, half, level - 1);
+			children[2] = build_node(x, y + half, half, level - 1);
+			children[3] = build_node(x + half, y + half, half, level - 1);
+			for (int i = 0; i < 4; i++)
+			{
+				nodes[index].children[i] = children[i];
+				if (children[i] < 0)
+					continue;
+				hMin = std::min(hMin, (nodes[children[i]].boxMin.y - offset.y) / scale.y);
+				hMax = std::max(hMax, (nodes[children[i]].boxMax.y - offset.y) / scale.y);
+			}
+		}
+
+		// the bounds are clamped to the heightmap, the patch vertices past its edge are clamped in the shader too
+		nodes[index].boxMin = grid_to_world(x, y, hMin);
+		nodes[index].boxMax = grid_to_world(std::min(x + size, width - 1), std::min(y + size, height - 1), hMax);
+		return index;
+	}
+
+	void create_height_texture(const Heightmap &heightmap)
+	{
+		glGenTextures(1, &heightTexture);
+		glBindTexture(GL_TEXTURE_2D, heightTexture);
+		// heights are x-major (see Heightmap::make_vertex) so grid x runs down the texture rows
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_R16, height, width, 0, GL_RED, GL_UNSIGNED_SHORT, heightmap.heights.empty() ? NULL : &heightmap.heights[0]);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		// linear filtering gives the in-between heights while a vertex morphs
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glBindTexture(GL_TEXTURE_2D, 0);
+	}
+
+	// world space normals of the whole grid (RG16_SNORM x and z, laid out like the heights), so the vertex shader
+	//   reads one texel instead of four heights
+	void create_normal_texture(const Heightmap &heightmap)
+	{
+		std::vector<short> normals(2 * heightmap.heights.size());
+		if (!normals.empty())
+			height_normals_rg16(&heightmap.heights[0], width, height, height_normal_slope(width, height, scale), &normals[0]);
+
+		glGenTextures(1, &normalTexture);
+		glBindTexture(GL_TEXTURE_2D, normalTexture);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16_SNORM, height, width, 0, GL_RG, GL_SHORT, normals.empty() ? NULL : &normals[0]);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glBindTexture(GL_TEXTURE_2D, 0);
+	}
+
+	// one (PATCH_SIZE+1)^2 grid shared by every node, indexed quadrant by quadrant so partial nodes are one range each
+	void setup_patch()
+	{
+		std::vector<glm::vec2> patch;
+		for (int x = 0; x <= PATCH_SIZE; x++)
+			for (int y = 0; y <= PATCH_SIZE; y++)
+				patch.push_back(glm::vec2(float(x), float(y)));
+
+		// each quadrant is walked in vertex cache sized strips (see vertex_cache.hpp), same triangle pair and winding
+		// as Heightmap::create_indices
+		std::vector<unsigned short> patchIndices;
+		const int half = PATCH_SIZE / 2;
+		for (int q = 0; q < 4; q++)
+		{
+			int qx = (q & 1) ? half : 0;
+			int qy = (q & 2) ? half : 0;
+			grid_cache_indices(half, half, PATCH_SIZE + 1, qx*(PATCH_SIZE + 1) + qy, patchIndices);
+		}
+
+		glGenVertexArrays(1, &VAO);
+		glGenBuffers(1, &VBO);
+		glGenBuffers(1, &EBO);
+
+		glBindVertexArray(VAO);
+		glBindBuffer(GL_ARRAY_BUFFER, VBO);
+		glBufferData(GL_ARRAY_BUFFER, patch.size() * sizeof(glm::vec2), &patch[0], GL_STATIC_DRAW);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, patchIndices.size() * sizeof(unsigned short), &patchIndices[0], GL_STATIC_DRAW);
+
+		// patch grid coordinates
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(glm::vec2), (void*)0);
+
+		glBindVertexArray(0);
+	}
+};
+#endif
@@ -0,0 +1,439 @@
+#ifndef TERRAIN_TILES_H
+#define TERRAIN_TILES_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <list>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+
+#include <mapped_file.hpp>
+
+// Reference: https://github.com/nothings/stb/blob/master/stb_image.h#L4
+// To use stb_image, add this in *one* C++ source file.
+#include <stb_image.h>
+
+// Tiled 16 bit terrain that is streamed from a memory mapped file around the camera.
+//
+// File layout (.tiles, little endian):
+//   TerrainTilesHeader
+//   tile bounds:  tilesX * tilesY (min, max) height pairs, so the quadtree can be built without touching the tiles
+//   overview:     overviewSize^2 heights of the whole terrain, drawn where a tile isn't resident yet
+//   tiles:        tilesX * tilesY blocks of (tileSize+1)^2 heights.  Neighbouring tiles repeat their shared edge so each
+//                 one can be filtered on its own.
+// Heights are x-major like Heightmap::heights: x runs over the source image rows, y over its columns.
+
+const unsigned int TERRAIN_TILES_VERSION = 1;
+
+struct TerrainTilesHeader {
+	char magic[4];
+	unsigned int version;
+	// grid points along x and y
+	unsigned int sizeX, sizeY;
+	// grid cells along each side of a tile
+	unsigned int tileSize;
+	unsigned int tilesX, tilesY;
+	unsigned int overviewSize;
+	// byte offsets of the sections
+	unsigned long long boundsOffset;
+	unsigned long long overviewOffset;
+	unsigned long long tilesOffset;
+};
+
+// Converter: cut a greyscale image (16 bit PNG, or 8 bit widened to 16) into a .tiles file.
+//   tileSize has to be a multiple of Terrain::PATCH_SIZE so a quadtree leaf never straddles two tiles.
+bool convert_terrain_tiles(const char *sourcePath, const char *tilesPath, int tileSize = 256, int overviewSize = 1024)
+{
+	if (tileSize <= 0)
+	{
+		std::cout << "Terrain tile size has to be positive: " << tileSize << std::endl;
+		return false;
+	}
+	int imageWidth, imageHeight, nrChannels;
+	unsigned short *data = stbi_load_16(sourcePath, &imageWidth, &imageHeight, &nrChannels, 1);
+	if (!data)
+	{
+		std::cout << "Failed to load terrain source: " << sourcePath << std::endl;
+		return false;
+	}
+	// a terrain needs at least one quad
+	if (imageWidth < 2 || imageHeight < 2)
+	{
+		std::cout << "Terrain source is smaller than 2x2: " << sourcePath << std::endl;
+		stbi_image_free(data);
+		return false;
+	}
+
+	TerrainTilesHeader header;
+	std::memcpy(header.magic, "RCTT", 4);
+	header.version = TERRAIN_TILES_VERSION;
+	header.sizeX = imageHeight;
+	header.sizeY = imageWidth;
+	header.tileSize = tileSize;
+	header.tilesX = (header.sizeX - 1 + tileSize - 1) / tileSize;
+	header.tilesY = (header.sizeY - 1 + tileSize - 1) / tileSize;
+	// at least 2x2, the overview samples the corners of the terrain
+	header.overviewSize = std::max(2, std::min(overviewSize, (int)std::max(header.sizeX, header.sizeY)));
+	header.boundsOffset = sizeof(TerrainTilesHeader);
+	header.overviewOffset = header.boundsOffset + header.tilesX * header.tilesY * 2 * sizeof(unsigned short);
+	header.tilesOffset = header.overviewOffset + header.overviewSize * header.overviewSize * sizeof(unsigned short);
+
+	// clamp to the edge for the last row/column of tiles
+	auto sample = [&](unsigned int x, unsigned int y) {
+		return data[std::min(x, header.sizeX - 1) * imageWidth + std::min(y, header.sizeY - 1)];
+	};
+
+	std::vector<unsigned short> bounds;
+	for (unsigned int tx = 0; tx < header.tilesX; tx++)
+	{
+		for (unsigned int ty = 0; ty < header.tilesY; ty++)
+		{
+			unsigned short hMin = 65535, hMax = 0;
+			for (int i = 0; i <= tileSize; i++)
+			{
+				for (int j = 0; j <= tileSize; j++)
+				{
+					unsigned short h = sample(tx * tileSize + i, ty * tileSize + j);
+					hMin = std::min(hMin, h);
+					hMax = std::max(hMax, h);
+				}
+			}
+			bounds.push_back(hMin);
+			bounds.push_back(hMax);
+		}
+	}
+
+	std::vector<unsigned short> overview;
+	for (unsigned int i = 0; i < header.overviewSize; i++)
+		for (unsigned int j = 0; j < header.overviewSize; j++)
+			overview.push_back(sample(i * (header.sizeX - 1) / (header.overviewSize - 1), j * (header.sizeY - 1) / (header.overviewSize - 1)));
+
+	std::ofstream file(tilesPath, std::ios::binary);
+	if (!file)
+	{
+		std::cout << "Failed to write terrain tiles: " << tilesPath << std::endl;
+		stbi_image_free(data);
+		return false;
+	}
+	file.write((const char*)&header, sizeof(header));
+	file.write((const char*)&bounds[0], bounds.size() * sizeof(unsigned short));
+	file.write((const char*)&overview[0], overview.size() * sizeof(unsigned short));
+
+	std::vector<unsigned short> tile((tileSize + 1) * (tileSize + 1));
+	for (unsigned int tx = 0; tx < header.tilesX; tx++)
+	{
+		for (unsigned int ty = 0; ty < header.tilesY; ty++)
+		{
+			for (int i = 0; i <= tileSize; i++)
+				for (int j = 0; j <= tileSize; j++)
+					tile[i * (tileSize + 1) + j] = sample(tx * tileSize + i, ty * tileSize + j);
+			file.write((const char*)&tile[0], tile.size() * sizeof(unsigned short));
+		}
+	}
+
+	stbi_image_free(data);
+	std::cout << "Wrote " << header.tilesX << "x" << header.tilesY << " tiles of " << tileSize << " to " << tilesPath << std::endl;
+	return true;
+}
+
+class TerrainTiles
+{
+public:
+	TerrainTilesHeader header;
+
+	// placement of the [-1,1]x[0,1]x[-1,1] terrain in the world (same as Heightmap)
+	glm::vec3 offset = glm::vec3(7.0f, -15.0f, 0.0f);
+	glm::vec3 scale = glm::vec3(30.0f, 15.0f, 30.0f);
+
+	// streaming settings
+	// tiles resident on the GPU (layers of the tile array), least recently wanted ones get evicted
+	const int cacheTiles;
+	// tiles closer than this (world units) to the camera are wanted
+	float streamRadius = 25.0f;
+	// tiles read out of the mapped file per frame
+	int decodeBudget = 4;
+	// bytes uploaded to the GPU per frame
+	size_t uploadBudget = 1024 * 1024;
+
+	// counters for the last update()
+	unsigned int tilesWanted = 0, tilesResident = 0, tilesDecoded = 0, tilesUploaded = 0, tilesEvicted = 0;
+
+	// textures: overview (R16), resident tiles (R16 array) and tile -> layer+1 table (R16UI, 0 = not resident)
+	unsigned int overviewTexture, tileArray, tileTable;
+
+	// constructor, maps the file and creates the (empty) GPU cache of cacheTiles tiles
+	TerrainTiles(const char *tilesPath, int cacheTiles = 64) : cacheTiles(cacheTiles), overviewTexture(0), tileArray(0), tileTable(0), frame(0)
+	{
+		std::memset(&header, 0, sizeof(header));
+		if (!file.open(tilesPath))
+			return;
+		std::memcpy(&header, file.data, std::min(sizeof(header), file.size));
+		if (std::memcmp(header.magic, "RCTT", 4) != 0 || header.version != TERRAIN_TILES_VERSION ||
+			file.size < header.tilesOffset + (unsigned long long)header.tilesX * header.tilesY * tile_bytes())
+		{
+			std::cout << "Not a terrain tile file (or wrong version): " << tilesPath << std::endl;
+			file.close();
+			std::memset(&header, 0, sizeof(header));
+			return;
+		}
+
+		int tiles = header.tilesX * header.tilesY;
+		layer.assign(tiles, -1);
+		state.assign(tiles, TILE_NONE);
+		wantedFrame.assign(tiles, 0);
+		lruPosition.resize(tiles);
+		table.assign(tiles, 0);
+		for (int i = cacheTiles - 1; i >= 0; i--)
+			freeLayers.push_back(i);
+
+		setup_textures();
+	}
+
+	bool is_open() const { return file.is_open(); }
+
+	// normalized height range of a tile
+	void tile_bounds(int tx, int ty, float &hMin, float &hMax) const
+	{
+		const unsigned short *bounds = (const unsigned short*)(file.data + header.boundsOffset);
+		hMin = float(bounds[(tx * header.tilesY + ty) * 2]) / 65535.0f;
+		hMax = float(bounds[(tx * header.tilesY + ty) * 2 + 1]) / 65535.0f;
+	}
+
+	// queue the tiles around the camera, then read and upload as many as the per-frame budgets allow
+	void update(const glm::vec3 &cameraPos)
+	{
+		if (!is_open())
+			return;
+		frame++;
+		tilesDecoded = tilesUploaded = tilesEvicted = 0;
+
+		// camera in grid cells
+		glm::vec3 local = (cameraPos - offset) / scale;
+		glm::vec2 cell(scale.x * 2.0f / float(header.sizeX - 1), scale.z * 2.0f / float(header.sizeY - 1));
+		glm::vec2 cameraGrid((local.x + 1.0f) * 0.5f * float(header.sizeX - 1), (local.z + 1.0f) * 0.5f * float(header.sizeY - 1));
+		glm::vec2 radius = glm::vec2(streamRadius) / cell;
+
+		// wanted tiles, nearest first
+		wanted.clear();
+		int txMin = std::max(0, (int)std::floor((cameraGrid.x - radius.x) / header.tileSize));
+		int txMax = std::min((int)header.tilesX - 1, (int)std::floor((cameraGrid.x + radius.x) / header.tileSize));
+		int tyMin = std::max(0, (int)std::floor((cameraGrid.y - radius.y) / header.tileSize));
+		int tyMax = std::min((int)header.tilesY - 1, (int)std::floor((cameraGrid.y + radius.y) / header.tileSize));
+		for (int tx = txMin; tx <= txMax; tx++)
+		{
+			for (int ty = tyMin; ty <= tyMax; ty++)
+			{
+				glm::vec2 tileMin(float(tx * header.tileSize), float(ty * header.tileSize));
+				glm::vec2 closest = glm::clamp(cameraGrid, tileMin, tileMin + float(header.tileSize));
+				float distance = glm::length((closest - cameraGrid) * cell);
+				if (distance <= streamRadius)
+					wanted.push_back(std::make_pair(distance, tx * (int)header.tilesY + ty));
+			}
+		}
+		std::sort(wanted.begin(), wanted.end());
+		if ((int)wanted.size() > cacheTiles)
+			wanted.resize(cacheTiles);
+		tilesWanted = wanted.size();
+
+		for (unsigned int i = 0; i < wanted.size(); i++)
+		{
+			int tile = wanted[i].second;
+			wantedFrame[tile] = frame;
+			if (state[tile] == TILE_RESIDENT)
+				lru.splice(lru.begin(), lru, lruPosition[tile]);
+			else if (state[tile] == TILE_NONE)
+				state[tile] = TILE_QUEUED;
+		}
+		// nearest first, and forget queued tiles the camera has moved away from
+		std::vector<int> queue;
+		for (unsigned int i = 0; i < wanted.size(); i++)
+			if (state[wanted[i].second] == TILE_QUEUED)
+				queue.push_back(wanted[i].second);
+		for (unsigned int i = 0; i < decodeQueue.size(); i++)
+			if (wantedFrame[decodeQueue[i]] != frame)
+				state[decodeQueue[i]] = TILE_NONE;
+		decodeQueue.assign(queue.begin(), queue.end());
+
+		decode_tiles();
+		upload_tiles();
+		tilesResident = lru.size();
+	}
+
+	void delete_textures()
+	{
+		glDeleteTextures(1, &overviewTexture);
+		glDeleteTextures(1, &tileArray);
+		glDeleteTextures(1, &tileTable);
+	}
+
+private:
+	enum TileState { TILE_NONE, TILE_QUEUED, TILE_DECODED, TILE_RESIDENT };
+
+	struct StagedTile {
+		int tile;
+		std::vector<unsigned short> samples;
+	};
+
+	MappedFile file;
+	unsigned int frame;
+
+	// per tile state
+	std::vector<int> layer;
+	std::vector<unsigned char> state;
+	std::vector<unsigned int> wantedFrame;
+	std::vector<std::list<int>::iterator> lruPosition;
+	// CPU copy of the tile table texture
+	std::vector<unsigned short> table;
+
+	// resident tiles, most recently wanted first
+	std::list<int> lru;
+	std::vector<int> freeLayers;
+	std::vector<std::pair<float, int> > wanted;
+	std::deque<int> decodeQueue;
+	std::deque<StagedTile> staged;
+	// staging buffers are recycled so streaming doesn't allocate every frame
+	std::vector<std::vector<unsigned short> > spareBuffers;
+
+	size_t tile_bytes() const
+	{
+		return (header.tileSize + 1) * (header.tileSize + 1) * sizeof(unsigned short);
+	}
+
+	// CPU side: copy tiles out of the mapping (this is where the pages are actually read from disk)
+	void decode_tiles()
+	{
+		while (!decodeQueue.empty() && (int)tilesDecoded < decodeBudget)
+		{
+			int tile = decodeQueue.front();
+			decodeQueue.pop_front();
+
+			staged.push_back(StagedTile());
+			StagedTile &s = staged.back();
+			s.tile = tile;
+			if (!spareBuffers.empty())
+			{
+				s.samples.swap(spareBuffers.back());
+				spareBuffers.pop_back();
+			}
+			s.samples.resize(tile_bytes() / sizeof(unsigned short));
+			std::memcpy(&s.samples[0], file.data + header.tilesOffset + (unsigned long long)tile * tile_bytes(), tile_bytes());
+
+			state[tile] = TILE_DECODED;
+			tilesDecoded++;
+		}
+	}
+
+	// GPU side: copy staged tiles into free (or least recently wanted) layers, within the byte budget
+	void upload_tiles()
+	{
+		size_t bytes = 0;
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+		while (!staged.empty())
+		{
+			// always let one tile through so a budget smaller than a tile can't stall streaming
+			if (bytes > 0 && bytes + tile_bytes() > uploadBudget)
+				break;
+
+			StagedTile &s = staged.front();
+			if (wantedFrame[s.tile] != frame)
+			{
+				// the camera moved on before it was uploaded
+				state[s.tile] = TILE_NONE;
+			}
+			else
+			{
+				int target = acquire_layer();
+				if (target < 0)
+					break;
+
+				glBindTexture(GL_TEXTURE_2D_ARRAY, tileArray);
+				glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, target, header.tileSize + 1, header.tileSize + 1, 1, GL_RED, GL_UNSIGNED_SHORT, &s.samples[0]);
+				set_table(s.tile, target + 1);
+
+				layer[s.tile] = target;
+				state[s.tile] = TILE_RESIDENT;
+				lru.push_front(s.tile);
+				lruPosition[s.tile] = lru.begin();
+				bytes += tile_bytes();
+				tilesUploaded++;
+			}
+
+			spareBuffers.push_back(std::vector<unsigned short>());
+			spareBuffers.back().swap(s.samples);
+			staged.pop_front();
+		}
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	}
+
+	// a free layer, or the one of the least recently wanted tile that isn't wanted this frame
+	int acquire_layer()
+	{
+		if (!freeLayers.empty())
+		{
+			int l = freeLayers.back();
+			freeLayers.pop_back();
+			return l;
+		}
+		if (lru.empty() || wantedFrame[lru.back()] == frame)
+			return -1;
+
+		int evicted = lru.back();
+		lru.pop_back();
+		int l = layer[evicted];
+		layer[evicted] = -1;
+		state[evicted] = TILE_NONE;
+		set_table(evicted, 0);
+		tilesEvicted++;
+		return l;
+	}
+
+	void set_table(int tile, unsigned short value)
+	{
+		table[tile] = value;
+		glBindTexture(GL_TEXTURE_2D, tileTable);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, tile % header.tilesY, tile / header.tilesY, 1, 1, GL_RED_INTEGER, GL_UNSIGNED_SHORT, &table[tile]);
+		glBindTexture(GL_TEXTURE_2D, 0);
+	}
+
+	void setup_textures()
+	{
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+
+		// overview, filtered like the in-memory height texture.  x-major data, so grid x runs down the rows
+		glGenTextures(1, &overviewTexture);
+		glBindTexture(GL_TEXTURE_2D, overviewTexture);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_R16, header.overviewSize, header.overviewSize, 0, GL_RED, GL_UNSIGNED_SHORT, file.data + header.overviewOffset);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+		// tile cache
+		glGenTextures(1, &tileArray);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, tileArray);
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_R16, header.tileSize + 1, header.tileSize + 1, cacheTiles, 0, GL_RED, GL_UNSIGNED_SHORT, NULL);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+		// tile table, integer texture so only nearest filtering
+		glGenTextures(1, &tileTable);
+		glBindTexture(GL_TEXTURE_2D, tileTable);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_R16UI, header.tilesY, header.tilesX, 0, GL_RED_INTEGER, GL_UNSIGNED_SHORT, &table[0]);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glBindTexture(GL_TEXTURE_2D, 0);
+
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	}
+};
+#endif
@@ -0,0 +1,466 @@
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include <glad/glad.h>
+#include <stb_image.h>
+
+#include <gl_handles.hpp>
+#include <texture_paths.hpp>
+#include <image_decoder.hpp>
+#include <texture_container.hpp>
+#include <texture_streamer.hpp>
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <sstream>
+#include <iostream>
+#include <chrono>
+#include <future>
+#include <unordered_map>
+
+// Process wide cache of image textures.  A texture is keyed by its canonical path and how it is sampled, decoded and
+// uploaded on the first acquire and shared (the same GL name) by every later one.  It is deleted when the last user
+// releases it.  Decoded pixels are shared the same way for users that read the image itself (the heightmap): they live
+// while someone holds them, and a texture acquired meanwhile is uploaded from them instead of decoding the file again.
+//   Files are decoded on the image decoder's threads (image_decoder.hpp): prefetch() queues files before they are
+// needed, and the faces of a cube map are decoded together.  Only the upload waits on the GL thread.  Images converted
+// to a texture container (texture_container.hpp) aren't decoded at all, their prepared levels are uploaded as they are.
+// With a streamer set, decoded images go to the GPU through it over the next frames (texture_streamer.hpp) instead of
+// in one glTexImage2D: the texture name is handed out at once and fills in when ready.  Until it has, bind_texture (and
+// bindable) put a 1x1 stand-in in its place.
+//   Textures are created and deleted on the GL thread; needs_decode() and prefetch() may be called from any thread.
+
+// how a 2D texture is sampled, part of the cache key
+struct TextureSampling
+{
+	GLint wrap;
+	bool mipmaps;
+
+	TextureSampling(GLint wrap = GL_REPEAT, bool mipmaps = true) : wrap(wrap), mipmaps(mipmaps)
+	{
+	}
+};
+
+class TextureCache
+{
+public:
+	// counters since startup
+	unsigned int requests, decodes, uploads;
+	unsigned int containers;	// uploads from texture containers
+	unsigned int standInBinds;	// binds of textures still streaming, which got a stand-in
+	double waitMilliseconds;	// time spent waiting for decodes to finish
+	double loadMilliseconds;	// time spent creating textures, waiting included
+
+	TextureCache() : requests(0), decodes(0), uploads(0), containers(0), standInBinds(0), waitMilliseconds(0.0), loadMilliseconds(0.0), streamer(NULL)
+	{
+	}
+
+	// stream decoded images through streamer from now on (NULL uploads them at once again)
+	void set_streamer(TextureStreamer *textureStreamer)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		streamer = textureStreamer;
+	}
+
+	// start decoding a file that is about to be acquired (as a texture or as pixels), unless it is already coming
+	void prefetch(const std::string &path)
+	{
+		std::string canonical = canonical_texture_path(path);
+		std::lock_guard<std::mutex> lock(mutex);
+		TextureContainer container;
+		if (pending.count(canonical) || pixels.count(canonical) || container.open(canonical))
+			return;
+		pending[canonical] = image_decoder().decode(canonical);
+	}
+
+	void prefetch(const std::vector<std::string> &paths)
+	{
+		for (unsigned int i = 0; i < paths.size(); i++)
+			prefetch(paths[i]);
+	}
+
+	// GL name of the texture for an image file, shared with everyone who asked for the same file and sampling
+	unsigned int acquire(const std::string &path, const TextureSampling &sampling = TextureSampling())
+	{
+		DecodedImage image = { 0, 0, 0, NULL };
+		return acquire_decoded(path, sampling, image, false);
+	}
+
+	// as acquire, with pixels decoded elsewhere (off the GL thread).  The cache takes them over and frees them, they are
+	// wasted if the texture became resident in the meantime (two models importing the same file at once).
+	//   decoded = false decodes here if the texture isn't resident (image is ignored then).
+	unsigned int acquire_decoded(const std::string &path, const TextureSampling &sampling, DecodedImage &image, bool decoded = true)
+	{
+		std::string canonical = canonical_texture_path(path);
+		std::string key = texture_key(canonical, sampling);
+		std::lock_guard<std::mutex> lock(mutex);
+		requests++;
+		if (decoded)
+			decodes++;
+		std::unordered_map<std::string, unsigned int>::iterator found = names.find(key);
+		if (found != names.end())
+		{
+			entries[found->second].refs++;
+			if (decoded)
+				stbi_image_free(image.pixels);
+			return found->second;
+		}
+
+		// the converted container, pixels someone holds, the caller's, or a fresh decode
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		std::unordered_map<std::string, PixelEntry>::iterator held = pixels.find(canonical);
+		TextureContainer container;
+		unsigned int name;
+		if (!decoded && held == pixels.end() && open_container(canonical, container))
+		{
+			name = upload_container(container, sampling);
+		}
+		else
+		{
+			// only pixels nobody else holds can be handed to the streamer
+			DecodedImage source = image;
+			bool owned = held == pixels.end();
+			if (!owned)
+				source = held->second.image;
+			else if (!decoded)
+				source = decode(canonical);
+			if (!source.pixels)
+				std::cout << "Texture failed to load at path: " << path << std::endl;
+
+			name = upload_2d(source, sampling, owned);
+			if (owned)
+				stbi_image_free(source.pixels);
+			else if (decoded)
+				stbi_image_free(image.pixels);
+		}
+		loadMilliseconds += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+		Entry &entry = entries[name];
+		entry.key = key;
+		entry.refs = 1;
+		entry.texture.reset(name);
+		names[key] = name;
+		return name;
+	}
+
+	// cube map from six faces (+X, -X, +Y, -Y, +Z, -Z), shared like the 2D textures
+	unsigned int acquire_cubemap(const std::vector<std::string> &faces)
+	{
+		std::string key = "cube";
+		for (unsigned int i = 0; i < faces.size(); i++)
+			key += "|" + canonical_texture_path(faces[i]);
+		std::lock_guard<std::mutex> lock(mutex);
+		requests++;
+		std::unordered_map<std::string, unsigned int>::iterator found = names.find(key);
+		if (found != names.end())
+		{
+			entries[found->second].refs++;
+			return found->second;
+		}
+
+		// all six faces decode at once (unless converted), each is uploaded as soon as it is ready
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		std::vector<TextureContainer> faceContainers(faces.size());
+		std::vector<std::future<DecodedImage> > images(faces.size());
+		for (unsigned int i = 0; i < faces.size(); i++)
+		{
+			if (!open_container(canonical_texture_path(faces[i]), faceContainers[i]))
+				images[i] = take_decode(canonical_texture_path(faces[i]));
+		}
+
+		unsigned int textureID;
+		glGenTextures(1, &textureID);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
+		for (unsigned int i = 0; i < faces.size(); i++)
+		{
+			// the sky isn't mipmapped, only the top level of a container is used
+			if (faceContainers[i].header)
+			{
+				faceContainers[i].upload(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 1);
+				containers++;
+				continue;
+			}
+			DecodedImage image = wait(images[i]);
+			if (image.pixels && streamer)
+			{
+				streamer->stream(textureID, GL_TEXTURE_CUBE_MAP, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, GL_RGB, pixel_format(image), image, false);
+				continue;
+			}
+			if (image.pixels)
+			{
+				GLint alignment;
+				glGetIntegerv(GL_UNPACK_ALIGNMENT, &alignment);
+				glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+				glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB, image.width, image.height, 0, pixel_format(image), GL_UNSIGNED_BYTE, image.pixels);
+				glPixelStorei(GL_UNPACK_ALIGNMENT, alignment);
+			}
+			else
+				std::cout << "Cubemap texture failed to load at path: " << faces[i] << std::endl;
+			stbi_image_free(image.pixels);
+		}
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+		uploads++;
+		loadMilliseconds += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+		Entry &entry = entries[textureID];
+		entry.key = key;
+		entry.refs = 1;
+		entry.texture.reset(textureID);
+		names[key] = textureID;
+		return textureID;
+	}
+
+	// the texture to bind for name: name itself, or while the streamer is still filling it in a 1x1 stand-in for target
+	// (GL_TEXTURE_2D or GL_TEXTURE_CUBE_MAP), mid grey or for a normal map a flat normal.  GL thread only.
+	unsigned int bindable(unsigned int name, GLenum target = GL_TEXTURE_2D, bool normalMap = false)
+	{
+		if (!streamer || name == 0 || streamer->ready(name))
+			return name;
+		standInBinds++;
+		int which = target == GL_TEXTURE_CUBE_MAP ? 2 : normalMap ? 1 : 0;
+		if (!standIns[which].get())
+		{
+			const unsigned char grey[4] = { 128, 128, 128, 255 };
+			const unsigned char flatNormal[4] = { 128, 128, 255, 255 };
+			standIns[which] = TextureHandle::create();
+			glBindTexture(target, standIns[which].get());
+			for (int face = 0; face < (target == GL_TEXTURE_CUBE_MAP ? 6 : 1); face++)
+			{
+				glTexImage2D(target == GL_TEXTURE_CUBE_MAP ? GL_TEXTURE_CUBE_MAP_POSITIVE_X + face : target, 0, GL_RGBA, 1, 1, 0,
+					GL_RGBA, GL_UNSIGNED_BYTE, normalMap ? flatNormal : grey);
+			}
+			glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+			glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		}
+		return standIns[which].get();
+	}
+
+	// give back one acquire, the texture is deleted with the last one
+	void release(unsigned int name)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		std::unordered_map<unsigned int, Entry>::iterator found = entries.find(name);
+		if (found == entries.end() || --found->second.refs > 0)
+			return;
+		if (streamer)
+			streamer->cancel(name);
+		names.erase(found->second.key);
+		entries.erase(found);
+	}
+
+	// would acquiring this texture decode the image?  Not if it is resident or has a container (so a loader can skip
+	// decoding it up front; should the driver lack the container's compression, acquire decodes it after all).
+	bool needs_decode(const std::string &path, const TextureSampling &sampling = TextureSampling())
+	{
+		std::string canonical = canonical_texture_path(path);
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (names.count(texture_key(canonical, sampling)))
+				return false;
+		}
+		TextureContainer container;
+		return !container.open(canonical);
+	}
+
+	// decoded pixels of an image file (in its own channel count), valid until the matching release_pixels
+	DecodedImage acquire_pixels(const std::string &path)
+	{
+		std::string canonical = canonical_texture_path(path);
+		std::lock_guard<std::mutex> lock(mutex);
+		requests++;
+		PixelEntry &entry = pixels[canonical];
+		if (entry.refs++ == 0)
+			entry.image = decode(canonical);
+		return entry.image;
+	}
+
+	void release_pixels(const std::string &path)
+	{
+		std::string canonical = canonical_texture_path(path);
+		std::lock_guard<std::mutex> lock(mutex);
+		std::unordered_map<std::string, PixelEntry>::iterator found = pixels.find(canonical);
+		if (found == pixels.end() || --found->second.refs > 0)
+			return;
+		stbi_image_free(found->second.image.pixels);
+		pixels.erase(found);
+	}
+
+	unsigned int resident() const
+	{
+		return (unsigned int)entries.size();
+	}
+
+	// delete every texture still held (at shutdown, while the context is current)
+	void delete_textures()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		for (std::unordered_map<unsigned int, Entry>::iterator i = entries.begin(); streamer && i != entries.end(); ++i)
+			streamer->cancel(i->first);
+		names.clear();
+		entries.clear();
+		for (int i = 0; i < 3; i++)
+			standIns[i].reset();
+		// prefetched files nobody asked for
+		for (std::unordered_map<std::string, std::future<DecodedImage> >::iterator i = pending.begin(); i != pending.end(); ++i)
+			stbi_image_free(i->second.get().pixels);
+		pending.clear();
+	}
+
+private:
+	struct Entry
+	{
+		std::string key;
+		unsigned int refs;
+		TextureHandle texture;
+
+		Entry() : refs(0)
+		{
+		}
+	};
+	struct PixelEntry
+	{
+		DecodedImage image;
+		unsigned int refs;
+
+		PixelEntry() : refs(0)
+		{
+			image.width = image.height = image.components = 0;
+			image.pixels = NULL;
+		}
+	};
+	std::mutex mutex;
+	std::unordered_map<std::string, unsigned int> names;	// key -> GL name
+	std::unordered_map<unsigned int, Entry> entries;	// GL name -> entry
+	std::unordered_map<std::string, PixelEntry> pixels;	// canonical path -> held pixels
+	std::unordered_map<std::string, std::future<DecodedImage> > pending;	// canonical path -> prefetched decode
+	TextureStreamer *streamer;
+	TextureHandle standIns[3];	// 2D grey, 2D flat normal, cube map grey (made on first need)
+
+	static std::string texture_key(const std::string &canonical, const TextureSampling &sampling)
+	{
+		std::stringstream ss;
+		ss << canonical << "|" << sampling.wrap << (sampling.mipmaps ? "|mip" : "|linear");
+		return ss.str();
+	}
+
+	// the prefetched decode of a file, or a new one
+	std::future<DecodedImage> take_decode(const std::string &canonical)
+	{
+		std::unordered_map<std::string, std::future<DecodedImage> >::iterator found = pending.find(canonical);
+		if (found == pending.end())
+			return image_decoder().decode(canonical);
+		std::future<DecodedImage> image = std::move(found->second);
+		pending.erase(found);
+		return image;
+	}
+
+	DecodedImage wait(std::future<DecodedImage> &image)
+	{
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		DecodedImage result = image.get();
+		waitMilliseconds += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		decodes++;
+		return result;
+	}
+
+	DecodedImage decode(const std::string &canonical)
+	{
+		std::future<DecodedImage> image = take_decode(canonical);
+		return wait(image);
+	}
+
+	// a container that is up to date and that the driver can upload
+	static bool open_container(const std::string &canonical, TextureContainer &container)
+	{
+		return container.open(canonical) && (!container.compressed() || texture_compression_supported());
+	}
+
+	// a texture from the container's levels (just the first without mipmaps)
+	unsigned int upload_container(const TextureContainer &container, const TextureSampling &sampling)
+	{
+		unsigned int textureID;
+		glGenTextures(1, &textureID);
+		glBindTexture(GL_TEXTURE_2D, textureID);
+		unsigned int levels = sampling.mipmaps ? container.header->levels : 1;
+		container.upload(GL_TEXTURE_2D, levels);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, sampling.wrap);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, sampling.wrap);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, sampling.mipmaps ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		uploads++;
+		containers++;
+		return textureID;
+	}
+
+	// the format of stb's pixels: it has to match their channel count, the rows are width * components bytes
+	static GLenum pixel_format(const DecodedImage &image)
+	{
+		if (image.components == 1)
+			return GL_RED;
+		if (image.components == 2)
+			return GL_RG;
+		if (image.components == 3)
+			return GL_RGB;
+		return GL_RGBA;
+	}
+
+	// a texture object (empty if there are no pixels).  owned pixels may go to the streamer, image.pixels is NULL then.
+	unsigned int upload_2d(DecodedImage &image, const TextureSampling &sampling, bool owned)
+	{
+		unsigned int textureID;
+		glGenTextures(1, &textureID);
+		if (!image.pixels)
+			return textureID;
+
+		GLenum format = pixel_format(image);
+		glBindTexture(GL_TEXTURE_2D, textureID);
+		if (image.components == 2)
+		{
+			// grey and alpha: sample as (grey, grey, grey, alpha) the way GL_LUMINANCE_ALPHA did
+			GLint swizzle[4] = { GL_RED, GL_RED, GL_RED, GL_GREEN };
+			glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, swizzle);
+		}
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, sampling.wrap);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, sampling.wrap);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, sampling.mipmaps ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		uploads++;
+		if (owned && streamer)
+		{
+			streamer->stream(textureID, GL_TEXTURE_2D, GL_TEXTURE_2D, format, format, image, sampling.mipmaps);
+			image.pixels = NULL;
+			return textureID;
+		}
+
+		// stb's rows are tightly packed, not padded to 4 bytes
+		GLint alignment;
+		glGetIntegerv(GL_UNPACK_ALIGNMENT, &alignment);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		glTexImage2D(GL_TEXTURE_2D, 0, format, image.width, image.height, 0, format, GL_UNSIGNED_BYTE, image.pixels);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, alignment);
+		if (sampling.mipmaps)
+			glGenerateMipmap(GL_TEXTURE_2D);
+		return textureID;
+	}
+};
+
+// the cache every loader shares
+inline TextureCache &texture_cache()
+{
+	static TextureCache cache;
+	return cache;
+}
+
+// bind a texture from the cache to the active unit, or its stand-in while it is still streaming
+inline void bind_texture(GLenum target, unsigned int name, bool normalMap = false)
+{
+	glBindTexture(target, texture_cache().bindable(name, target, normalMap));
+}
+#endif
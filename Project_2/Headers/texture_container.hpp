@@ -0,0 +1,321 @@
+#ifndef TEXTURE_CONTAINER_H
+#define TEXTURE_CONTAINER_H
+
+#include <glad/glad.h>
+
+#include <mapped_file.hpp>
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+// Reference: https://github.com/nothings/stb (stb_image_resize.h for the mip filter, stb_dxt.h for BC1/BC3)
+// The implementations are compiled in Project2.hpp.
+#include <stb_image.h>
+#include <stb_image_resize.h>
+#include <stb_dxt.h>
+
+// GPU ready texture files.  The converter (--convert-textures) writes "<image>.rctex" next to an image: every mip level
+// already filtered and in the layout glTexImage2D / glCompressedTexImage2D take, optionally BC1 (RGB) or BC3 (RGBA)
+// compressed.  The texture cache maps that file and uploads the levels as they are, so loading skips the PNG/JPEG
+// decode and glGenerateMipmap.  A container is only used while the image still has the recorded size and modification
+// time, and a compressed one only if the driver has EXT_texture_compression_s3tc; otherwise the image is decoded as before.
+//
+// Layout (native endianness, like the model cache):
+//   TextureContainerHeader
+//   levels * TextureContainerLevel
+//   level data, each level starting on a 4 byte boundary
+
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+const unsigned int TEXTURE_CONTAINER_VERSION = 1;
+
+// TextureContainerHeader::flags
+const unsigned int TEXTURE_CONTAINER_COMPRESSED = 1;	// levels are BC1/BC3 blocks (format and type are 0)
+
+struct TextureContainerHeader
+{
+	char magic[4];	// "RCTX"
+	unsigned int version;
+	unsigned int width, height;
+	unsigned int components;	// of the source image
+	unsigned int levels;
+	unsigned int internalFormat;	// arguments of glTexImage2D
+	unsigned int format, type;
+	unsigned int flags;
+	unsigned long long sourceSize;
+	long long sourceTime;
+};
+
+struct TextureContainerLevel
+{
+	unsigned int width, height;
+	unsigned long long offset;	// from the start of the file
+	unsigned long long size;
+};
+
+inline std::string texture_container_path(const std::string &path)
+{
+	return path + ".rctex";
+}
+
+// mip levels of a width x height image, down to 1x1
+inline unsigned int texture_mip_levels(unsigned int width, unsigned int height)
+{
+	unsigned int levels = 1;
+	while ((width | height) >> levels)
+		levels++;
+	return levels;
+}
+
+// EXT_texture_compression_s3tc (BC1-3), asked once on the GL thread
+inline bool texture_compression_supported()
+{
+	static int supported = -1;
+	if (supported < 0)
+	{
+		supported = 0;
+		GLint count = 0;
+		glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+		for (GLint i = 0; i < count; i++)
+		{
+			const char *name = (const char*)glGetStringi(GL_EXTENSIONS, i);
+			if (name && std::strcmp(name, "GL_EXT_texture_compression_s3tc") == 0)
+				supported = 1;
+		}
+	}
+	return supported == 1;
+}
+
+// A mapped container, valid while open
+class TextureContainer
+{
+public:
+	const TextureContainerHeader *header;
+
+	TextureContainer() : header(NULL)
+	{
+	}
+
+	// false if there is no container for the image, it is stale or damaged
+	bool open(const std::string &sourcePath)
+	{
+		header = NULL;
+		struct stat st;
+		if (stat(sourcePath.c_str(), &st) != 0)
+			return false;
+		if (!file.open(texture_container_path(sourcePath)) || file.size < sizeof(TextureContainerHeader))
+			return false;
+
+		const TextureContainerHeader *h = (const TextureContainerHeader*)file.data;
+		if (std::memcmp(h->magic, "RCTX", 4) != 0 || h->version != TEXTURE_CONTAINER_VERSION || h->levels == 0 ||
+			h->sourceSize != (unsigned long long)st.st_size || h->sourceTime != (long long)st.st_mtime ||
+			file.size < sizeof(TextureContainerHeader) + h->levels * sizeof(TextureContainerLevel))
+			return false;
+		for (unsigned int i = 0; i < h->levels; i++)
+		{
+			const TextureContainerLevel &l = level(h, i);
+			if (l.offset + l.size > file.size)
+				return false;
+		}
+		header = h;
+		return true;
+	}
+
+	bool compressed() const
+	{
+		return (header->flags & TEXTURE_CONTAINER_COMPRESSED) != 0;
+	}
+
+	const TextureContainerLevel &level(unsigned int i) const
+	{
+		return level(header, i);
+	}
+
+	const unsigned char *data(unsigned int i) const
+	{
+		return file.data + level(i).offset;
+	}
+
+	// upload levels [0, levels) to target (GL_TEXTURE_2D or a cube map face) of the bound texture, returns the bytes uploaded
+	size_t upload(GLenum target, unsigned int levels) const
+	{
+		// rows of RGB levels aren't 4 byte aligned
+		GLint alignment;
+		glGetIntegerv(GL_UNPACK_ALIGNMENT, &alignment);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		size_t bytes = 0;
+		levels = std::min(levels, header->levels);
+		for (unsigned int i = 0; i < levels; i++)
+		{
+			const TextureContainerLevel &l = level(i);
+			if (compressed())
+				glCompressedTexImage2D(target, i, header->internalFormat, l.width, l.height, 0, (GLsizei)l.size, data(i));
+			else
+				glTexImage2D(target, i, header->internalFormat, l.width, l.height, 0, header->format, header->type, data(i));
+			bytes += (size_t)l.size;
+		}
+		glPixelStorei(GL_UNPACK_ALIGNMENT, alignment);
+		return bytes;
+	}
+
+private:
+	MappedFile file;
+
+	static const TextureContainerLevel &level(const TextureContainerHeader *h, unsigned int i)
+	{
+		return ((const TextureContainerLevel*)(h + 1))[i];
+	}
+};
+
+// BC1 (alpha = false) or BC3 blocks of an RGB(A) image
+inline std::vector<unsigned char> compress_texture_level(const unsigned char *pixels, int width, int height, int components, bool alpha)
+{
+	int blocksX = (width + 3) / 4, blocksY = (height + 3) / 4;
+	int blockSize = alpha ? 16 : 8;
+	std::vector<unsigned char> blocks((size_t)blocksX * blocksY * blockSize);
+	unsigned char rgba[64];
+	for (int by = 0; by < blocksY; by++)
+	{
+		for (int bx = 0; bx < blocksX; bx++)
+		{
+			// 4x4 RGBA texels, edges repeated where the level is smaller than a block
+			for (int y = 0; y < 4; y++)
+			{
+				for (int x = 0; x < 4; x++)
+				{
+					const unsigned char *p = pixels + ((size_t)std::min(by * 4 + y, height - 1) * width + std::min(bx * 4 + x, width - 1)) * components;
+					unsigned char *q = rgba + 4 * (4 * y + x);
+					q[0] = p[0];
+					q[1] = p[1];
+					q[2] = p[2];
+					q[3] = components == 4 ? p[3] : 255;
+				}
+			}
+			stb_compress_dxt_block(&blocks[((size_t)by * blocksX + bx) * blockSize], rgba, alpha ? 1 : 0, STB_DXT_HIGHQUAL);
+		}
+	}
+	return blocks;
+}
+
+// Converter: write the container of one image.  The mip levels are each filtered from the full image with a Mitchell
+// filter, wrapping at the edges like the GL_REPEAT sampler does.  compress only applies to RGB and RGBA images.
+//   Prints the decode time of the image against the time to map the container, and the GPU memory of both.
+inline bool convert_texture_container(const std::string &sourcePath, bool compress)
+{
+	struct stat st;
+	if (stat(sourcePath.c_str(), &st) != 0)
+	{
+		std::cout << "Failed to find texture source: " << sourcePath << std::endl;
+		return false;
+	}
+	std::chrono::high_resolution_clock::time_point decodeStart = std::chrono::high_resolution_clock::now();
+	int width, height, components;
+	unsigned char *pixels = stbi_load(sourcePath.c_str(), &width, &height, &components, 0);
+	double decodeMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - decodeStart).count();
+	if (!pixels)
+	{
+		std::cout << "Failed to load texture source: " << sourcePath << std::endl;
+		return false;
+	}
+
+	static const GLenum formats[4] = { GL_RED, GL_RG, GL_RGB, GL_RGBA };
+	static const GLenum internalFormats[4] = { GL_R8, GL_RG8, GL_RGB8, GL_RGBA8 };
+	compress = compress && components >= 3;
+
+	TextureContainerHeader header;
+	std::memcpy(header.magic, "RCTX", 4);
+	header.version = TEXTURE_CONTAINER_VERSION;
+	header.width = width;
+	header.height = height;
+	header.components = components;
+	header.levels = texture_mip_levels(width, height);
+	header.internalFormat = compress ? (components == 4 ? GL_COMPRESSED_RGBA_S3TC_DXT5_EXT : GL_COMPRESSED_RGB_S3TC_DXT1_EXT) : internalFormats[components - 1];
+	header.format = compress ? 0 : formats[components - 1];
+	header.type = compress ? 0 : GL_UNSIGNED_BYTE;
+	header.flags = compress ? TEXTURE_CONTAINER_COMPRESSED : 0;
+	header.sourceSize = (unsigned long long)st.st_size;
+	header.sourceTime = (long long)st.st_mtime;
+
+	std::vector<TextureContainerLevel> levels(header.levels);
+	std::vector<std::vector<unsigned char> > data(header.levels);
+	unsigned long long offset = sizeof(TextureContainerHeader) + header.levels * sizeof(TextureContainerLevel);
+	std::vector<unsigned char> resized;
+	double gpuBytes = 0.0;
+	for (unsigned int i = 0; i < header.levels; i++)
+	{
+		int w = std::max(1, width >> i), h = std::max(1, height >> i);
+		const unsigned char *level = pixels;
+		if (i > 0)
+		{
+			resized.resize((size_t)w * h * components);
+			stbir_resize_uint8_generic(pixels, width, height, 0, &resized[0], w, h, 0, components,
+				components == 4 ? 3 : STBIR_ALPHA_CHANNEL_NONE, 0, STBIR_EDGE_WRAP, STBIR_FILTER_MITCHELL, STBIR_COLORSPACE_LINEAR, NULL);
+			level = &resized[0];
+		}
+		if (compress)
+			data[i] = compress_texture_level(level, w, h, components, components == 4);
+		else
+			data[i].assign(level, level + (size_t)w * h * components);
+
+		offset = (offset + 3) & ~3ULL;
+		levels[i].width = w;
+		levels[i].height = h;
+		levels[i].offset = offset;
+		levels[i].size = data[i].size();
+		offset += data[i].size();
+		gpuBytes += compress ? (double)data[i].size() : (double)w * h * (components == 3 ? 4 : components);
+	}
+	stbi_image_free(pixels);
+
+	std::string containerPath = texture_container_path(sourcePath);
+	std::ofstream file(containerPath.c_str(), std::ios::binary);
+	if (!file)
+	{
+		std::cout << "Failed to write texture container: " << containerPath << std::endl;
+		return false;
+	}
+	file.write((const char*)&header, sizeof(header));
+	file.write((const char*)&levels[0], levels.size() * sizeof(TextureContainerLevel));
+	unsigned long long written = sizeof(TextureContainerHeader) + header.levels * sizeof(TextureContainerLevel);
+	for (unsigned int i = 0; i < header.levels; i++)
+	{
+		static const char padding[4] = { 0, 0, 0, 0 };
+		file.write(padding, (std::streamsize)(levels[i].offset - written));
+		file.write((const char*)&data[i][0], data[i].size());
+		written = levels[i].offset + levels[i].size;
+	}
+	file.close();
+
+	// what loading costs now: mapping the container and touching every page, against the decode above
+	std::chrono::high_resolution_clock::time_point mapStart = std::chrono::high_resolution_clock::now();
+	TextureContainer container;
+	volatile unsigned char touched = 0;
+	if (container.open(sourcePath))
+	{
+		for (unsigned int i = 0; i < container.header->levels; i++)
+			for (unsigned long long b = 0; b < container.level(i).size; b += 4096)
+				touched = touched + container.data(i)[b];
+	}
+	double mapMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - mapStart).count();
+
+	// GPU memory: the decoded image plus the mips glGenerateMipmap adds (RGB is padded to 4 bytes by most drivers)
+	double decodedBytes = (double)width * height * (components == 3 ? 4 : components) * 4.0 / 3.0;
+	std::printf("%s: %dx%d, %u levels%s, decode %.1f ms -> map %.1f ms, GPU memory %.2f MB -> %.2f MB\n", sourcePath.c_str(),
+		width, height, header.levels, compress ? (components == 4 ? " BC3" : " BC1") : "", decodeMilliseconds, mapMilliseconds,
+		decodedBytes / (1024.0 * 1024.0), gpuBytes / (1024.0 * 1024.0));
+	return true;
+}
+#endif
@@ -0,0 +1,73 @@
+#ifndef TEXTURE_PATHS_H
+#define TEXTURE_PATHS_H
+
+#include <string>
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+
+// Interned texture paths.  Every distinct canonical path gets a small id once, so texture records carry 4 bytes instead
+// of the path and finding a texture is one hash lookup on an integer.
+
+// one spelling per file: '/' separators, no "." segments or doubled separators (".." is kept, it may cross a link)
+inline std::string canonical_texture_path(const std::string &path)
+{
+	std::string result;
+	result.reserve(path.size());
+	size_t start = 0;
+	while (start <= path.size())
+	{
+		size_t end = path.find_first_of("/\\", start);
+		if (end == std::string::npos)
+			end = path.size();
+		std::string segment = path.substr(start, end - start);
+		bool leading = result.empty() && start == 0;
+		if (leading && segment.empty() && end < path.size())
+			result += '/';	// absolute path
+		else if (!segment.empty() && segment != ".")
+		{
+			if (!result.empty() && result[result.size() - 1] != '/')
+				result += '/';
+			result += segment;
+		}
+		start = end + 1;
+	}
+	return result;
+}
+
+class TexturePathTable
+{
+public:
+	// id of a (canonical) path, the same for every call with that path
+	unsigned int intern(const std::string &path)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		std::unordered_map<std::string, unsigned int>::iterator found = ids.find(path);
+		if (found != ids.end())
+			return found->second;
+		unsigned int id = (unsigned int)paths.size();
+		paths.push_back(path);
+		ids[path] = id;
+		return id;
+	}
+
+	// the path of an id (references stay valid, paths are never removed)
+	const std::string &path(unsigned int id)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return paths[id];
+	}
+
+private:
+	std::mutex mutex;
+	std::unordered_map<std::string, unsigned int> ids;
+	std::deque<std::string> paths;
+};
+
+// the table all texture records use
+inline TexturePathTable &texture_paths()
+{
+	static TexturePathTable table;
+	return table;
+}
+#endif
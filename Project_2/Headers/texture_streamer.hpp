@@ -0,0 +1,237 @@
+#ifndef TEXTURE_STREAMER_H
+#define TEXTURE_STREAMER_H
+
+#include <glad/glad.h>
+#include <stb_image.h>
+
+#include <gl_handles.hpp>
+#include <image_decoder.hpp>
+
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <algorithm>
+#include <cstring>
+
+// Streams decoded images into textures a few rows at a time, so a big texture never stalls one frame.
+//   stream() allocates the texture and queues its pixels, update() (once per frame on the GL thread) copies at most
+// bytesPerFrame of them into a pixel buffer object and lets glTexSubImage2D read them from there, which the driver can
+// do asynchronously.  The buffers form a small ring and are orphaned before every write; a fence per buffer makes sure
+// the ring never gets ahead of the GPU by more than its size (update() skips the frame instead of waiting).  Mipmaps
+// are generated after the last rows and a fence marks the texture finished: ready() is true once the GPU is past it.
+// Until then the texture's rows and mipmaps are still arriving, so what it samples is undefined: the texture cache binds
+// a 1x1 stand-in in its place (TextureCache::bindable).
+//   OpenGL 3.3 has no persistent mapping (ARB_buffer_storage), so the buffers are mapped each time with
+// GL_MAP_INVALIDATE_BUFFER_BIT instead.
+class TextureStreamer
+{
+public:
+	size_t bytesPerFrame;
+
+	// counters since startup
+	unsigned int streamed;	// textures finished
+	size_t bytesUploaded;
+	unsigned int skippedFrames;	// frames update() found the next buffer still in use
+
+	explicit TextureStreamer(size_t bytesPerFrame = 8 << 20, unsigned int buffers = 3)
+		: bytesPerFrame(bytesPerFrame), streamed(0), bytesUploaded(0), skippedFrames(0), slots(buffers), next(0)
+	{
+	}
+
+	~TextureStreamer()
+	{
+		delete_buffers();
+	}
+
+	// Queue image for level 0 of imageTarget (GL_TEXTURE_2D or a cube map face) of texture, which is bound to
+	// bindTarget, stored as internalFormat (the faces of a cube map need the same one).  format must match the image's
+	// channel count.  Takes over the pixels (they are freed once uploaded).  The texture's parameters are the caller's.
+	void stream(unsigned int texture, GLenum bindTarget, GLenum imageTarget, GLenum internalFormat, GLenum format,
+		const DecodedImage &image, bool mipmaps)
+	{
+		glBindTexture(bindTarget, texture);
+		glTexImage2D(imageTarget, 0, internalFormat, image.width, image.height, 0, format, GL_UNSIGNED_BYTE, NULL);
+		Job job = { texture, bindTarget, imageTarget, format, image, mipmaps, 0 };
+		jobs.push_back(job);
+		pendingCount[texture]++;
+	}
+
+	// upload the next rows within the budget, call once per frame
+	void update()
+	{
+		retire_finished();
+		size_t budget = bytesPerFrame;
+		while (!jobs.empty())
+		{
+			Job &job = jobs.front();
+			// rows as format lays them out (what glTexImage2D would have read from the pixels)
+			size_t rowBytes = (size_t)job.image.width * (job.format == GL_RED ? 1 : job.format == GL_RG ? 2 : job.format == GL_RGB ? 3 : 4);
+			// whole rows, at least one so every frame makes progress
+			int rows = (int)std::max<size_t>(1, budget / rowBytes);
+			rows = std::min(rows, job.image.height - job.row);
+			size_t bytes = rows * rowBytes;
+			if (bytes > budget && budget < bytesPerFrame)
+				break;
+
+			Slot &slot = slots[next];
+			if (slot.fence)
+			{
+				// the GPU still reads this buffer: try again next frame rather than wait
+				if (glClientWaitSync(slot.fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+				{
+					skippedFrames++;
+					break;
+				}
+				glDeleteSync(slot.fence);
+				slot.fence = 0;
+			}
+			if (!slot.buffer.get())
+				slot.buffer = BufferHandle::create();
+
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.buffer.get());
+			glBufferData(GL_PIXEL_UNPACK_BUFFER, bytes, NULL, GL_STREAM_DRAW);
+			void *mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+			if (mapped)
+			{
+				std::memcpy(mapped, job.image.pixels + job.row * rowBytes, bytes);
+				glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+				GLint alignment;
+				glGetIntegerv(GL_UNPACK_ALIGNMENT, &alignment);
+				glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+				glBindTexture(job.bindTarget, job.texture);
+				glTexSubImage2D(job.imageTarget, 0, 0, job.row, job.image.width, rows, job.format, GL_UNSIGNED_BYTE, (const void*)0);
+				glPixelStorei(GL_UNPACK_ALIGNMENT, alignment);
+				slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+			}
+			// a pixel unpack buffer left bound would turn the pointers of every later glTexImage2D into offsets
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			next = (next + 1) % slots.size();
+			budget -= std::min(budget, bytes);
+			bytesUploaded += bytes;
+			job.row += rows;
+
+			if (job.row >= job.image.height)
+				finish(job);
+			if (budget == 0)
+				break;
+		}
+	}
+
+	// have all of the texture's images reached the GPU?  Asked before every bind, so it only polls this texture's fence.
+	bool ready(unsigned int texture)
+	{
+		if (pendingCount.empty() && finished.empty())
+			return true;
+		if (pendingCount.count(texture))
+			return false;
+		std::unordered_map<unsigned int, GLsync>::iterator found = finished.find(texture);
+		if (found == finished.end())
+			return true;
+		if (glClientWaitSync(found->second, 0, 0) == GL_TIMEOUT_EXPIRED)
+			return false;
+		glDeleteSync(found->second);
+		finished.erase(found);
+		return true;
+	}
+
+	// drop whatever is still queued for a texture (before it is deleted)
+	void cancel(unsigned int texture)
+	{
+		for (std::deque<Job>::iterator i = jobs.begin(); i != jobs.end();)
+		{
+			if (i->texture == texture)
+			{
+				stbi_image_free(i->image.pixels);
+				i = jobs.erase(i);
+			}
+			else
+				++i;
+		}
+		pendingCount.erase(texture);
+		std::unordered_map<unsigned int, GLsync>::iterator found = finished.find(texture);
+		if (found != finished.end())
+		{
+			glDeleteSync(found->second);
+			finished.erase(found);
+		}
+	}
+
+	unsigned int pending() const
+	{
+		return (unsigned int)pendingCount.size();
+	}
+
+	// free the queue, buffers and fences (while the context is still there)
+	void delete_buffers()
+	{
+		while (!jobs.empty())
+			cancel(jobs.front().texture);
+		for (std::unordered_map<unsigned int, GLsync>::iterator i = finished.begin(); i != finished.end(); ++i)
+			glDeleteSync(i->second);
+		finished.clear();
+		for (unsigned int i = 0; i < slots.size(); i++)
+		{
+			if (slots[i].fence)
+				glDeleteSync(slots[i].fence);
+			slots[i].fence = 0;
+			slots[i].buffer.reset();
+		}
+	}
+
+private:
+	struct Job
+	{
+		unsigned int texture;
+		GLenum bindTarget, imageTarget, format;
+		DecodedImage image;
+		bool mipmaps;
+		int row;	// rows uploaded so far
+	};
+	struct Slot
+	{
+		BufferHandle buffer;
+		GLsync fence;
+
+		Slot() : fence(0)
+		{
+		}
+	};
+	std::deque<Job> jobs;
+	std::vector<Slot> slots;
+	unsigned int next;
+	std::unordered_map<unsigned int, unsigned int> pendingCount;	// texture -> queued images (six for a cube map)
+	std::unordered_map<unsigned int, GLsync> finished;	// texture -> fence after its last upload
+
+	void finish(Job &job)
+	{
+		if (--pendingCount[job.texture] == 0)
+		{
+			pendingCount.erase(job.texture);
+			if (job.mipmaps)
+			{
+				glBindTexture(job.bindTarget, job.texture);
+				glGenerateMipmap(job.bindTarget);
+			}
+			finished[job.texture] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+			streamed++;
+		}
+		stbi_image_free(job.image.pixels);
+		jobs.pop_front();
+	}
+
+	void retire_finished()
+	{
+		for (std::unordered_map<unsigned int, GLsync>::iterator i = finished.begin(); i != finished.end();)
+		{
+			if (glClientWaitSync(i->second, 0, 0) != GL_TIMEOUT_EXPIRED)
+			{
+				glDeleteSync(i->second);
+				i = finished.erase(i);
+			}
+			else
+				++i;
+		}
+	}
+};
+#endif
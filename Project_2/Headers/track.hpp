@@ -8,6 +8,10 @@
 #include <iostream>
 
 #include <shader.hpp>
+#include <gl_handles.hpp>
+#include <texture_cache.hpp>
+#include <frustum.hpp>
+#include <vertex_packing.hpp>
 #include <rc_spline.h>
 
 struct Orientation {
@@ -26,10 +30,10 @@ class Track
 public:
 
 	// VAO
-	unsigned int VAO;
+	VertexArrayHandle VAO;
 
 	//VAOPlank
-	unsigned int VAOPlank;
+	VertexArrayHandle VAOPlank;
 
 	// Control Points Loading Class for loading from File
 	rc_Spline g_Track;
@@ -43,6 +47,16 @@ public:
 	std::vector<Orientation> camera; 
 	// indices for EBO
 	std::vector<unsigned int> indices;
+	// vertices drawn, stay valid after release_cpu_data
+	unsigned int vertexCount = 0, plankVertexCount = 0;
+
+	// of the rails and planks (drawn without a model transform, so in world space)
+	Bounds bounds;
+
+	// how the GPU copies of the rails and planks are stored: PackedVertex (16 bytes) or Vertex (32), both in the box of
+	// the whole track (see vertex_packing.hpp)
+	bool packVertices;
+	VertexQuantization quantization;
 
 	// hmax for camera
 	float hmax = 0.0f;
@@ -54,17 +68,34 @@ public:
 	const float railGap = 0.3f;
 	const float cameraHeight = 4.0f;
 
-	// constructor, just use same VBO as before, 
-	Track(const char* trackPath)
+	// constructor, just use same VBO as before.  packVertices = false uploads the float vertices.
+	Track(const char* trackPath, bool packVertices = true) : packVertices(packVertices), quantization(VertexQuantization::identity())
 	{
 		// load Track data
 		load_track(trackPath);
 
 		create_track();
 
+		if (packVertices && !vertices.empty())
+			quantization = vertex_quantization(&vertices[0], vertices.size());
+		if (packVertices && !vertices_plank.empty())
+		{
+			VertexQuantization planks = vertex_quantization(&vertices_plank[0], vertices_plank.size());
+			quantization = vertices.empty() ? planks : vertex_quantization_union(quantization, planks);
+		}
+		packingError = VertexPackingError();
 		setup_track();
 
 		setup_track_plank();
+		if (packVertices)
+			print_vertex_packing("Track", packingError, quantization, sizeof(Vertex), sizeof(PackedVertex));
+
+		bounds = bounds_of_box(glm::vec3(0.0f), glm::vec3(0.0f));
+		if (!vertices.empty() && !vertices_plank.empty())
+			bounds = bounds_union(bounds_of_points(&vertices[0].Position.x, sizeof(Vertex), vertices.size()),
+				bounds_of_points(&vertices_plank[0].Position.x, sizeof(Vertex), vertices_plank.size()));
+		else if (!vertices.empty())
+			bounds = bounds_of_points(&vertices[0].Position.x, sizeof(Vertex), vertices.size());
 	}
 
 	// render the mesh
@@ -82,16 +113,17 @@ public:
 		// Bind new textures to both texture positions (do both since it has 2 textures in the vertex shader)
 		glActiveTexture(GL_TEXTURE0);
 
-		glBindTexture(GL_TEXTURE_2D, textureID);
+		bind_texture(GL_TEXTURE_2D, textureID);
 		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D, textureID);
+		bind_texture(GL_TEXTURE_2D, textureID);
 
 		// Set model in shaders
 
 
 		shader.setMat4("model", model_track);
-		glBindVertexArray(VAO);
-		glDrawArrays(GL_TRIANGLES, 0, vertices.size());
+		quantization.apply(shader);
+		glBindVertexArray(VAO.get());
+		glDrawArrays(GL_TRIANGLES, 0, vertexCount);
 
 		// always good practice to set everything back to defaults once configured.
 		glActiveTexture(GL_TEXTURE0);
@@ -101,13 +133,13 @@ public:
 
 		glActiveTexture(GL_TEXTURE0);
 
-		glBindTexture(GL_TEXTURE_2D, texturePlank);
+		bind_texture(GL_TEXTURE_2D, texturePlank);
 		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D, texturePlank);
+		bind_texture(GL_TEXTURE_2D, texturePlank);
 
 		shader.setMat4("model", model_track);
-		glBindVertexArray(VAOPlank);
-		glDrawArrays(GL_TRIANGLES, 0, vertices_plank.size());
+		glBindVertexArray(VAOPlank.get());
+		glDrawArrays(GL_TRIANGLES, 0, plankVertexCount);
 
 		// always good practice to set everything back to defaults once configured.
 		glActiveTexture(GL_TEXTURE0);
@@ -127,19 +159,29 @@ public:
 	}
 
 
+	// free the rail and plank vertices once they are on the GPU
+	void release_cpu_data()
+	{
+		std::vector<Vertex>().swap(vertices);
+		std::vector<Vertex>().swap(vertices_plank);
+		std::vector<unsigned int>().swap(indices);
+	}
+
 	void delete_buffers()
 	{
-		glDeleteVertexArrays(1, &VAO);
-		glDeleteBuffers(1, &VBO);
-		glDeleteBuffers(1, &EBO);
+		VAO.reset();
+		VBO.reset();
+		VAOPlank.reset();
+		VBOplank.reset();
 	}
 
 private:
 	
 
 	/*  Render data  */
-	unsigned int VBO, EBO;
-	unsigned int VBOplank, EBOplank;
+	BufferHandle VBO;
+	BufferHandle VBOplank;
+	VertexPackingError packingError;	// of the rails and planks together
 
 	void load_track(const char* trackPath)
 	{
@@ -690,31 +732,18 @@ private:
 		 //      Vertex Array Buffer (VAO), and the Element Buffer Objects (EBO)
 
 		 // 2. Bind Vertex Array Object
-		 glGenVertexArrays(1, &VAO);
+		 VAO = VertexArrayHandle::create();
 
 		 //  Bind the Vertex Buffer
-		 glGenBuffers(1, &VBO);
+		 VBO = BufferHandle::create();
 		 //glGenBuffers(1, &EBO);
+		 vertexCount = (unsigned int)vertices.size();
 
-		 glBindVertexArray(VAO);
+		 glBindVertexArray(VAO.get());
 
 		 // 3. Copy our vertices array in a vertex buffer for OpenGL to use
-		 glBindBuffer(GL_ARRAY_BUFFER, VBO);
-		 glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
-
-		 // 4. Copy our indices array in a vertex buffer for OpenGL to use
-		 //glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-		 //glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), &indices[0], GL_STATIC_DRAW);
-
-		 // 5.  Position attribute for the 3D Position Coordinates and link to position 0
-		 glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
-		 glEnableVertexAttribArray(0);
-		 // 6.  TexCoord attribute for the 2d Texture Coordinates and link to position 2
-		 glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)(3 * sizeof(float)));
-		 glEnableVertexAttribArray(1);
-		 // 6.  TexCoord attribute for the 2d Texture Coordinates and link to position 2
-		 glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)(6 * sizeof(float)));
-		 glEnableVertexAttribArray(2);
+		 glBindBuffer(GL_ARRAY_BUFFER, VBO.get());
+		 upload_vertices(vertices);
 	}
 	void setup_track_plank()
 	{
@@ -723,17 +752,33 @@ private:
 		 //      Vertex Array Buffer (VAO), and the Element Buffer Objects (EBO)
 
 		 // 2. Bind Vertex Array Object
-		glGenVertexArrays(1, &VAOPlank);
+		VAOPlank = VertexArrayHandle::create();
 
 		//  Bind the Vertex Buffer
-		glGenBuffers(1, &VBOplank);
+		VBOplank = BufferHandle::create();
 		//glGenBuffers(1, &EBO);
+		plankVertexCount = (unsigned int)vertices_plank.size();
 
-		glBindVertexArray(VAOPlank);
+		glBindVertexArray(VAOPlank.get());
 
 		// 3. Copy our vertices array in a vertex buffer for OpenGL to use
-		glBindBuffer(GL_ARRAY_BUFFER, VBOplank);
-		glBufferData(GL_ARRAY_BUFFER, vertices_plank.size() * sizeof(Vertex), &vertices_plank[0], GL_STATIC_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, VBOplank.get());
+		upload_vertices(vertices_plank);
+	}
+
+	// fill the bound GL_ARRAY_BUFFER and point the bound VAO at it, packed or as floats
+	void upload_vertices(const std::vector<Vertex> &data)
+	{
+		if (data.empty())
+			return;
+		if (packVertices)
+		{
+			std::vector<PackedVertex> packed = pack_vertices(&data[0], data.size(), quantization, packingError);
+			glBufferData(GL_ARRAY_BUFFER, packed.size() * sizeof(PackedVertex), &packed[0], GL_STATIC_DRAW);
+			setup_packed_vertex_attributes();
+			return;
+		}
+		glBufferData(GL_ARRAY_BUFFER, data.size() * sizeof(Vertex), &data[0], GL_STATIC_DRAW);
 
 		// 4. Copy our indices array in a vertex buffer for OpenGL to use
 		//glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
@@ -0,0 +1,136 @@
+#ifndef UNIFORM_BLOCKS_H
+#define UNIFORM_BLOCKS_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <shader.hpp>
+#include <gl_handles.hpp>
+
+// Per-frame data every lit program reads, in std140 uniform blocks instead of per-program uniforms: main fills one
+// buffer per block and binds it to a fixed binding point, and each program's block is pointed at that binding point
+// once (bind_uniform_blocks).  The blocks are declared the same way in the shaders:
+//
+//   layout (std140) uniform Camera { mat4 view; mat4 projection; vec3 viewPos; vec3 viewFront; };
+//   layout (std140) uniform Lights { Light dirLight; Light pointLights[NR_POINT_LIGHTS]; Light spotLight; };
+//
+// with the Light struct ordered vec3, float, vec3, float, ... so std140 packs it without padding.
+
+const GLuint CAMERA_BLOCK_BINDING = 0;
+const GLuint LIGHTS_BLOCK_BINDING = 1;
+
+const int NR_POINT_LIGHTS = 4;
+
+// std140 Camera block: vec3s are aligned to 16 bytes
+struct CameraBlock
+{
+	glm::mat4 view;
+	glm::mat4 projection;
+	glm::vec3 viewPos;
+	float pad0;
+	glm::vec3 viewFront;
+	float pad1;
+};
+
+// std140 Light struct, 80 bytes
+struct LightBlock
+{
+	glm::vec3 position;
+	float cutOff;
+	glm::vec3 direction;
+	float outerCutOff;
+	glm::vec3 ambient;
+	float constant;
+	glm::vec3 diffuse;
+	float linear;
+	glm::vec3 specular;
+	float quadratic;
+};
+
+// std140 Lights block.  The spot light is the camera's flashlight, the shaders take its position and direction from
+// the Camera block, so the lights only change when the scene's lights do.
+struct LightsBlock
+{
+	LightBlock dirLight;
+	LightBlock pointLights[NR_POINT_LIGHTS];
+	LightBlock spotLight;
+};
+
+static_assert(sizeof(CameraBlock) == 160, "CameraBlock must match the std140 layout of the Camera block");
+static_assert(sizeof(LightBlock) == 80, "LightBlock must match the std140 layout of the Light struct");
+static_assert(sizeof(LightsBlock) == (NR_POINT_LIGHTS + 2) * 80, "LightsBlock must match the std140 layout of the Lights block");
+
+// Contents of one uniform block in a GL buffer on a fixed binding point.  edit() marks the data dirty and update()
+// uploads it only then, so a block that didn't change costs nothing per frame.
+template <typename Block>
+class UniformBuffer
+{
+public:
+	unsigned int uploads;	// buffer updates so far
+
+	explicit UniformBuffer(GLuint binding) : uploads(0), binding(binding), dirty(true), data()
+	{
+	}
+
+	const Block &get() const
+	{
+		return data;
+	}
+
+	Block &edit()
+	{
+		dirty = true;
+		return data;
+	}
+
+	// upload the block if it changed; true if it did
+	bool update()
+	{
+		if (!dirty)
+			return false;
+		if (buffer.get() == 0)
+		{
+			buffer = BufferHandle::create();
+			glBindBuffer(GL_UNIFORM_BUFFER, buffer.get());
+			glBufferData(GL_UNIFORM_BUFFER, sizeof(Block), &data, GL_DYNAMIC_DRAW);
+			glBindBufferBase(GL_UNIFORM_BUFFER, binding, buffer.get());
+		}
+		else
+		{
+			// orphan the storage so the update doesn't wait for last frame's draws
+			glBindBuffer(GL_UNIFORM_BUFFER, buffer.get());
+			glBufferData(GL_UNIFORM_BUFFER, sizeof(Block), NULL, GL_DYNAMIC_DRAW);
+			glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(Block), &data);
+		}
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		dirty = false;
+		uploads++;
+		return true;
+	}
+
+	void delete_buffers()
+	{
+		buffer.reset();
+		dirty = true;
+	}
+
+private:
+	GLuint binding;
+	bool dirty;
+	Block data;
+	BufferHandle buffer;
+};
+
+// point the Camera and Lights blocks of a program (if it has them) at their binding points.  GLSL 330 has no
+// layout(binding = N), so this is done once per program after linking.
+inline void bind_uniform_blocks(const Shader &shader)
+{
+	GLuint camera = glGetUniformBlockIndex(shader.ID, "Camera");
+	if (camera != GL_INVALID_INDEX)
+		glUniformBlockBinding(shader.ID, camera, CAMERA_BLOCK_BINDING);
+	GLuint lights = glGetUniformBlockIndex(shader.ID, "Lights");
+	if (lights != GL_INVALID_INDEX)
+		glUniformBlockBinding(shader.ID, lights, LIGHTS_BLOCK_BINDING);
+}
+
+#endif
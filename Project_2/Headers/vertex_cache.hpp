@@ -0,0 +1,298 @@
+#ifndef VERTEX_CACHE_H
+#define VERTEX_CACHE_H
+
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+#include <utility>
+
+// Index ordering for the GPU post-transform vertex cache.
+//   A vertex is only shaded again if it fell out of the small cache of recently transformed vertices, so the order of
+//   the triangles decides how often that happens.  The quality measure is the average cache miss ratio (ACMR): vertices
+//   transformed per triangle, 3.0 for a triangle soup and about 0.5 at best for a regular grid.
+//   Reference: Sander, Nehab & Barczak, "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw" (Tipsify)
+
+// cache size the orderings aim at and ACMR is measured with (a FIFO of this many vertices)
+const int VERTEX_CACHE_SIZE = 16;
+
+// ACMR of a triangle list on a FIFO cache
+template <typename Index>
+float vertex_cache_acmr(const Index *indices, size_t count, size_t vertexCount, int cacheSize = VERTEX_CACHE_SIZE)
+{
+	if (count < 3)
+		return 0.0f;
+	// a vertex is in the cache while fewer than cacheSize misses happened since it was loaded
+	std::vector<unsigned int> loadedAt(vertexCount, 0);
+	unsigned int misses = 0;
+	for (size_t i = 0; i < count; i++)
+	{
+		unsigned int &stamp = loadedAt[indices[i]];
+		if (stamp == 0 || misses - (stamp - 1) >= (unsigned int)cacheSize)
+		{
+			misses++;
+			stamp = misses;
+		}
+	}
+	return float(misses) / float(count / 3);
+}
+
+// Tipsify: fan around the vertex that is still in the cache and has the most triangles left, jump back to a recently
+// used vertex (or the next unused one) at dead ends.  Linear time, works in place on any triangle list.
+template <typename Index>
+void optimize_vertex_cache(Index *indices, size_t count, size_t vertexCount, int cacheSize = VERTEX_CACHE_SIZE)
+{
+	size_t triangleCount = count / 3;
+	if (triangleCount == 0)
+		return;
+
+	// vertex -> triangles adjacency as offsets into one array
+	std::vector<unsigned int> live(vertexCount, 0), offsets(vertexCount + 1, 0), adjacency(count);
+	for (size_t i = 0; i < count; i++)
+		live[indices[i]]++;
+	for (size_t v = 0; v < vertexCount; v++)
+		offsets[v + 1] = offsets[v] + live[v];
+	std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+	for (size_t i = 0; i < count; i++)
+		adjacency[fill[indices[i]]++] = (unsigned int)(i / 3);
+
+	std::vector<unsigned int> cacheTime(vertexCount, 0);
+	std::vector<char> emitted(triangleCount, 0);
+	std::vector<unsigned int> deadEnd;
+	std::vector<unsigned int> candidates;
+	std::vector<Index> result;
+	result.reserve(count);
+
+	unsigned int time = cacheSize + 1;
+	size_t cursor = 0;
+	long long fanning = 0;
+	while (fanning >= 0)
+	{
+		// emit every remaining triangle around the fanning vertex
+		candidates.clear();
+		for (unsigned int a = offsets[fanning]; a < offsets[fanning + 1]; a++)
+		{
+			unsigned int t = adjacency[a];
+			if (emitted[t])
+				continue;
+			for (int k = 0; k < 3; k++)
+			{
+				Index v = indices[3 * t + k];
+				result.push_back(v);
+				deadEnd.push_back(v);
+				candidates.push_back(v);
+				live[v]--;
+				if (time - cacheTime[v] > (unsigned int)cacheSize)
+					cacheTime[v] = time++;
+			}
+			emitted[t] = 1;
+		}
+
+		// next fanning vertex: a candidate that will still be cached after its remaining triangles, oldest first
+		fanning = -1;
+		int best = -1;
+		for (unsigned int i = 0; i < candidates.size(); i++)
+		{
+			unsigned int v = candidates[i];
+			if (live[v] == 0)
+				continue;
+			int priority = 0;
+			if (time - cacheTime[v] + 2 * live[v] <= (unsigned int)cacheSize)
+				priority = time - cacheTime[v];
+			if (priority > best)
+			{
+				best = priority;
+				fanning = v;
+			}
+		}
+
+		// dead end: the most recent vertex with triangles left, else the next one in input order
+		while (fanning < 0 && !deadEnd.empty())
+		{
+			unsigned int v = deadEnd.back();
+			deadEnd.pop_back();
+			if (live[v] > 0)
+				fanning = v;
+		}
+		while (fanning < 0 && cursor < vertexCount)
+		{
+			if (live[cursor] > 0)
+				fanning = cursor;
+			cursor++;
+		}
+	}
+
+	std::memcpy(indices, &result[0], count * sizeof(Index));
+}
+
+// Overdraw pass over a cache ordered triangle list (the second half of Tipsify).  The list is cut into clusters where the
+// cache order jumps to an unrelated vertex, and also once a cluster gets close to the ACMR of the whole list, so the cuts
+// cost little cache efficiency (threshold 1.05 allows 5% more misses).  Clusters facing away from the centre of the mesh
+// are drawn first: from most directions they are in front, and everything behind them fails the depth test early.
+//   positions are x, y, z floats, stride bytes apart (one per vertex).
+template <typename Index>
+void optimize_overdraw(Index *indices, size_t count, const float *positions, size_t stride, size_t vertexCount,
+	float threshold = 1.05f, int cacheSize = VERTEX_CACHE_SIZE)
+{
+	size_t triangleCount = count / 3;
+	if (triangleCount < 2)
+		return;
+	float acmr = vertex_cache_acmr(indices, count, vertexCount, cacheSize);
+
+	// cut into clusters while replaying the FIFO cache.  A cluster's own ACMR is measured from an empty cache, because
+	// after sorting it can follow any other cluster, so a cut only happens once the cluster has paid for its start.
+	std::vector<size_t> clusters(1, 0);
+	std::vector<unsigned int> loadedAt(vertexCount, 0), clusterLoadedAt(vertexCount, 0);
+	unsigned int misses = 0, clusterMisses = 0, clusterBase = 0, clusterClock = 0;
+	for (size_t t = 0; t < triangleCount; t++)
+	{
+		unsigned int triangleMisses = 0;
+		for (int k = 0; k < 3; k++)
+		{
+			unsigned int &stamp = loadedAt[indices[3 * t + k]];
+			if (stamp == 0 || misses - (stamp - 1) >= (unsigned int)cacheSize)
+			{
+				misses++;
+				stamp = misses;
+				triangleMisses++;
+			}
+		}
+		// a jump to unrelated vertices is always a cut, otherwise cut when the cluster is within threshold of the whole list
+		size_t clusterSize = t - clusters.back();
+		if (clusterSize > 0 && (triangleMisses == 3 || float(clusterMisses) <= threshold * acmr * float(clusterSize)))
+		{
+			clusters.push_back(t);
+			clusterMisses = 0;
+			clusterBase = clusterClock;
+		}
+		for (int k = 0; k < 3; k++)
+		{
+			unsigned int &stamp = clusterLoadedAt[indices[3 * t + k]];
+			if (stamp <= clusterBase || clusterClock - (stamp - 1) >= (unsigned int)cacheSize)
+			{
+				clusterClock++;
+				stamp = clusterClock;
+				clusterMisses++;
+			}
+		}
+	}
+	clusters.push_back(triangleCount);
+
+	// area weighted centroid and normal of every cluster and of the whole mesh
+	struct Vec
+	{
+		static void load(const float *positions, size_t stride, size_t v, float *out)
+		{
+			const float *p = (const float*)((const char*)positions + v * stride);
+			out[0] = p[0];
+			out[1] = p[1];
+			out[2] = p[2];
+		}
+	};
+	size_t clusterCount = clusters.size() - 1;
+	std::vector<float> centroid(clusterCount * 3, 0.0f), normal(clusterCount * 3, 0.0f), area(clusterCount, 0.0f);
+	float meshCentroid[3] = { 0.0f, 0.0f, 0.0f }, meshArea = 0.0f;
+	for (size_t c = 0; c < clusterCount; c++)
+	{
+		for (size_t t = clusters[c]; t < clusters[c + 1]; t++)
+		{
+			float a[3], b[3], d[3];
+			Vec::load(positions, stride, indices[3 * t], a);
+			Vec::load(positions, stride, indices[3 * t + 1], b);
+			Vec::load(positions, stride, indices[3 * t + 2], d);
+			float e1[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+			float e2[3] = { d[0] - a[0], d[1] - a[1], d[2] - a[2] };
+			float n[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+			float triangleArea = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+			for (int k = 0; k < 3; k++)
+			{
+				centroid[3 * c + k] += (a[k] + b[k] + d[k]) / 3.0f * triangleArea;
+				normal[3 * c + k] += n[k];
+			}
+			area[c] += triangleArea;
+		}
+		for (int k = 0; k < 3; k++)
+			meshCentroid[k] += centroid[3 * c + k];
+		meshArea += area[c];
+	}
+	for (int k = 0; k < 3; k++)
+		meshCentroid[k] /= std::max(meshArea, 1e-30f);
+
+	// how far each cluster faces out of the mesh
+	std::vector<std::pair<float, size_t> > order(clusterCount);
+	for (size_t c = 0; c < clusterCount; c++)
+	{
+		float *n = &normal[3 * c];
+		float length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+		float facing = 0.0f;
+		if (length > 0.0f && area[c] > 0.0f)
+		{
+			for (int k = 0; k < 3; k++)
+				facing += (centroid[3 * c + k] / area[c] - meshCentroid[k]) * n[k];
+			facing /= length;
+		}
+		order[c] = std::make_pair(-facing, c);
+	}
+	std::stable_sort(order.begin(), order.end());
+
+	std::vector<Index> result;
+	result.reserve(count);
+	for (size_t i = 0; i < clusterCount; i++)
+	{
+		size_t c = order[i].second;
+		result.insert(result.end(), indices + 3 * clusters[c], indices + 3 * clusters[c + 1]);
+	}
+	std::memcpy(indices, &result[0], 3 * triangleCount * sizeof(Index));
+}
+
+// Renumber vertices in the order the indices first use them, so the vertex fetch walks memory forwards.
+//   Unused vertices are dropped.
+template <typename VertexType, typename Index>
+void optimize_vertex_fetch(std::vector<VertexType> &vertices, Index *indices, size_t count)
+{
+	std::vector<long long> remap(vertices.size(), -1);
+	std::vector<VertexType> ordered;
+	ordered.reserve(vertices.size());
+	for (size_t i = 0; i < count; i++)
+	{
+		long long &index = remap[indices[i]];
+		if (index < 0)
+		{
+			index = ordered.size();
+			ordered.push_back(vertices[indices[i]]);
+		}
+		indices[i] = (Index)index;
+	}
+	vertices.swap(ordered);
+}
+
+// Cache friendly triangle order for cells [0,cellsX) x [0,cellsY) of a regular grid (vertex base + x*rowLength + y) with
+// the triangle pair of Heightmap::create_indices.  The grid is walked in strips narrow enough that the row of vertices
+// shared with the next row of cells is still cached, so nearly every vertex is transformed once.
+template <typename Index>
+void grid_cache_indices(int cellsX, int cellsY, int rowLength, int base, std::vector<Index> &indices, int cacheSize = VERTEX_CACHE_SIZE)
+{
+	// two rows of strip + 1 vertices have to fit
+	int strip = std::max(1, cacheSize / 2 - 1);
+	for (int y0 = 0; y0 < cellsY; y0 += strip)
+	{
+		int y1 = std::min(y0 + strip, cellsY);
+		for (int x = 0; x < cellsX; x++)
+		{
+			for (int y = y0; y < y1; y++)
+			{
+				Index a = base + x*rowLength + y;
+				Index b = base + x*rowLength + y + 1;
+				Index c = base + (x + 1)*rowLength + y;
+				Index d = base + (x + 1)*rowLength + y + 1;
+				indices.push_back(a);
+				indices.push_back(b);
+				indices.push_back(c);
+				indices.push_back(b);
+				indices.push_back(d);
+				indices.push_back(c);
+			}
+		}
+	}
+}
+#endif
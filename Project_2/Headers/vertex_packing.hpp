@@ -0,0 +1,246 @@
+#ifndef VERTEX_PACKING_H
+#define VERTEX_PACKING_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <shader.hpp>
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstddef>
+
+// Compact vertex formats for the GPU copies of the geometry (the CPU side keeps its float vertices).
+//   PackedVertex       16 bytes for a Vertex (32): position unorm16 x3, normal snorm 10:10:10, texture coordinates unorm16 x2
+//   PackedVertexModel  20 bytes for a VertexModel (56): the same plus the tangent as snorm 10:10:10 with the handedness
+//                      of the bitangent in the 2 bit w, so the shader rebuilds the bitangent as cross(N, T) * w
+// Positions and texture coordinates are stored relative to the box they span in the whole buffer (VertexQuantization),
+// which the vertex shaders undo with the positionOffset/positionScale and texCoordOffset/texCoordScale uniforms.  Those
+// default to the identity, so float vertices drawn with the same shaders need nothing.
+
+struct PackedVertex
+{
+	unsigned short position[4];	// the 4th is padding
+	unsigned int normal;	// GL_INT_2_10_10_10_REV
+	unsigned short texCoords[2];
+};
+
+struct PackedVertexModel
+{
+	unsigned short position[4];
+	unsigned int normal;
+	unsigned short texCoords[2];
+	unsigned int tangent;	// w: +1 or -1, the bitangent's side
+};
+
+// what the shader multiplies and adds to get the positions and texture coordinates back
+struct VertexQuantization
+{
+	glm::vec3 positionOffset, positionScale;
+	glm::vec2 texCoordOffset, texCoordScale;
+
+	static VertexQuantization identity()
+	{
+		VertexQuantization quantization = { glm::vec3(0.0f), glm::vec3(1.0f), glm::vec2(0.0f), glm::vec2(1.0f) };
+		return quantization;
+	}
+
+	// set the uniforms of shader (which has to be in use)
+	void apply(const Shader &shader) const
+	{
+		shader.setVec3("positionOffset", positionOffset);
+		shader.setVec3("positionScale", positionScale);
+		shader.setVec2("texCoordOffset", texCoordOffset);
+		shader.setVec2("texCoordScale", texCoordScale);
+	}
+};
+
+// largest differences between the packed and the float vertices, checked at load
+struct VertexPackingError
+{
+	unsigned int vertices;
+	float position;	// in model units
+	float normalDegrees;
+	float texCoord;
+	float tangentDegrees;
+	unsigned int handedness;	// tangent frames whose bitangent side came out different
+	unsigned int missingTangents;	// zero or NaN tangents that were replaced
+};
+
+// the box of the positions and texture coordinates of count vertices (anything with Position and TexCoords)
+template <typename VertexType>
+VertexQuantization vertex_quantization(const VertexType *vertices, size_t count)
+{
+	VertexQuantization quantization = VertexQuantization::identity();
+	if (count == 0)
+		return quantization;
+	glm::vec3 low(vertices[0].Position), high(vertices[0].Position);
+	glm::vec2 lowUV(vertices[0].TexCoords), highUV(vertices[0].TexCoords);
+	for (size_t i = 1; i < count; i++)
+	{
+		low = glm::min(low, vertices[i].Position);
+		high = glm::max(high, vertices[i].Position);
+		lowUV = glm::min(lowUV, vertices[i].TexCoords);
+		highUV = glm::max(highUV, vertices[i].TexCoords);
+	}
+	// a flat axis still needs a scale to divide by
+	quantization.positionOffset = low;
+	quantization.positionScale = glm::max(high - low, glm::vec3(1e-20f));
+	quantization.texCoordOffset = lowUV;
+	quantization.texCoordScale = glm::max(highUV - lowUV, glm::vec2(1e-20f));
+	return quantization;
+}
+
+// the box of two buffers sharing one quantization
+inline VertexQuantization vertex_quantization_union(const VertexQuantization &a, const VertexQuantization &b)
+{
+	VertexQuantization quantization;
+	quantization.positionOffset = glm::min(a.positionOffset, b.positionOffset);
+	quantization.positionScale = glm::max(a.positionOffset + a.positionScale, b.positionOffset + b.positionScale) - quantization.positionOffset;
+	quantization.texCoordOffset = glm::min(a.texCoordOffset, b.texCoordOffset);
+	quantization.texCoordScale = glm::max(a.texCoordOffset + a.texCoordScale, b.texCoordOffset + b.texCoordScale) - quantization.texCoordOffset;
+	return quantization;
+}
+
+inline unsigned short quantize_unorm16(float value, float offset, float scale)
+{
+	return (unsigned short)glm::clamp((int)std::floor((value - offset) / scale * 65535.0f + 0.5f), 0, 65535);
+}
+
+inline float unquantize_unorm16(unsigned short value, float offset, float scale)
+{
+	return offset + scale * (float(value) / 65535.0f);
+}
+
+// signed normalized x, y, z in 10 bits each and w (-1 or +1) in 2.  -1 is stored as -2 so that it reads back as -1 with
+// both the GL 3.3 ((2c + 1) / (2^b - 1)) and the GL 4.2 (max(c / (2^(b-1) - 1), -1)) conversion.
+inline unsigned int pack_snorm_10_10_10_2(const glm::vec3 &v, float w)
+{
+	int x = glm::clamp((int)std::floor(v.x * 511.0f + 0.5f), -511, 511);
+	int y = glm::clamp((int)std::floor(v.y * 511.0f + 0.5f), -511, 511);
+	int z = glm::clamp((int)std::floor(v.z * 511.0f + 0.5f), -511, 511);
+	int s = w < 0.0f ? -2 : 1;
+	return (unsigned int)(x & 1023) | ((unsigned int)(y & 1023) << 10) | ((unsigned int)(z & 1023) << 20) | ((unsigned int)(s & 3) << 30);
+}
+
+inline glm::vec4 unpack_snorm_10_10_10_2(unsigned int packed)
+{
+	// sign extend each field
+	int x = (int)(packed << 22) >> 22, y = (int)(packed << 12) >> 22, z = (int)(packed << 2) >> 22, w = (int)packed >> 30;
+	return glm::vec4(std::max(x / 511.0f, -1.0f), std::max(y / 511.0f, -1.0f), std::max(z / 511.0f, -1.0f), std::max(float(w), -1.0f));
+}
+
+// angle between two directions in degrees (0 if either is zero)
+inline float vertex_packing_angle(const glm::vec3 &a, const glm::vec3 &b)
+{
+	float lengths = glm::length(a) * glm::length(b);
+	if (lengths <= 0.0f)
+		return 0.0f;
+	return glm::degrees(std::acos(glm::clamp(glm::dot(a, b) / lengths, -1.0f, 1.0f)));
+}
+
+// unit length v, or zero if v has no direction (zero, or not finite: Assimp leaves NaN tangents on degenerate UVs)
+inline glm::vec3 vertex_packing_direction(const glm::vec3 &v)
+{
+	float length = glm::length(v);
+	if (!(length > 0.0f) || !std::isfinite(length))
+		return glm::vec3(0.0f);
+	return v / length;
+}
+
+// position, normal and texture coordinates of any vertex type, and the error they picked up
+template <typename VertexType, typename Packed>
+void pack_vertex_common(const VertexType &vertex, const VertexQuantization &quantization, Packed &packed, VertexPackingError &error)
+{
+	glm::vec3 position;
+	for (int k = 0; k < 3; k++)
+	{
+		packed.position[k] = quantize_unorm16(vertex.Position[k], quantization.positionOffset[k], quantization.positionScale[k]);
+		position[k] = unquantize_unorm16(packed.position[k], quantization.positionOffset[k], quantization.positionScale[k]);
+	}
+	packed.position[3] = 0;
+	error.position = std::max(error.position, glm::length(position - vertex.Position));
+
+	glm::vec3 normal = vertex_packing_direction(vertex.Normal);
+	packed.normal = pack_snorm_10_10_10_2(normal, 1.0f);
+	error.normalDegrees = std::max(error.normalDegrees, vertex_packing_angle(glm::vec3(unpack_snorm_10_10_10_2(packed.normal)), normal));
+
+	for (int k = 0; k < 2; k++)
+	{
+		packed.texCoords[k] = quantize_unorm16(vertex.TexCoords[k], quantization.texCoordOffset[k], quantization.texCoordScale[k]);
+		error.texCoord = std::max(error.texCoord, std::fabs(unquantize_unorm16(packed.texCoords[k], quantization.texCoordOffset[k],
+			quantization.texCoordScale[k]) - vertex.TexCoords[k]));
+	}
+	error.vertices++;
+}
+
+template <typename VertexType>
+std::vector<PackedVertex> pack_vertices(const VertexType *vertices, size_t count, const VertexQuantization &quantization, VertexPackingError &error)
+{
+	std::vector<PackedVertex> packed(count);
+	for (size_t i = 0; i < count; i++)
+		pack_vertex_common(vertices[i], quantization, packed[i], error);
+	return packed;
+}
+
+// the bitangent only keeps its side: cross(N, T) points the same way or the other way
+template <typename VertexType>
+std::vector<PackedVertexModel> pack_model_vertices(const VertexType *vertices, size_t count, const VertexQuantization &quantization, VertexPackingError &error)
+{
+	std::vector<PackedVertexModel> packed(count);
+	for (size_t i = 0; i < count; i++)
+	{
+		const VertexType &vertex = vertices[i];
+		pack_vertex_common(vertex, quantization, packed[i], error);
+
+		// a vertex without a tangent gets any one perpendicular to its normal, the float vertex would shade as NaN
+		glm::vec3 tangent = vertex_packing_direction(vertex.Tangent);
+		if (tangent == glm::vec3(0.0f))
+		{
+			glm::vec3 normal = vertex_packing_direction(vertex.Normal);
+			tangent = vertex_packing_direction(glm::cross(normal, std::fabs(normal.x) < 0.9f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f)));
+			error.missingTangents++;
+		}
+		float side = glm::dot(glm::cross(vertex.Normal, vertex.Tangent), vertex.Bitangent) < 0.0f ? -1.0f : 1.0f;
+		packed[i].tangent = pack_snorm_10_10_10_2(tangent, side);
+		glm::vec4 unpacked = unpack_snorm_10_10_10_2(packed[i].tangent);
+		error.tangentDegrees = std::max(error.tangentDegrees, vertex_packing_angle(glm::vec3(unpacked), tangent));
+		if (unpacked.w != side)
+			error.handedness++;
+	}
+	return packed;
+}
+
+// attribute pointers of a PackedVertex buffer bound to GL_ARRAY_BUFFER, at the locations setup_vertex_model_attributes uses
+inline void setup_packed_vertex_attributes(GLsizei stride = sizeof(PackedVertex))
+{
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, stride, (void*)offsetof(PackedVertex, position));
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(1, 4, GL_INT_2_10_10_10_REV, GL_TRUE, stride, (void*)offsetof(PackedVertex, normal));
+	glEnableVertexAttribArray(2);
+	glVertexAttribPointer(2, 2, GL_UNSIGNED_SHORT, GL_TRUE, stride, (void*)offsetof(PackedVertex, texCoords));
+}
+
+// the same for PackedVertexModel, the tangent (with its w) at location 3 and nothing at the bitangent's location 4
+inline void setup_packed_vertex_model_attributes()
+{
+	setup_packed_vertex_attributes(sizeof(PackedVertexModel));
+	glEnableVertexAttribArray(3);
+	glVertexAttribPointer(3, 4, GL_INT_2_10_10_10_REV, GL_TRUE, sizeof(PackedVertexModel), (void*)offsetof(PackedVertexModel, tangent));
+	glDisableVertexAttribArray(4);
+}
+
+inline void print_vertex_packing(const char *name, const VertexPackingError &error, const VertexQuantization &quantization, size_t floatSize, size_t packedSize)
+{
+	float size = glm::length(quantization.positionScale);
+	std::printf("%s vertex packing: %u vertices, %.1f -> %.1f KB, largest error: position %.2g (%.4f%% of the box), normal %.2f deg, texture coordinate %.2g",
+		name, error.vertices, error.vertices * floatSize / 1024.0, error.vertices * packedSize / 1024.0, error.position,
+		size > 0.0f ? 100.0f * error.position / size : 0.0f, error.normalDegrees, error.texCoord);
+	if (packedSize == sizeof(PackedVertexModel))
+		std::printf(", tangent %.2f deg, %u handedness flips, %u tangents replaced", error.tangentDegrees, error.handedness, error.missingTangents);
+	std::printf("\n");
+}
+#endif
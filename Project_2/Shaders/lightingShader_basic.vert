@@ -8,14 +8,26 @@ out vec3 Normal;
 out vec2 TexCoords;
 
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+// per frame camera, shared by all programs (uniform_blocks.hpp)
+layout (std140) uniform Camera
+{
+    mat4 view;
+    mat4 projection;
+    vec3 viewPos;
+    vec3 viewFront;
+};
+// packed vertices (vertex_packing.hpp) come in normalized to their box, the defaults leave float vertices alone
+uniform vec3 positionOffset = vec3(0.0);
+uniform vec3 positionScale = vec3(1.0);
+uniform vec2 texCoordOffset = vec2(0.0);
+uniform vec2 texCoordScale = vec2(1.0);
 
 void main()
 {
-    FragPos = vec3(model * vec4(aPos, 1.0));
+    vec3 position = positionOffset + positionScale * aPos;
+    FragPos = vec3(model * vec4(position, 1.0));
     Normal = mat3(transpose(inverse(model))) * normalize(aNormal);  
-    TexCoords = aTexCoords;
+    TexCoords = texCoordOffset + texCoordScale * aTexCoords;
     
     gl_Position = projection * view * vec4(FragPos, 1.0);
 }
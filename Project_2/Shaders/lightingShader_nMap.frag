@@ -8,20 +8,18 @@ struct Material {
     float shininess;
 }; 
 
+// ordered so std140 packs it without padding (LightBlock in uniform_blocks.hpp)
 struct Light {
     vec3 position;
-    vec3 TangentLightPos;
-    vec3 direction;
     float cutOff;
+    vec3 direction;
     float outerCutOff;
-  
+    vec3 ambient;
     float constant;
+    vec3 diffuse;
     float linear;
+    vec3 specular;
     float quadratic;
-  
-    vec3 ambient;
-    vec3 diffuse;
-    vec3 specular;       
 };
 
 #define NR_POINT_LIGHTS 4
@@ -36,10 +34,21 @@ in VS_OUT {
     mat3 TBN;
 } fs_in;
 
-uniform vec3 viewPos;
-uniform Light dirLight;
-uniform Light pointLights[NR_POINT_LIGHTS];
-uniform Light spotLight;
+// per frame camera and the scene's lights, shared by all programs (uniform_blocks.hpp).  The spot light is the
+// camera's flashlight: it shines from viewPos along viewFront.
+layout (std140) uniform Camera
+{
+    mat4 view;
+    mat4 projection;
+    vec3 viewPos;
+    vec3 viewFront;
+};
+layout (std140) uniform Lights
+{
+    Light dirLight;
+    Light pointLights[NR_POINT_LIGHTS];
+    Light spotLight;
+};
 uniform Material material;
 
 // function prototypes
@@ -72,8 +81,11 @@ void main()
     // phase 2: point lights
     for(int i = 0; i < NR_POINT_LIGHTS; i++)
         result += max(CalcPointLight(pointLights[i], norm, fs_in.FragPos, viewDir, color, color_spec),vec3(0.0));    
-    // phase 3: spot light
-    result += max(CalcSpotLight(spotLight, norm, fs_in.FragPos, viewDir, color, color_spec),vec3(0.0));
+    // phase 3: spot light, the flashlight
+    Light flashlight = spotLight;
+    flashlight.position = viewPos;
+    flashlight.direction = viewFront;
+    result += max(CalcSpotLight(flashlight, norm, fs_in.FragPos, viewDir, color, color_spec),vec3(0.0));
     
     FragColor = vec4(result, 1.0);
     //FragColor = vec4(fs_in.TangentViewPos, 1.0);
@@ -99,8 +111,6 @@ vec3 CalcDirLight(Light light, vec3 normal, vec3 viewDir, vec3 color, vec3 color
 // calculates the color when using a point light.
 vec3 CalcPointLight(Light light, vec3 normal, vec3 fragPos, vec3 viewDir, vec3 color, vec3 color_spec)
 {
-    light.TangentLightPos = fs_in.TBN * light.position;
-    //vec3 lightDir = normalize(light.TangentLightPos - fragPos);
     vec3 lightDir = fs_in.TBN * normalize(light.position - fs_in.FragPos);
     // diffuse shading
     float diff = max(dot(normal, lightDir), 0.0);
@@ -123,7 +133,6 @@ vec3 CalcPointLight(Light light, vec3 normal, vec3 fragPos, vec3 viewDir, vec3 c
 // calculates the color when using a spot light.
 vec3 CalcSpotLight(Light light, vec3 normal, vec3 fragPos, vec3 viewDir, vec3 color, vec3 color_spec)
 {
-    light.TangentLightPos = fs_in.TBN * light.position;
     vec3 lightDir = normalize(light.position - fragPos);
     // diffuse shading
     float diff = max(dot(normal, lightDir), 0.0);
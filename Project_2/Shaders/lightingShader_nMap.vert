@@ -2,8 +2,8 @@
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec2 aTexCoords;
-layout (location = 3) in vec3 aTangent;
-layout (location = 4) in vec3 aBitangent;
+// w is the side of the bitangent: +1 or -1 for packed vertices, 1 (the default w) for float ones
+layout (location = 3) in vec4 aTangent;
 
 out VS_OUT {
     vec3 FragPos;
@@ -14,24 +14,37 @@ out VS_OUT {
     mat3 TBN;
 } vs_out;
 
-uniform mat4 projection;
-uniform mat4 view;
+// per frame camera, shared by all programs (uniform_blocks.hpp)
+layout (std140) uniform Camera
+{
+    mat4 view;
+    mat4 projection;
+    vec3 viewPos;
+    vec3 viewFront;
+};
+
 uniform mat4 model;
 
 uniform vec3 lightPos;
-uniform vec3 viewPos;
+
+// packed vertices (vertex_packing.hpp) come in normalized to their box, the defaults leave float vertices alone
+uniform vec3 positionOffset = vec3(0.0);
+uniform vec3 positionScale = vec3(1.0);
+uniform vec2 texCoordOffset = vec2(0.0);
+uniform vec2 texCoordScale = vec2(1.0);
 
 void main()
 {
-    vs_out.FragPos = vec3(model * vec4(aPos, 1.0));   
-    vs_out.TexCoords = aTexCoords;
+    vec3 position = positionOffset + positionScale * aPos;
+    vs_out.FragPos = vec3(model * vec4(position, 1.0));   
+    vs_out.TexCoords = texCoordOffset + texCoordScale * aTexCoords;
     
-    vec3 T = normalize(vec3(model * vec4(aTangent, 0.0)));
+    vec3 T = normalize(vec3(model * vec4(aTangent.xyz, 0.0)));
     vec3 N = normalize(vec3(model * vec4(aNormal, 0.0)));
     // re-orthogonalize T with respect to N
     T = normalize(T - dot(T, N) * N);
-    // then retrieve perpendicular vector B with the cross product of T and N
-    vec3 B = cross(N, T);
+    // then retrieve perpendicular vector B with the cross product of T and N, on the side the tangent's w says
+    vec3 B = cross(N, T) * (aTangent.w < 0.0 ? -1.0 : 1.0);
     
     vs_out.TBN = transpose(mat3(T, B, N));
    
@@ -39,6 +52,6 @@ void main()
     vs_out.TangentViewPos  = vs_out.TBN * viewPos;
     vs_out.TangentFragPos  = vs_out.TBN * vs_out.FragPos;
         
-    gl_Position = projection * view * model * vec4(aPos, 1.0);
+    gl_Position = projection * view * model * vec4(position, 1.0);
 }
 
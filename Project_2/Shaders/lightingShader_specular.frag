@@ -7,19 +7,18 @@ struct Material {
     float shininess;
 }; 
 
+// ordered so std140 packs it without padding (LightBlock in uniform_blocks.hpp)
 struct Light {
     vec3 position;
-    vec3 direction;
     float cutOff;
+    vec3 direction;
     float outerCutOff;
-  
+    vec3 ambient;
     float constant;
+    vec3 diffuse;
     float linear;
+    vec3 specular;
     float quadratic;
-  
-    vec3 ambient;
-    vec3 diffuse;
-    vec3 specular;       
 };
 
 #define NR_POINT_LIGHTS 4
@@ -28,10 +27,21 @@ in vec3 FragPos;
 in vec3 Normal;
 in vec2 TexCoords;
 
-uniform vec3 viewPos;
-uniform Light dirLight;
-uniform Light pointLights[NR_POINT_LIGHTS];
-uniform Light spotLight;
+// per frame camera and the scene's lights, shared by all programs (uniform_blocks.hpp).  The spot light is the
+// camera's flashlight: it shines from viewPos along viewFront.
+layout (std140) uniform Camera
+{
+    mat4 view;
+    mat4 projection;
+    vec3 viewPos;
+    vec3 viewFront;
+};
+layout (std140) uniform Lights
+{
+    Light dirLight;
+    Light pointLights[NR_POINT_LIGHTS];
+    Light spotLight;
+};
 uniform Material material;
 
 // function prototypes
@@ -56,8 +66,11 @@ void main()
     // phase 2: point lights
     for(int i = 0; i < NR_POINT_LIGHTS; i++)
         result += CalcPointLight(pointLights[i], norm, FragPos, viewDir);    
-    // phase 3: spot light
-    result += CalcSpotLight(spotLight, norm, FragPos, viewDir);    
+    // phase 3: spot light, the flashlight
+    Light flashlight = spotLight;
+    flashlight.position = viewPos;
+    flashlight.direction = viewFront;
+    result += CalcSpotLight(flashlight, norm, FragPos, viewDir);    
     
     FragColor = vec4(result, 1.0);
 }
@@ -6,15 +6,25 @@ out VS_OUT {
     vec3 normal;
 } vs_out;
 
-uniform mat4 projection;
-uniform mat4 view;
+// per frame camera, shared by all programs (uniform_blocks.hpp)
+layout (std140) uniform Camera
+{
+    mat4 view;
+    mat4 projection;
+    vec3 viewPos;
+    vec3 viewFront;
+};
+
 uniform mat4 model;
+// packed vertices (vertex_packing.hpp) come in normalized to their box, the defaults leave float vertices alone
+uniform vec3 positionOffset = vec3(0.0);
+uniform vec3 positionScale = vec3(1.0);
 
 void main()
 {
     vec3 normal = normalize(aNormal);
     mat3 normalMatrix = mat3(transpose(inverse(view * model)));
     vs_out.normal = normalize(vec3(projection * vec4(normalMatrix * normal, 1.0)));
-    gl_Position = projection * view * model * vec4(aPos, 1.0); 
+    gl_Position = projection * view * model * vec4(positionOffset + positionScale * aPos, 1.0); 
 }
 
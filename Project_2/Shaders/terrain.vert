@@ -0,0 +1,90 @@
+#version 330 core
+layout (location = 0) in vec2 aGrid;
+
+out vec3 FragPos;
+out vec3 Normal;
+out vec2 TexCoords;
+
+// per frame camera, shared by all programs (uniform_blocks.hpp)
+layout (std140) uniform Camera
+{
+    mat4 view;
+    mat4 projection;
+    vec3 viewPos;
+    vec3 viewFront;
+};
+
+// heights (R16), stored x-major like Heightmap::heights.  For streamed terrain this is the low resolution overview.
+uniform sampler2D heightmap;
+// streamed terrain: resident tiles and the tile -> layer+1 table (0 while a tile isn't loaded)
+uniform bool streamed;
+uniform sampler2DArray tileHeights;
+uniform usampler2D tileTable;
+// in-memory heightmap: world space normals (x and z, RG16 snorm) laid out like the heights
+uniform sampler2D normalMap;
+uniform float tileSize;
+// grid points along x and y, and where the [-1,1]x[0,1]x[-1,1] heightmap sits in the world
+uniform vec2 gridSize;
+uniform vec3 terrainOffset;
+uniform vec3 terrainScale;
+
+// node placement: grid cell of the patch corner and grid cells per patch quad
+uniform vec2 nodeOrigin;
+uniform float nodeScale;
+// camera distance where morphing to the next coarser level starts and ends
+uniform vec2 morphRange;
+uniform vec3 cameraPos;
+
+float sampleHeight(vec2 grid)
+{
+    // grid x runs down the texture rows
+    if (streamed)
+    {
+        vec2 tile = min(floor(grid / tileSize), vec2(textureSize(tileTable, 0).yx) - 1.0);
+        uint layer = texelFetch(tileTable, ivec2(tile.yx), 0).r;
+        // tiles hold tileSize+1 samples per side (shared edges), so they filter on their own
+        if (layer > 0u)
+            return textureLod(tileHeights, vec3((grid - tile * tileSize + 0.5).yx / (tileSize + 1.0), float(layer - 1u)), 0.0).r;
+    }
+    // whole heightmap (or the overview while a tile streams in), scaled onto the texture's texel centers
+    vec2 size = vec2(textureSize(heightmap, 0));
+    return textureLod(heightmap, ((grid / (gridSize - 1.0)).yx * (size - 1.0) + 0.5) / size, 0.0).r;
+}
+
+vec3 worldPosition(vec2 grid, float h)
+{
+    vec2 local = 2.0 * grid / (gridSize - 1.0) - 1.0;
+    return terrainOffset + terrainScale * vec3(local.x, h, local.y);
+}
+
+void main()
+{
+    vec2 grid = min(nodeOrigin + aGrid * nodeScale, gridSize - 1.0);
+    vec3 position = worldPosition(grid, sampleHeight(grid));
+
+    // slide odd patch vertices onto their even neighbour so the patch turns into the next coarser one
+    float morph = 0.0;
+    if (morphRange.y > morphRange.x)
+        morph = clamp((distance(cameraPos, position) - morphRange.x) / (morphRange.y - morphRange.x), 0.0, 1.0);
+    vec2 odd = fract(aGrid * 0.5) * 2.0;
+    grid = min(nodeOrigin + (aGrid - odd * morph) * nodeScale, gridSize - 1.0);
+
+    FragPos = worldPosition(grid, sampleHeight(grid));
+
+    TexCoords = grid / (gridSize - 1.0);
+    gl_Position = projection * view * vec4(FragPos, 1.0);
+
+    if (!streamed)
+    {
+        vec2 size = vec2(textureSize(normalMap, 0));
+        vec2 n = textureLod(normalMap, ((grid / (gridSize - 1.0)).yx * (size - 1.0) + 0.5) / size, 0.0).rg;
+        Normal = vec3(n.x, sqrt(max(1.0 - dot(n, n), 0.0)), n.y);
+        return;
+    }
+
+    // streamed tiles have no normal texture, central differences of the finest grid
+    vec2 cell = 2.0 * terrainScale.xz / (gridSize - 1.0);
+    float dx = sampleHeight(grid + vec2(1.0, 0.0)) - sampleHeight(grid - vec2(1.0, 0.0));
+    float dy = sampleHeight(grid + vec2(0.0, 1.0)) - sampleHeight(grid - vec2(0.0, 1.0));
+    Normal = normalize(vec3(-dx * terrainScale.y / (2.0 * cell.x), 1.0, -dy * terrainScale.y / (2.0 * cell.y)));
+}
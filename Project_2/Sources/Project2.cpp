@@ -19,12 +19,118 @@ std::string preamble =
 "Pressing Q will toggle Quaternion Rotation\n "
 "Pressing B will toggle reflections for the box textures\n "
 "Pressing H will toggle heightmap\n "
+"Pressing M will switch the heightmap between LOD terrain and the decimated mesh\n "
 "Pressing N will toggle Normals\n "
 "Pressing P will print information\n\n";
 bool isTpressed = false;
 bool isCpressed = false;
-int main()
+int main(int argc, char **argv)
 {
+	// command line options
+	//   --convert-terrain <image> <out.tiles> [tile size]   cut a (16 bit) heightmap into a tile file and exit
+	//   --terrain <file.tiles>                               stream that terrain instead of the in-memory heightmap
+	//   --heightmap-error <steps>                            error allowed in the decimated heightmap (8 bit height steps, 0 = full grid)
+	//   --no-cache-order                                     keep the plain heightmap triangle order (to compare draw times)
+	//   --no-model-cache                                     always import the models with Assimp (cold load times)
+	//   --no-mesh-optimize                                   draw the models as imported (to compare draw times)
+	//   --no-obj-reader                                      import the .obj models with Assimp instead of the OBJ reader
+	//   --no-multi-draw                                      draw the models mesh by mesh instead of one multi-draw per material
+	//   --no-lod                                             always draw the models at full detail (no simplified levels)
+	//   --statues <count>                                    line the ride with count small Vader statues, drawn instanced
+	//   --no-vertex-packing                                  upload float vertices instead of the 16/20 byte quantized ones
+	//   --serial-shaders                                     build and check each shader program before the next (setup times)
+	//   --no-program-cache                                   compile every shader from source (cold shader setup times)
+	//   --no-uniform-cache                                   look uniform locations up in the driver on every set (to compare CPU times)
+	//   --release-cpu-data                                   free the CPU copies of the geometry once it is uploaded
+	//   --upload-budget <MB>                                 texture bytes streamed to the GPU per frame (0 = upload at once)
+	//   --benchmark-normals [size]                           time the heightmap normal pass on a size^2 grid and exit
+	//   --benchmark-decode                                   time decoding the scene images on 1 and on all hardware threads and exit
+	//   --benchmark-obj [model.obj ...]                      time importing the models (vader and nanosuit by default) with
+	//                                                        Assimp and with the OBJ reader and exit
+	//   --convert-textures [--compress] [image ...]          write texture containers (pre-mipmapped, BC1/BC3 with --compress)
+	//                                                        for the images, or the scene images if none are given, and exit
+	const char *terrainTilesPath = NULL;
+	float heightmapError = 4.0f;
+	bool heightmapCacheOrder = true;
+	bool useModelCache = true;
+	bool optimizeMeshes = true;
+	bool objReader = true;
+	bool multiDraw = true;
+	bool modelLods = true;
+	int statueCount = 0;
+	bool packVertices = true;
+	bool cacheUniforms = true;
+	bool serialShaders = false;
+	bool releaseCpuData = false;
+	float uploadBudget = 8.0f;
+	for (int i = 1; i < argc; i++)
+	{
+		if (std::strcmp(argv[i], "--convert-terrain") == 0 && i + 2 < argc)
+			return convert_terrain_tiles(argv[i + 1], argv[i + 2], i + 3 < argc ? std::atoi(argv[i + 3]) : 256) ? 0 : 1;
+		if (std::strcmp(argv[i], "--terrain") == 0 && i + 1 < argc)
+			terrainTilesPath = argv[++i];
+		if (std::strcmp(argv[i], "--benchmark-normals") == 0)
+		{
+			benchmark_normals(i + 1 < argc ? std::atoi(argv[i + 1]) : 8192);
+			return 0;
+		}
+		if (std::strcmp(argv[i], "--benchmark-decode") == 0)
+		{
+			benchmark_image_decode(scene_images());
+			return 0;
+		}
+		if (std::strcmp(argv[i], "--benchmark-obj") == 0)
+		{
+			std::vector<std::string> models(argv + i + 1, argv + argc);
+			if (models.empty())
+			{
+				models.push_back("../Project_2/Media/vader/vader.obj");
+				models.push_back("../Project_2/Media/nanosuit/nanosuit.obj");
+			}
+			Model::benchmark_import(models);
+			return 0;
+		}
+		if (std::strcmp(argv[i], "--convert-textures") == 0)
+		{
+			bool compress = i + 1 < argc && std::strcmp(argv[i + 1], "--compress") == 0;
+			std::vector<std::string> images(argv + i + 1 + (compress ? 1 : 0), argv + argc);
+			if (images.empty())
+				images = scene_images();
+			bool converted = true;
+			for (unsigned int t = 0; t < images.size(); t++)
+				converted = convert_texture_container(images[t], compress) && converted;
+			return converted ? 0 : 1;
+		}
+		if (std::strcmp(argv[i], "--no-model-cache") == 0)
+			useModelCache = false;
+		if (std::strcmp(argv[i], "--no-mesh-optimize") == 0)
+			optimizeMeshes = false;
+		if (std::strcmp(argv[i], "--no-obj-reader") == 0)
+			objReader = false;
+		if (std::strcmp(argv[i], "--no-multi-draw") == 0)
+			multiDraw = false;
+		if (std::strcmp(argv[i], "--no-lod") == 0)
+			modelLods = false;
+		if (std::strcmp(argv[i], "--statues") == 0 && i + 1 < argc)
+			statueCount = std::max(0, std::atoi(argv[++i]));
+		if (std::strcmp(argv[i], "--no-vertex-packing") == 0)
+			packVertices = false;
+		if (std::strcmp(argv[i], "--serial-shaders") == 0)
+			serialShaders = true;
+		if (std::strcmp(argv[i], "--no-program-cache") == 0)
+			program_cache_enabled() = false;
+		if (std::strcmp(argv[i], "--no-uniform-cache") == 0)
+			cacheUniforms = false;
+		if (std::strcmp(argv[i], "--release-cpu-data") == 0)
+			releaseCpuData = true;
+		if (std::strcmp(argv[i], "--upload-budget") == 0 && i + 1 < argc)
+			uploadBudget = (float)std::atof(argv[++i]);
+		if (std::strcmp(argv[i], "--no-cache-order") == 0)
+			heightmapCacheOrder = false;
+		if (std::strcmp(argv[i], "--heightmap-error") == 0 && i + 1 < argc)
+			heightmapError = (float)std::atof(argv[++i]);
+	}
+
 	// glfw: initialize and configure
 	// ------------------------------
 
@@ -71,13 +177,23 @@ int main()
 
 	// build and compile shaders
 	// -------------------------
+	// the programs build on the driver's threads if it can, and are only waited for when they are first used
+	shader_build_settings().deferred = !serialShaders;
+	bool parallelShaders = !serialShaders && enable_parallel_shader_compile((GLADloadproc)glfwGetProcAddress);
+	std::chrono::high_resolution_clock::time_point shadersStart = std::chrono::high_resolution_clock::now();
 	Shader lightingShader_basic("../Project_2/Shaders/lightingShader_basic.vert", "../Project_2/Shaders/lightingShader_basic.frag");
 	Shader reflectionShader("../Project_2/Shaders/reflectionShader.vert", "../Project_2/Shaders/reflectionShader.frag");
 	Shader skyboxShader("../Project_2/Shaders/skyboxShader.vert", "../Project_2/Shaders/skyboxShader.frag");
 	Shader lightingShader_specular("../Project_2/Shaders/lightingShader_specular.vert", "../Project_2/Shaders/lightingShader_specular.frag");
 	Shader normalShader("../Project_2/Shaders/normal.vert", "../Project_2/Shaders/normal.frag", "../Project_2/Shaders/normal.geom");
 	Shader lightingShader_nMap("../Project_2/Shaders/lightingShader_nMap.vert", "../Project_2/Shaders/lightingShader_nMap.frag");
+	Shader lightingShader_nMap_instanced("../Project_2/Shaders/lightingShader_nMap_instanced.vert", "../Project_2/Shaders/lightingShader_nMap.frag");
+	Shader terrainShader("../Project_2/Shaders/terrain.vert", "../Project_2/Shaders/lightingShader_basic.frag");
 	Shader railShader("","");
+	double shadersSubmitMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - shadersStart).count();
+	Shader *shaders[] = { &lightingShader_basic, &reflectionShader, &skyboxShader, &lightingShader_specular, &normalShader,
+		&lightingShader_nMap, &lightingShader_nMap_instanced, &terrainShader, &railShader };
+	const unsigned int shaderCount = sizeof(shaders) / sizeof(shaders[0]);
 
 	// set up vertex data (and buffer(s)) and configure vertex attributes
 	// ------------------------------------------------------------------
@@ -158,26 +274,27 @@ int main()
 	// load textures
 	// -------------
 
-	std::vector<std::string> faces =
-	{
-		"../Project_2/Media/skybox_new/left.png",
-		"../Project_2/Media/skybox_new/right.png",
-		"../Project_2/Media/skybox_new/top.png",
-		"../Project_2/Media/skybox_new/bottom.png",
-		"../Project_2/Media/skybox_new/back.png",
-		"../Project_2/Media/skybox_new/front.png"
-	};
-	unsigned int cubemapTexture = loadCubemap(faces);
+	// decoded images reach the GPU a budget per frame, so the big ones don't stall
+	TextureStreamer textureStreamer((size_t)(uploadBudget * 1024.0f * 1024.0f));
+	if (uploadBudget > 0.0f)
+		texture_cache().set_streamer(&textureStreamer);
 
-	// init heatmap
-	Heightmap heightmap("../Project_2/Media/heightmaps/hflab4.jpg");
-	unsigned int heightmap_texture = loadTexture("../Project_2/Media/heightmaps/hflab4.jpg");
-	unsigned int diffuseMap = loadTexture("../Project_2/Media/textures/container2_specular.png");
-	unsigned int specularMap = loadTexture("../Project_2/Media/textures/container2_specular.png");
+	// every image below starts decoding on the image decoder's threads now, the loaders wait only for what they upload
+	texture_cache().prefetch(scene_images());
+	unsigned int cubemapTexture = loadCubemap(skyboxFaces);
 
-	Track track("spline/track.sp");
-	unsigned int rail_texture = loadTexture("../Project_2/Media/textures/black.jpg");
-	unsigned int plank_texture = loadTexture("../Project_2/Media/textures/marble.jpg");
+	// init heatmap
+	Heightmap heightmap(heightmapImage, true, heightmapError, heightmapCacheOrder, packVertices);
+	TerrainTiles *terrainTiles = terrainTilesPath ? new TerrainTiles(terrainTilesPath) : NULL;
+	Terrain terrain = (terrainTiles && terrainTiles->is_open()) ? Terrain(*terrainTiles) : Terrain(heightmap);
+	unsigned int heightmap_texture = heightmap.texture;
+	unsigned int diffuseMap = loadTexture(containerImage);
+	unsigned int specularMap = loadTexture(containerImage);
+	GpuTimer heightmapTimer;
+
+	Track track("spline/track.sp", packVertices);
+	unsigned int rail_texture = loadTexture(railImage);
+	unsigned int plank_texture = loadTexture(plankImage);
 
 	// positions of the point lights
 	glm::vec3 pointLightPositions[] = {
@@ -186,14 +303,76 @@ int main()
 		glm::vec3(-4.0f,  2.0f, -12.0f),
 		glm::vec3(0.0f,  0.0f, -3.0f)
 	};
+	// camera (updated every frame) and lights (only when they change) of all the lit shaders
+	UniformBuffer<CameraBlock> cameraBlock(CAMERA_BLOCK_BINDING);
+	UniformBuffer<LightsBlock> lightsBlock(LIGHTS_BLOCK_BINDING);
+	lightsBlock.edit() = scene_lights(pointLightPositions);
 
 	// load models
 	// -----------
-	Model ourModel("../Project_2/Media/vader/vader.obj");
-	Model cityModel("../Project_2/Media/Organodron City/Organodron City.obj");
-	Model cartModel("../Project_2/Media/Rescue ship/Falcon t45 Rescue ship/Falcon t45 Rescue ship flying.obj");
+	Model ourModel, cityModel, cartModel;
+	ourModel.optimizeMeshes = cityModel.optimizeMeshes = cartModel.optimizeMeshes = optimizeMeshes;
+	ourModel.objReader = cityModel.objReader = cartModel.objReader = objReader;
+	ourModel.multiDraw = cityModel.multiDraw = cartModel.multiDraw = multiDraw;
+	ourModel.buildLods = cityModel.buildLods = cartModel.buildLods = modelLods;
+	ourModel.packVertices = cityModel.packVertices = cartModel.packVertices = packVertices;
+	ModelLoader modelLoader;
+	modelLoader.add(ourModel, "../Project_2/Media/vader/vader.obj", false, useModelCache);
+	modelLoader.add(cityModel, "../Project_2/Media/Organodron City/Organodron City.obj", false, useModelCache);
+	modelLoader.add(cartModel, "../Project_2/Media/Rescue ship/Falcon t45 Rescue ship/Falcon t45 Rescue ship flying.obj", false, useModelCache);
+	modelLoader.load();
+	GpuTimer vaderTimer, cityTimer;
+
+	// the statues along the ride don't move, their matrices are uploaded once
+	InstanceBuffer statues;
+	std::vector<glm::mat4> statueMatrices = statue_matrices(track, statueCount);
+	statues.update(statueMatrices);
+
+	// bounds of the unit cube the boxes are drawn from, and of all the statues together (they don't move)
+	Bounds boxBounds = bounds_of_box(glm::vec3(-0.5f), glm::vec3(0.5f));
+	Bounds statueBounds = bounds_of_box(glm::vec3(0.0f), glm::vec3(0.0f));
+	for (unsigned int i = 0; i < statueMatrices.size(); i++)
+		statueBounds = i == 0 ? transform_bounds(ourModel.bounds, statueMatrices[i]) : bounds_union(statueBounds, transform_bounds(ourModel.bounds, statueMatrices[i]));
+	FrustumCuller culler;
+
+	// the scene is on the GPU now, the CPU copies of the geometry are only needed to look at (or rebuild) it
+	if (releaseCpuData)
+	{
+		heightmap.release_cpu_data();
+		track.release_cpu_data();
+		ourModel.release_cpu_data();
+		cityModel.release_cpu_data();
+		cartModel.release_cpu_data();
+	}
+	std::printf("Resident set after loading: %.1f MB (geometry CPU copies %s)\n", resident_set_size() / (1024.0 * 1024.0),
+		releaseCpuData ? "released" : "kept");
+	std::printf("Texture cache: %u requests, %u files decoded, %u textures uploaded (%u images from containers) in %.1f ms, %u resident\n",
+		texture_cache().requests, texture_cache().decodes, texture_cache().uploads, texture_cache().containers, texture_cache().loadMilliseconds,
+		texture_cache().resident());
+	std::printf("Image decoding: %u images, %.1f ms of decode time on %u threads, the GL thread waited %.1f ms (compare with --benchmark-decode)\n",
+		image_decoder().decoded_count(), image_decoder().busy_milliseconds(), image_decoder().threads(), texture_cache().waitMilliseconds);
 	// shader configuration
 	// --------------------
+	// first use of the programs: wait for what the driver hasn't built yet while everything above was loading
+	std::chrono::high_resolution_clock::time_point shadersWaitStart = std::chrono::high_resolution_clock::now();
+	unsigned int shadersReady = 0;
+	for (unsigned int s = 0; s < shaderCount; s++)
+	{
+		if (shaders[s]->ready())
+			shadersReady++;
+		// back to a glGetUniformLocation per setter call
+		if (!cacheUniforms)
+			shaders[s]->dropUniformTable();
+		shaders[s]->finish();
+		// camera and lights come from the shared uniform buffers (uniform_blocks.hpp)
+		bind_uniform_blocks(*shaders[s]);
+	}
+	std::printf("Shaders: %u programs submitted in %.1f ms (%s), %u built by their first use, then waited %.1f ms; "
+		"%u compiled, %u from the program cache (%u cached binaries rejected)%s\n", shaderCount, shadersSubmitMilliseconds,
+		serialShaders ? "one by one" : parallelShaders ? "parallel shader compile" : "no parallel shader compile", shadersReady,
+		std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - shadersWaitStart).count(),
+		program_cache_stats().compiled, program_cache_stats().loaded, program_cache_stats().rejected,
+		program_binaries_supported() ? "" : ", the driver has no program binaries");
 	reflectionShader.use();
 	reflectionShader.setInt("skybox", 0);
 
@@ -203,6 +382,9 @@ int main()
 	lightingShader_basic.use();
 	lightingShader_basic.setInt("material.diffuse", 0);
 
+	terrainShader.use();
+	terrainShader.setInt("material.diffuse", 0);
+
 	lightingShader_specular.use();
 	lightingShader_specular.setInt("material.diffuse", 0);
 	lightingShader_specular.setInt("material.specular", 1);
@@ -212,6 +394,15 @@ int main()
 	lightingShader_nMap.setInt("material.specular", 1);
 	lightingShader_nMap.setInt("material.normal", 2);
 
+	lightingShader_nMap_instanced.use();
+	lightingShader_nMap_instanced.setInt("material.diffuse", 0);
+	lightingShader_nMap_instanced.setInt("material.specular", 1);
+	lightingShader_nMap_instanced.setInt("material.normal", 2);
+
+	// counters of the instanced statue draw (printed with P)
+	double statueSubmitMilliseconds = 0.0;
+	unsigned int statueDrawCalls = 0, statueTriangles = 0;
+
 	// render loop
 	// -----------
 	while (!glfwWindowShouldClose(window))
@@ -224,10 +415,16 @@ int main()
 		// weighted avg for framerate
 		framerate = (0.4f / (deltaTime)+1.6f * framerate) / 2.0f;
 
+		// heap allocations of the frame and of the model draws alone (printed with P)
+		unsigned long long frameAllocations = allocation_count(), drawAllocations = 0, allocationsBefore;
+
 		// input
 		// -----
 		processInput(window);
 
+		// the next rows of textures that are still loading
+		textureStreamer.update();
+
 		// render
 		// ------
 		glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
@@ -242,55 +439,38 @@ int main()
 		// Setup shader info
 		reflectionShader.use();
 		reflectionShader.setMat4("model", model);
-		reflectionShader.setMat4("view", view);
-		reflectionShader.setMat4("projection", projection);
-		reflectionShader.setVec3("cameraPos", camera.Position);
 
 		lightingShader_basic.use();
 		lightingShader_basic.setMat4("model", model);
-		lightingShader_basic.setMat4("view", view);
-		lightingShader_basic.setMat4("projection", projection);
 
 		lightingShader_specular.use();
 		lightingShader_specular.setMat4("model", model);
-		lightingShader_specular.setMat4("view", view);
-		lightingShader_specular.setMat4("projection", projection);
 
 		lightingShader_nMap.use();
 		lightingShader_nMap.setMat4("model", model);
-		lightingShader_nMap.setMat4("view", view);
-		lightingShader_nMap.setMat4("projection", projection);
 
-		set_lighting(lightingShader_basic, pointLightPositions);
-		set_lighting(lightingShader_specular, pointLightPositions);
-		set_lighting(lightingShader_nMap, pointLightPositions);
+		// view, projection and the camera's position and direction for every program at once; the lights only go up
+		// when they changed
+		std::chrono::high_resolution_clock::time_point blocksStart = std::chrono::high_resolution_clock::now();
+		CameraBlock &cameraData = cameraBlock.edit();
+		cameraData.view = view;
+		cameraData.projection = projection;
+		cameraData.viewPos = camera.Position;
+		cameraData.viewFront = camera.Front;
+		cameraBlock.update();
+		lightsBlock.update();
+		double blocksMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - blocksStart).count();
 		
 		// Turn rotation rate into quaturian and cumulate the rotations
 		rotation *= glm::quat(rotation_rate * deltaTime);
 		// add rotation rate to euler rotation
 		rotation_euler += rotation_rate * deltaTime;
 
-		if (drawBoxes)
-		{ // if you want normal looking boxes, use ourShader
-			lightingShader_specular.use();
-			glActiveTexture(GL_TEXTURE0);
-			glBindTexture(GL_TEXTURE_2D, diffuseMap);
-			glActiveTexture(GL_TEXTURE1);
-			glBindTexture(GL_TEXTURE_2D, specularMap);
-			lightingShader_specular.setFloat("material.shininess", 16.0f);
-		}
-		else
-		{  // if you want reflective boxes
-			reflectionShader.use();
-			glActiveTexture(GL_TEXTURE0);
-			glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapTexture);
-			//glBindTexture(GL_TEXTURE_HEIGHT, heightmap_texture);
-		}
-		
-		glBindVertexArray(cubeVAO);
+		// where everything is this frame, and which of it is in view: one culling pass over all the objects
+		glm::mat4 boxModels[28];
 		for (unsigned int i = 1; i < 28; i++)
 		{
-			// calculate the model matrix for each object and pass it to shader before drawing
+			// calculate the model matrix for each object
 			glm::mat4 box_model;
 
 			// Translate box for final offset
@@ -321,6 +501,69 @@ int main()
 
 			// Scale the boxes 
 			box_model = glm::scale(box_model, scale);
+			boxModels[i] = box_model;
+		}
+		glm::mat4 vaderMatrix;
+		vaderMatrix = glm::translate(vaderMatrix, glm::vec3(0.0f, 5.0f, -5.0f)); // translate it down so it's at the center of the scene
+		vaderMatrix = glm::rotate(vaderMatrix, glm::radians(180.0f), glm::vec3(0.0f, 1.0f, 0.0f)); // Rotated it towards the light.  Praise the sun
+		vaderMatrix = glm::scale(vaderMatrix, glm::vec3(1.5f, 1.5f, 1.5f));	// it's a bit too big for our scene, so scale it down
+		glm::mat4 cityMatrix;
+		cityMatrix = glm::translate(cityMatrix, glm::vec3(0.0f, -5.0f, -5.0f)); // translate it down so it's at the center of the scene
+		cityMatrix = glm::rotate(cityMatrix, glm::radians(180.0f), glm::vec3(0.0f, 1.0f, 0.0f)); // Rotated it towards the light.  Praise the sun
+		cityMatrix = glm::scale(cityMatrix, glm::vec3(0.1f, 0.1f, 0.1f));	// it's a bit too big for our scene, so scale it down
+		if (isCpressed) {
+			cartCamera.ProcessTrackMovement(deltaTime, track);
+
+			modelC = glm::mat4();  // Set to idenity matrix
+			modelC = glm::translate(modelC, (cartCamera.Position - (0.1f*cartCamera.Up)));
+			glm::mat4 rotationMatrix;
+			rotationMatrix = { glm::vec4(cartCamera.Right, 0), glm::vec4(cartCamera.Up, 0), glm::vec4(cartCamera.Front, 0), glm::vec4(0,0,0,1)};
+			modelC = modelC * rotationMatrix;
+			modelC = glm::scale(modelC, glm::vec3(0.002f, 0.002f, 0.002f));	// it's a bit too big for our scene, so scale it down
+		}
+
+		std::chrono::high_resolution_clock::time_point cullStart = std::chrono::high_resolution_clock::now();
+		// objects that aren't drawn this frame get an id no object has (never visible) and aren't counted
+		const unsigned int notDrawn = ~0u;
+		culler.clear();
+		unsigned int boxIds[28];
+		for (unsigned int i = 1; i < 28; i++)
+			boxIds[i] = culler.add(transform_bounds(boxBounds, boxModels[i]));
+		unsigned int vaderId = culler.add(transform_bounds(ourModel.bounds, vaderMatrix));
+		unsigned int statuesId = statues.count > 0 ? culler.add(statueBounds) : notDrawn;
+		unsigned int cityId = culler.add(transform_bounds(cityModel.bounds, cityMatrix));
+		unsigned int cartId = isCpressed ? culler.add(transform_bounds(cartModel.bounds, modelC)) : notDrawn;
+		unsigned int heightmapId = drawHeightmap && !drawTerrainLOD ? culler.add(transform_bounds(heightmap.bounds, heightmap.model_matrix())) : notDrawn;
+		unsigned int trackId = culler.add(track.bounds);
+		culler.cull(Frustum(projection * view));
+		double cullMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - cullStart).count();
+
+		if (drawBoxes)
+		{ // if you want normal looking boxes, use ourShader
+			lightingShader_specular.use();
+			glActiveTexture(GL_TEXTURE0);
+			bind_texture(GL_TEXTURE_2D, diffuseMap);
+			glActiveTexture(GL_TEXTURE1);
+			bind_texture(GL_TEXTURE_2D, specularMap);
+			lightingShader_specular.setFloat("material.shininess", 16.0f);
+		}
+		else
+		{  // if you want reflective boxes
+			reflectionShader.use();
+			// the boxes are float vertices, the track leaves its quantization behind in this program
+			VertexQuantization::identity().apply(reflectionShader);
+			glActiveTexture(GL_TEXTURE0);
+			bind_texture(GL_TEXTURE_CUBE_MAP, cubemapTexture);
+			//glBindTexture(GL_TEXTURE_HEIGHT, heightmap_texture);
+		}
+		
+		glBindVertexArray(cubeVAO);
+		for (unsigned int i = 1; i < 28; i++)
+		{
+			// skip the boxes the camera can't see
+			if (!culler.visible(boxIds[i]))
+				continue;
+			glm::mat4 box_model = boxModels[i];
 
 			// Send the model matrix to the shader (which ever one we are using).  
 			if (drawBoxes)
@@ -343,66 +586,91 @@ int main()
 
 				normalShader.use();
 				normalShader.setMat4("model", box_model);
-				normalShader.setMat4("projection", projection);
-				normalShader.setMat4("view", view);
+				// the boxes are float vertices, the heightmap and track normals below leave their quantization behind
+				VertexQuantization::identity().apply(normalShader);
 				glDrawArrays(GL_TRIANGLES, 0, 36);
 			}
 		}
 
 		glBindVertexArray(0);
 
-		// Draw the heightmap
+		// Draw the heightmap, either as quadtree LOD terrain or as the decimated static mesh
 		if (drawHeightmap)
 		{
-			heightmap.Draw(lightingShader_basic, heightmap_texture);
+			heightmapTimer.begin();
+			if (drawTerrainLOD)
+			{
+				terrain.update(camera.Position, projection, view, camera.Zoom, (float)SCR_HEIGHT);
+				terrain.Draw(terrainShader, heightmap_texture);
+			}
+			else
+			{
+				if (culler.visible(heightmapId))
+					heightmap.Draw(lightingShader_basic, heightmap_texture);
+			}
+			heightmapTimer.end();
 		}
 
 
 
 		// Loading model of the crysis character.  Provided so you can create better scenes.
 		//  Check out "https://learnopengl.com/#!Model-Loading/Assimp" for more details
+
+		// Draw Darth Vader's statues along the ride, all of them in one pass over his meshes (before him, his Draw counters are the ones P prints)
+		if (culler.visible(statuesId))
+		{
+			lightingShader_nMap_instanced.use();
+			lightingShader_nMap_instanced.setFloat("material.shininess", 16.0f);
+			ourModel.DrawInstanced(lightingShader_nMap_instanced, statues.get(), statues.count);
+			statueSubmitMilliseconds = ourModel.submitMilliseconds;
+			statueDrawCalls = ourModel.drawCalls;
+			statueTriangles = ourModel.trianglesDrawn;
+		}
 		lightingShader_nMap.use();
 
 		// Draw Darth Vader
 		lightingShader_nMap.setFloat("material.shininess", 16.0f);
-		model = glm::mat4();  // Set to idenity matrix
-		model = glm::translate(model, glm::vec3(0.0f, 5.0f, -5.0f)); // translate it down so it's at the center of the scene
-		model = glm::rotate(model, glm::radians(180.0f), glm::vec3(0.0f, 1.0f, 0.0f)); // Rotated it towards the light.  Praise the sun
-		model = glm::scale(model, glm::vec3(1.5f, 1.5f, 1.5f));	// it's a bit too big for our scene, so scale it down
+		model = vaderMatrix;
 		lightingShader_nMap.setMat4("model", model);
-		ourModel.Draw(lightingShader_nMap);
+		ourModel.select_lod(model, view, projection, (float)SCR_HEIGHT);
+		vaderTimer.begin();
+		allocationsBefore = allocation_count();
+		if (culler.visible(vaderId))
+			ourModel.Draw(lightingShader_nMap);
+		drawAllocations += allocation_count() - allocationsBefore;
+		vaderTimer.end();
 
 		//draw Darth Vaders castle
 		lightingShader_nMap.setFloat("material.shininess", 16.0f);
-		model = glm::mat4();  // Set to idenity matrix
-		model = glm::translate(model, glm::vec3(0.0f, -5.0f, -5.0f)); // translate it down so it's at the center of the scene
-		model = glm::rotate(model, glm::radians(180.0f), glm::vec3(0.0f, 1.0f, 0.0f)); // Rotated it towards the light.  Praise the sun
-		model = glm::scale(model, glm::vec3(0.1f, 0.1f, 0.1f));	// it's a bit too big for our scene, so scale it down
+		model = cityMatrix;
 		lightingShader_nMap.setMat4("model", model);
-		cityModel.Draw(lightingShader_nMap);
+		cityModel.select_lod(model, view, projection, (float)SCR_HEIGHT);
+		cityTimer.begin();
+		allocationsBefore = allocation_count();
+		if (culler.visible(cityId))
+			cityModel.Draw(lightingShader_nMap);
+		drawAllocations += allocation_count() - allocationsBefore;
+		cityTimer.end();
 		
 		//draw Darth Vaders carts
 		
 		
-		if (drawBoxes)
+		if (drawBoxes && culler.visible(trackId))
 		{
 			lightingShader_basic.use();
 			lightingShader_nMap.setFloat("Material.shininess", 10.0f);
 			track.Draw(lightingShader_basic, rail_texture, plank_texture);
 		}
-		else
+		else if (culler.visible(trackId))
 		{
 			reflectionShader.use();
-			lightingShader_nMap.setFloat("Material.shininess", 10.0f);
-			track.Draw(lightingShader_basic, rail_texture, plank_texture);
+			track.Draw(reflectionShader, rail_texture, plank_texture);
 		}
 		
 		// Draw the normals if desired for heightmap and nano suit
 		if (drawNormals)
 		{
 			normalShader.use();
-			normalShader.setMat4("projection", projection);
-			normalShader.setMat4("view", view);
 			heightmap.Draw(normalShader, heightmap_texture);
 			
 			normalShader.use();
@@ -412,18 +680,12 @@ int main()
 		if (isTpressed) {
 			camera.ProcessTrackMovement(deltaTime, track);
 		}
-		if (isCpressed) {
-			cartCamera.ProcessTrackMovement(deltaTime, track);
-			
+		if (culler.visible(cartId)) {
+			// the cart moved along the track before culling
 			lightingShader_nMap.use();
 			lightingShader_nMap.setFloat("material.shininess", 16.0f);
-			modelC = glm::mat4();  // Set to idenity matrix
-			modelC = glm::translate(modelC, (cartCamera.Position - (0.1f*cartCamera.Up)));
-			glm::mat4 rotationMatrix;
-			rotationMatrix = { glm::vec4(cartCamera.Right, 0), glm::vec4(cartCamera.Up, 0), glm::vec4(cartCamera.Front, 0), glm::vec4(0,0,0,1)};
-			modelC = modelC * rotationMatrix;
-			modelC = glm::scale(modelC, glm::vec3(0.002f, 0.002f, 0.002f));	// it's a bit too big for our scene, so scale it down
 			lightingShader_nMap.setMat4("model", modelC);
+			cartModel.select_lod(modelC, view, projection, (float)SCR_HEIGHT);
 			cartModel.Draw(lightingShader_nMap);
 		}
 		// draw skybox as last
@@ -435,11 +697,44 @@ int main()
 		// skybox cube
 		glBindVertexArray(skyboxVAO);
 		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapTexture);
+		bind_texture(GL_TEXTURE_CUBE_MAP, cubemapTexture);
 		glDrawArrays(GL_TRIANGLES, 0, 36);
 		glBindVertexArray(0);
 		glDepthFunc(GL_LESS); // set depth function back to default
 		
+		// Print render counters (requested with P)
+		if (printStats)
+		{
+			if (drawTerrainLOD)
+				std::printf("Heightmap: LOD terrain, %.3f ms GPU\n", heightmapTimer.milliseconds);
+			else
+				std::printf("Heightmap: decimated mesh, %u triangles, %.3f ms GPU\n", heightmap.indexCount / 3, heightmapTimer.milliseconds);
+			std::printf("Models (%s): vader %.3f ms GPU, city %.3f ms GPU\n", optimizeMeshes ? "optimized" : "as imported",
+				vaderTimer.milliseconds, cityTimer.milliseconds);
+			std::printf("City: %u meshes in %u draw calls (%s), %.3f ms CPU submit\n", (unsigned int)cityModel.meshes.size(), cityModel.drawCalls,
+				multiDraw ? "multi-draw per material" : "mesh by mesh", cityModel.submitMilliseconds);
+			std::printf("Model triangles submitted: vader %u, city %u, ship %u (%u, %u, %u at full detail)\n", ourModel.trianglesDrawn,
+				cityModel.trianglesDrawn, isCpressed ? cartModel.trianglesDrawn : 0, ourModel.trianglesFullDetail, cityModel.trianglesFullDetail,
+				isCpressed ? cartModel.trianglesFullDetail : 0);
+			std::printf("Uniform blocks: camera %u bytes per frame, lights %u bytes uploaded %u times so far, %.3f ms CPU\n",
+				(unsigned int)sizeof(CameraBlock), (unsigned int)sizeof(LightsBlock), lightsBlock.uploads, blocksMilliseconds);
+			std::printf("Culling: %u objects tested, %u visible, %.3f ms\n", culler.tested, culler.visibleCount, cullMilliseconds);
+			if (statues.count > 0)
+				std::printf("Statues: %d instances in %u draw calls, %u triangles, %.3f ms CPU submit\n", statues.count, statueDrawCalls,
+					statueTriangles, statueSubmitMilliseconds);
+			std::printf("Resident set: %.1f MB\n", resident_set_size() / (1024.0 * 1024.0));
+			std::printf("Heap allocations: %llu in model draws, %llu this frame so far\n", drawAllocations, allocation_count() - frameAllocations);
+			std::printf("Texture streaming: %u textures pending, %u done, %.1f MB uploaded at %.1f MB per frame, %u frames waited for a buffer, "
+				"%u binds of unfinished textures got a stand-in\n", textureStreamer.pending(), textureStreamer.streamed,
+				textureStreamer.bytesUploaded / (1024.0 * 1024.0), uploadBudget, textureStreamer.skippedFrames, texture_cache().standInBinds);
+			std::printf("Terrain: %u levels, %u nodes tested, %u drawn, %u triangles\n", terrain.levels, terrain.nodesTested, terrain.nodesSelected, terrain.trianglesDrawn);
+			if (terrainTiles)
+				std::printf("Terrain tiles: %u wanted, %u resident, %u read, %u uploaded, %u evicted this frame\n", terrainTiles->tilesWanted,
+					terrainTiles->tilesResident, terrainTiles->tilesDecoded, terrainTiles->tilesUploaded, terrainTiles->tilesEvicted);
+			std::printf("\n");
+			printStats = false;
+		}
+
 		// glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
 		// -------------------------------------------------------------------------------
 		glfwSwapBuffers(window);
@@ -453,6 +748,22 @@ int main()
 	glDeleteBuffers(1, &VBO);
 	glDeleteBuffers(1, &skyboxVAO);
 	heightmap.delete_buffers();
+	track.delete_buffers();
+	ourModel.delete_buffers();
+	cityModel.delete_buffers();
+	cartModel.delete_buffers();
+	statues.delete_buffers();
+	cameraBlock.delete_buffers();
+	lightsBlock.delete_buffers();
+	heightmapTimer.delete_queries();
+	vaderTimer.delete_queries();
+	cityTimer.delete_queries();
+	terrain.delete_buffers();
+	delete terrainTiles;
+	// the textures main acquired (skybox, container, track) go with everything still in the cache
+	texture_cache().delete_textures();
+	texture_cache().set_streamer(NULL);
+	textureStreamer.delete_buffers();
 
 	glfwTerminate();
 	return 0;
@@ -503,6 +814,8 @@ void processInput(GLFWwindow *window)
 	{
 		if (glfwGetKey(window, GLFW_KEY_H) == GLFW_PRESS)
 			drawHeightmap ? drawHeightmap = false : drawHeightmap = true;
+		if (glfwGetKey(window, GLFW_KEY_M) == GLFW_PRESS)
+			drawTerrainLOD = !drawTerrainLOD;
 		if (glfwGetKey(window, GLFW_KEY_B) == GLFW_PRESS)
 			drawBoxes ? drawBoxes = false : drawBoxes = true;
 		if (glfwGetKey(window, GLFW_KEY_N) == GLFW_PRESS)
@@ -555,6 +868,9 @@ void processInput(GLFWwindow *window)
 			quaterians ? std::printf("Using Quaterians\n") : std::printf("Not Using Quaterians\n");
 			std::printf("\n");
 
+			// the render loop prints its own counters at the end of this frame
+			printStats = true;
+
 			
 		}
 		if (glfwGetKey(window, GLFW_KEY_T) == GLFW_PRESS)
@@ -668,42 +984,11 @@ void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
 }
 
 // utility function for loading a 2D texture from file
+// (shared through the texture cache, loading the same file again returns the same texture)
 // ---------------------------------------------------
 unsigned int loadTexture(char const * path)
 {
-	unsigned int textureID;
-	glGenTextures(1, &textureID);
-
-	int width, height, nrComponents;
-	unsigned char *data = stbi_load(path, &width, &height, &nrComponents, 0);
-	if (data)
-	{
-		GLenum format;
-		if (nrComponents == 1)
-			format = GL_RED;
-		else if (nrComponents == 3)
-			format = GL_RGB;
-		else if (nrComponents == 4)
-			format = GL_RGBA;
-
-		glBindTexture(GL_TEXTURE_2D, textureID);
-		glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-		glGenerateMipmap(GL_TEXTURE_2D);
-
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-		stbi_image_free(data);
-	}
-	else
-	{
-		std::cout << "Texture failed to load at path: " << path << std::endl;
-		stbi_image_free(data);
-	}
-
-	return textureID;
+	return texture_cache().acquire(path);
 }
 
 // loads a cubemap texture from 6 individual texture faces
@@ -717,93 +1002,81 @@ unsigned int loadTexture(char const * path)
 // -------------------------------------------------------
 unsigned int loadCubemap(std::vector<std::string> faces)
 {
-	unsigned int textureID;
-	glGenTextures(1, &textureID);
-	glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
+	return texture_cache().acquire_cubemap(faces);
+}
 
-	int width, height, nrComponents;
-	for (unsigned int i = 0; i < faces.size(); i++)
+// count statue transforms spread evenly along the track's control polygon, on alternating sides and facing it
+std::vector<glm::mat4> statue_matrices(const Track &track, int count)
+{
+	std::vector<glm::mat4> matrices;
+	if (track.controlPoints.size() < 2)
+		return matrices;
+	float segments = float(track.controlPoints.size() - 1);
+	for (int i = 0; i < count; i++)
 	{
-		unsigned char *data = stbi_load(faces[i].c_str(), &width, &height, &nrComponents, 0);
-		if (data)
-		{
-			glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-			stbi_image_free(data);
-		}
-		else
-		{
-			std::cout << "Cubemap texture failed to load at path: " << faces[i] << std::endl;
-			stbi_image_free(data);
-		}
+		float t = segments * (float(i) + 0.5f) / float(count);
+		unsigned int k = std::min((unsigned int)t, (unsigned int)track.controlPoints.size() - 2);
+		glm::vec3 a = track.controlPoints[k], b = track.controlPoints[k + 1];
+		glm::vec3 along = b - a;
+		if (glm::length(along) < 1e-6f)
+			along = glm::vec3(1.0f, 0.0f, 0.0f);
+		glm::vec3 side = glm::cross(glm::normalize(along), glm::vec3(0.0f, 1.0f, 0.0f));
+		if (glm::length(side) < 1e-6f)
+			side = glm::vec3(0.0f, 0.0f, 1.0f);
+		side = glm::normalize(side) * (i % 2 == 0 ? 3.0f : -3.0f);
+		glm::vec3 position = glm::mix(a, b, t - float(k)) + side;
+
+		glm::mat4 statue;
+		statue = glm::translate(statue, position);
+		// face the track
+		statue = glm::rotate(statue, std::atan2(-side.x, -side.z), glm::vec3(0.0f, 1.0f, 0.0f));
+		statue = glm::scale(statue, glm::vec3(0.3f));
+		matrices.push_back(statue);
 	}
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	return matrices;
+}
 
-	return textureID;
+// the image files main loads itself, skybox faces first
+std::vector<std::string> scene_images()
+{
+	std::vector<std::string> images = skyboxFaces;
+	images.push_back(heightmapImage);
+	images.push_back(containerImage);
+	images.push_back(railImage);
+	images.push_back(plankImage);
+	return images;
 }
 
-void set_lighting(Shader shader, glm::vec3 * pointLightPositions)
+// the scene's lights for the Lights uniform block: the sun, four point lights and the camera's flashlight (which the shaders
+// place at the camera, see uniform_blocks.hpp)
+LightsBlock scene_lights(const glm::vec3 *pointLightPositions)
 {
-	shader.use();
-	shader.setVec3("viewPos", camera.Position);
-
-	/*
-	Here we set all the uniforms for the 5/6 types of lights we have. We have to set them manually and index
-	the proper PointLight struct in the array to set each uniform variable. This can be done more code-friendly
-	by defining light types as classes and set their values in there, or by using a more efficient uniform approach
-	by using 'Uniform buffer objects', but that is something we'll discuss in the 'Advanced GLSL' tutorial.
-	*/
+	LightsBlock lights = LightsBlock();
 	// directional light
-	//shader.setVec3("dirLight.direction", -0.2f, -1.0f, -0.3f);
-	shader.setVec3("dirLight.direction", 0.24f, -.3f, 0.91f); // Tried to target the sun
-	shader.setVec3("dirLight.ambient", 0.5f, 0.5f, 0.5f);
-	shader.setVec3("dirLight.diffuse", 0.9f, 0.9f, 0.9f);
-	shader.setVec3("dirLight.specular", 0.9f, 0.9f, 0.9f);
-	// point light 1
-	shader.setVec3("pointLights[0].position", pointLightPositions[0]);
-	shader.setVec3("pointLights[0].ambient", 0.05f, 0.05f, 0.05f);
-	shader.setVec3("pointLights[0].diffuse", 0.8f, 0.8f, 0.8f);
-	shader.setVec3("pointLights[0].specular", 1.0f, 1.0f, 1.0f);
-	shader.setFloat("pointLights[0].constant", 1.0f);
-	shader.setFloat("pointLights[0].linear", 0.09);
-	shader.setFloat("pointLights[0].quadratic", 0.032);
-	// point light 2
-	shader.setVec3("pointLights[1].position", pointLightPositions[1]);
-	shader.setVec3("pointLights[1].ambient", 0.05f, 0.05f, 0.05f);
-	shader.setVec3("pointLights[1].diffuse", 0.8f, 0.8f, 0.8f);
-	shader.setVec3("pointLights[1].specular", 1.0f, 1.0f, 1.0f);
-	shader.setFloat("pointLights[1].constant", 1.0f);
-	shader.setFloat("pointLights[1].linear", 0.09);
-	shader.setFloat("pointLights[1].quadratic", 0.032);
-	// point light 3
-	shader.setVec3("pointLights[2].position", pointLightPositions[2]);
-	shader.setVec3("pointLights[2].ambient", 0.05f, 0.05f, 0.05f);
-	shader.setVec3("pointLights[2].diffuse", 0.8f, 0.8f, 0.8f);
-	shader.setVec3("pointLights[2].specular", 1.0f, 1.0f, 1.0f);
-	shader.setFloat("pointLights[2].constant", 1.0f);
-	shader.setFloat("pointLights[2].linear", 0.09);
-	shader.setFloat("pointLights[2].quadratic", 0.032);
-	// point light 4
-	shader.setVec3("pointLights[3].position", pointLightPositions[3]);
-	shader.setVec3("pointLights[3].ambient", 0.05f, 0.05f, 0.05f);
-	shader.setVec3("pointLights[3].diffuse", 0.8f, 0.8f, 0.8f);
-	shader.setVec3("pointLights[3].specular", 1.0f, 1.0f, 1.0f);
-	shader.setFloat("pointLights[3].constant", 1.0f);
-	shader.setFloat("pointLights[3].linear", 0.09);
-	shader.setFloat("pointLights[3].quadratic", 0.032);
+	//lights.dirLight.direction = glm::vec3(-0.2f, -1.0f, -0.3f);
+	lights.dirLight.direction = glm::vec3(0.24f, -.3f, 0.91f); // Tried to target the sun
+	lights.dirLight.ambient = glm::vec3(0.5f, 0.5f, 0.5f);
+	lights.dirLight.diffuse = glm::vec3(0.9f, 0.9f, 0.9f);
+	lights.dirLight.specular = glm::vec3(0.9f, 0.9f, 0.9f);
+	// point lights
+	for (int i = 0; i < NR_POINT_LIGHTS; i++)
+	{
+		lights.pointLights[i].position = pointLightPositions[i];
+		lights.pointLights[i].ambient = glm::vec3(0.05f, 0.05f, 0.05f);
+		lights.pointLights[i].diffuse = glm::vec3(0.8f, 0.8f, 0.8f);
+		lights.pointLights[i].specular = glm::vec3(1.0f, 1.0f, 1.0f);
+		lights.pointLights[i].constant = 1.0f;
+		lights.pointLights[i].linear = 0.09f;
+		lights.pointLights[i].quadratic = 0.032f;
+	}
 	// spotLight
-	shader.setVec3("spotLight.position", camera.Position);
-	shader.setVec3("spotLight.direction", camera.Front);
-	shader.setVec3("spotLight.ambient", 0.0f, 0.0f, 0.0f);
-	shader.setVec3("spotLight.diffuse", 1.0f, 1.0f, 1.0f);
-	shader.setVec3("spotLight.specular", 1.0f, 1.0f, 1.0f);
-	shader.setFloat("spotLight.constant", 1.0f);
-	shader.setFloat("spotLight.linear", 0.09);
-	shader.setFloat("spotLight.quadratic", 0.032);
-	shader.setFloat("spotLight.cutOff", glm::cos(glm::radians(12.5f)));
-	shader.setFloat("spotLight.outerCutOff", glm::cos(glm::radians(15.0f)));
-
+	lights.spotLight.ambient = glm::vec3(0.0f, 0.0f, 0.0f);
+	lights.spotLight.diffuse = glm::vec3(1.0f, 1.0f, 1.0f);
+	lights.spotLight.specular = glm::vec3(1.0f, 1.0f, 1.0f);
+	lights.spotLight.constant = 1.0f;
+	lights.spotLight.linear = 0.09f;
+	lights.spotLight.quadratic = 0.032f;
+	lights.spotLight.cutOff = glm::cos(glm::radians(12.5f));
+	lights.spotLight.outerCutOff = glm::cos(glm::radians(15.0f));
+	return lights;
 }